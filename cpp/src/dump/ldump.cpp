@@ -12,6 +12,10 @@
 
 #include <climits>
 #include <cstddef>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "lua.hpp"
 
@@ -56,12 +60,12 @@ struct DumpState
 	template<typename V>
 	void dumpVar (V* v)
 	{
-		dumpBlock(v, 1);
+		dumpVector(v, 1);
 	}
 
 	void dumpLiteral (const char* s)
 	{
-		dumpBlock(s, sizeof(s) - sizeof(char));
+		dumpBlock(s, strlen(s));
 	}
 
 	void dumpByte(int y)
@@ -250,3 +254,170 @@ int luaU::dump(lua_State *L, const Proto *f, lua_Writer w, void *data, int strip
 	D.dumpFunction(f, nullptr);
 	return D.status;
 }
+
+
+
+/*
+** {======================================================
+** Images
+** =======================================================
+*/
+
+struct ImageDump
+{
+	int strip;
+	std::string out; /* the image, built in memory */
+	std::unordered_map<const TString *, l_uint32> refs;
+	std::vector<ImageString> strings;
+
+	/* append 'n' items, aligned for their type; returns their offset */
+	template<typename T>
+	l_uint32 append (const T *v, size_t n)
+	{
+		if (n == 0)
+			return 0;
+		out.append((alignof(T) - out.size() % alignof(T)) % alignof(T), '\0');
+		size_t offset = out.size();
+		out.append(reinterpret_cast<const char *>(v), n * sizeof(T));
+		return static_cast<l_uint32>(offset);
+	}
+
+	l_uint32 string (const char *s, size_t len)
+	{
+		strings.push_back({append(s, len + 1), static_cast<l_uint32>(len)});
+		return static_cast<l_uint32>(strings.size());
+	}
+
+	l_uint32 string (const TString *s)
+	{
+		if (s == nullptr)
+			return 0;
+		auto [it, isnew] = refs.try_emplace(s, 0);
+		if (isnew)
+			it->second = string(getstr(s), tsslen(s));
+		return it->second;
+	}
+
+	void proto (ImageProto &ip, const Proto *f, const TString *psource,
+					const std::vector<l_uint32> &children);
+};
+
+
+void ImageDump::proto (ImageProto &ip, const Proto *f, const TString *psource,
+							  const std::vector<l_uint32> &children)
+{
+	int i;
+	ip.source = (strip || f->source == psource) ? 0 : string(f->source);
+	ip.linedefined = f->linedefined;
+	ip.lastlinedefined = f->lastlinedefined;
+	ip.numparams = f->numparams;
+	ip.is_vararg = f->is_vararg;
+	ip.maxstacksize = f->maxstacksize;
+	ip.sizecode = f->sizecode;
+	ip.code = append(f->code, f->sizecode);
+	std::vector<ImageConstant> ks(f->sizek);
+	for (i = 0; i < f->sizek; i++)
+	{
+		const TValue *o = &f->k[i];
+		ks[i].tt = ttypetag(o);
+		switch (ks[i].tt)
+		{
+			case LUA_VNUMFLT:
+				ks[i].v.n = fltvalue(o);
+				break;
+			case LUA_VNUMINT:
+				ks[i].v.i = ivalue(o);
+				break;
+			case LUA_VSHRSTR:
+			case LUA_VLNGSTR:
+				ks[i].str = string(tsvalue(o));
+				break;
+			default:
+				lua_assert(ks[i].tt == LUA_VNIL || ks[i].tt == LUA_VFALSE ||
+							  ks[i].tt == LUA_VTRUE);
+		}
+	}
+	ip.sizek = f->sizek;
+	ip.k = append(ks.data(), ks.size());
+	std::vector<ImageUpvalue> ups(f->sizeupvalues);
+	for (i = 0; i < f->sizeupvalues; i++)
+	{
+		ups[i].name = strip ? 0 : string(f->upvalues[i].name);
+		ups[i].instack = f->upvalues[i].instack;
+		ups[i].idx = f->upvalues[i].idx;
+		ups[i].kind = f->upvalues[i].kind;
+	}
+	ip.sizeupvalues = f->sizeupvalues;
+	ip.upvalues = append(ups.data(), ups.size());
+	ip.sizep = f->sizep;
+	ip.p = append(children.data(), children.size());
+	ip.sizelineinfo = strip ? 0 : f->sizelineinfo;
+	ip.lineinfo = append(f->lineinfo, ip.sizelineinfo);
+	ip.sizeabslineinfo = strip ? 0 : f->sizeabslineinfo;
+	ip.abslineinfo = append(f->abslineinfo, ip.sizeabslineinfo);
+	std::vector<ImageLocVar> vars(strip ? 0 : f->sizelocvars);
+	for (i = 0; i < static_cast<int>(vars.size()); i++)
+		vars[i] = {string(f->locvars[i].varname), f->locvars[i].startpc,
+					  f->locvars[i].endpc};
+	ip.sizelocvars = static_cast<int>(vars.size());
+	ip.locvars = append(vars.data(), vars.size());
+}
+
+
+/*
+** dump Lua function as an image (see 'ImageHeader'), built whole in
+** memory and handed to the writer in one piece
+*/
+int luaU::dumpimage(lua_State *L, const Proto *f, lua_Writer w, void *data, int strip)
+{
+	ImageDump D {strip, {}, {}, {}};
+	/* number prototypes parents first */
+	std::vector<const Proto *> protos {f};
+	std::vector<const TString *> psources {nullptr};
+	for (size_t i = 0; i < protos.size(); i++)
+	{
+		for (int j = 0; j < protos[i]->sizep; j++)
+		{
+			protos.push_back(protos[i]->p[j]);
+			psources.push_back(protos[i]->source);
+		}
+	}
+	std::vector<ImageProto> ips(protos.size());
+	D.out.assign(sizeof(ImageHeader), '\0');
+	l_uint32 next = 1; /* index of the first child of the current proto */
+	std::vector<l_uint32> children;
+	for (size_t i = 0; i < protos.size(); i++)
+	{
+		children.clear();
+		for (int j = 0; j < protos[i]->sizep; j++)
+			children.push_back(next++);
+		D.proto(ips[i], protos[i], psources[i], children);
+	}
+	ImageHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.signature, LUA_SIGNATURE, sizeof(h.signature));
+	h.version = LUAC_VERSION;
+	h.format = LUAC_FORMAT_IMAGE;
+	memcpy(h.data, LUAC_DATA, sizeof(h.data));
+	h.sizes[0] = sizeof(Instruction);
+	h.sizes[1] = sizeof(lua_Integer);
+	h.sizes[2] = sizeof(lua_Number);
+	h.nupvalues = cast_byte(f->sizeupvalues);
+	h.checkint = LUAC_INT;
+	h.checknum = LUAC_NUM;
+	h.nprotos = static_cast<l_uint32>(ips.size());
+	h.protos = D.append(ips.data(), ips.size());
+	h.nstrings = static_cast<l_uint32>(D.strings.size());
+	h.strings = D.append(D.strings.data(), D.strings.size());
+	D.out.append((8 - D.out.size() % 8) % 8, '\0');
+	if (D.out.size() > 0xFFFFFFFFu)
+		return 1; /* offsets would not fit */
+	h.size = static_cast<l_uint32>(D.out.size());
+	memcpy(D.out.data(), &h, sizeof(h));
+	lua_unlock(L);
+	int status = (*w)(L, D.out.data(), D.out.size(), data);
+	lua_lock(L);
+	return status;
+}
+
+/* }====================================================== */
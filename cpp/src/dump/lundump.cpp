@@ -11,7 +11,11 @@
 
 
 #include <climits>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <new>
 
 #include "lua.hpp"
 
@@ -20,6 +24,7 @@
 #include "lfunc.hpp"
 #include "lmem.hpp"
 #include "lobject.hpp"
+#include "lstate.hpp"
 #include "lstring.hpp"
 #include "lundump.hpp"
 #include "lzio.hpp"
@@ -242,7 +247,7 @@ static void loadUpvalues(LoadState *S, Proto *f)
 
 	for (i = 0; i < n; i++)
 	{
-		auto upv = f->upvalues[i];
+		auto &upv = f->upvalues[i];
 		/* following calls can raise errors */
 		upv.instack = loadByte(S);
 		upv.idx = loadByte(S);
@@ -322,14 +327,11 @@ static void fchecksize(LoadState *S, size_t size, const char *tname)
 
 #define checksize(S,t)	fchecksize(S,sizeof(t),#t)
 
+/*
+** Check the header after its format byte
+*/
 static void checkHeader(LoadState *S)
 {
-	/* skip 1st char (already read and checked) */
-	checkliteral(S, &LUA_SIGNATURE[1], "not a binary chunk");
-	if (loadByte(S) != LUAC_VERSION)
-		error(S, "version mismatch");
-	if (loadByte(S) != LUAC_FORMAT)
-		error(S, "format mismatch");
 	checkliteral(S, LUAC_DATA, "corrupted chunk");
 	checksize(S, Instruction);
 	checksize(S, lua_Integer);
@@ -341,20 +343,95 @@ static void checkHeader(LoadState *S)
 }
 
 
+static const char *chunkname(const char *name)
+{
+	if (*name == '@' || *name == '=')
+		return name + 1;
+	else if (*name == LUA_SIGNATURE[0])
+		return "binary string";
+	else
+		return name;
+}
+
+
+static void freeimage(void *ud, const void *data, size_t size)
+{
+	UNUSED(ud);
+	UNUSED(size);
+	std::free(const_cast<void *>(data));
+}
+
+
+/*
+** An image met in a stream: read the rest of it into memory, as if it
+** had been mapped, and load it from there.
+*/
+static LClosure *streamimage(LoadState *S)
+{
+	ZIO *Z = S->Z;
+	size_t size = 6; /* header bytes already read */
+	size_t cap = 1 << 16;
+	std::unique_ptr<char, decltype(&std::free)> data(
+		static_cast<char *>(std::malloc(cap)), &std::free);
+	if (!data)
+		luaD::lthrow(S->L, LUA_ERRMEM);
+	std::memcpy(data.get(), LUA_SIGNATURE, 4);
+	data.get()[4] = cast_char(LUAC_VERSION);
+	data.get()[5] = cast_char(LUAC_FORMAT_IMAGE);
+	for (;;)
+	{
+		if (Z->n == 0)
+		{
+			if (Z->fill() == EOZ)
+				break;
+			Z->n++; /* give back the char 'fill' took */
+			Z->p--;
+		}
+		if (Z->n > cap - size)
+		{
+			while (Z->n > cap - size)
+				cap *= 2;
+			char *newdata = static_cast<char *>(std::realloc(data.get(), cap));
+			if (newdata == NULL)
+				luaD::lthrow(S->L, LUA_ERRMEM);
+			data.release();
+			data.reset(newdata);
+		}
+		std::memcpy(data.get() + size, Z->p, Z->n);
+		size += Z->n;
+		Z->p += Z->n;
+		Z->n = 0;
+	}
+	ChunkImage *im = luaU::newimage(data.release(), size, freeimage, NULL);
+	if (im == NULL)
+		luaD::lthrow(S->L, LUA_ERRMEM);
+	struct Ref
+	{
+		ChunkImage *im;
+		~Ref () { luaU::releaseimage(im); }
+	} ref {im}; /* prototypes take their own references */
+	return luaU::undumpimage(S->L, im, S->name);
+}
+
+
 /*
 ** Load precompiled chunk.
 */
 LClosure *luaU::undump(lua_State *L, ZIO *Z, const char *name)
 {
 	LoadState S;
-	if (*name == '@' || *name == '=')
-		S.name = name + 1;
-	else if (*name == LUA_SIGNATURE[0])
-		S.name = "binary string";
-	else
-		S.name = name;
+	S.name = chunkname(name);
 	S.L = L;
 	S.Z = Z;
+	/* skip 1st char (already read and checked) */
+	checkliteral(&S, &LUA_SIGNATURE[1], "not a binary chunk");
+	if (loadByte(&S) != LUAC_VERSION)
+		error(&S, "version mismatch");
+	int format = loadByte(&S);
+	if (format == LUAC_FORMAT_IMAGE)
+		return streamimage(&S);
+	if (format != LUAC_FORMAT)
+		error(&S, "format mismatch");
 	checkHeader(&S);
 	LClosure *cl = luaF::newLclosure(L, loadByte(&S));
 	setclLvalue2s(L, L->top.p, cl);
@@ -366,3 +443,391 @@ LClosure *luaU::undump(lua_State *L, ZIO *Z, const char *name)
 	luai_verifycode(L, cl->p);
 	return cl;
 }
+
+
+
+/*
+** {======================================================
+** Images
+** =======================================================
+*/
+
+ChunkImage *luaU::newimage(const void *data, size_t size,
+									lua_ImageRelease release, void *ud)
+{
+	ChunkImage *im = new (std::nothrow) ChunkImage;
+	if (im == NULL)
+	{
+		if (release)
+			release(ud, data, size);
+		return NULL;
+	}
+	im->refs.store(1, std::memory_order_relaxed);
+	im->data = static_cast<const char *>(data);
+	im->size = size;
+	im->release = release;
+	im->ud = ud;
+	return im;
+}
+
+
+void luaU::retainimage(ChunkImage *im)
+{
+	im->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void luaU::releaseimage(ChunkImage *im)
+{
+	if (im->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		if (im->release)
+			im->release(im->ud, im->data, im->size);
+		delete im;
+	}
+}
+
+
+struct ImageLoad
+{
+	lua_State *L;
+	ChunkImage *im;
+	const char *name;
+	size_t size; /* as the header says */
+	const ImageHeader *h;
+	const ImageString *strings;
+	const ImageProto *protos;
+
+	l_noret error (const char *why)
+	{
+		luaO_pushfstring(L, "%s: bad binary format (%s)", name, why);
+		luaD::lthrow(L, LUA_ERRSYNTAX);
+	}
+
+	/* 'n' items of type 'T' at 'offset', checked to be in the image */
+	template<typename T>
+	const T *at (l_uint32 offset, size_t n)
+	{
+		if (n == 0)
+			return NULL;
+		if (offset % alignof(T) != 0 || offset > size ||
+			n > (size - offset) / sizeof(T))
+			error("truncated chunk");
+		return reinterpret_cast<const T *>(im->data + offset);
+	}
+
+	/* the string 'ref' refers to */
+	TString *string (Proto *f, l_uint32 ref)
+	{
+		if (ref == 0)
+			return NULL;
+		if (ref > h->nstrings)
+			error("bad string reference");
+		const ImageString &is = strings[ref - 1];
+		const char *s = at<char>(is.offset, size_t(is.len) + 1);
+		TString *ts = luaS::newlstr(L, s, is.len);
+		luaC_objbarrier(L, f, ts);
+		return ts;
+	}
+
+	void header ();
+	void stub (l_uint32 index, Proto *f, TString *psource);
+	void body (Proto *f);
+	void debug (Proto *f);
+};
+
+
+void ImageLoad::header ()
+{
+	if (reinterpret_cast<uintptr_t>(im->data) % alignof(ImageHeader) != 0)
+		error("misaligned image");
+	if (im->size < sizeof(ImageHeader))
+		error("truncated chunk");
+	h = reinterpret_cast<const ImageHeader *>(im->data);
+	if (memcmp(h->data, LUAC_DATA, sizeof(h->data)) != 0)
+		error("corrupted chunk");
+	if (h->sizes[0] != sizeof(Instruction))
+		error("Instruction size mismatch");
+	if (h->sizes[1] != sizeof(lua_Integer))
+		error("lua_Integer size mismatch");
+	if (h->sizes[2] != sizeof(lua_Number))
+		error("lua_Number size mismatch");
+	if (h->checkint != LUAC_INT)
+		error("integer format mismatch");
+	if (h->checknum != LUAC_NUM)
+		error("float format mismatch");
+	if (h->size > im->size)
+		error("truncated chunk");
+	size = h->size;
+	if (h->nprotos == 0)
+		error("no main function");
+	strings = at<ImageString>(h->strings, h->nstrings);
+	protos = at<ImageProto>(h->protos, h->nprotos);
+}
+
+
+/*
+** Make 'f' a stub of prototype 'index': what creating and calling a
+** closure needs, with the arrays the VM only reads left in the image.
+** Its constants and nested prototypes wait for 'body', which runs when
+** the function is first called (see 'luaU::loadbody'). The names of
+** its variables wait for 'debug', which runs only when something asks
+** for them (see 'luaU::loaddebug'); line information is read in place.
+*/
+void ImageLoad::stub (l_uint32 index, Proto *f, TString *psource)
+{
+	const ImageProto &ip = protos[index];
+	int i;
+	f->source = string(f, ip.source);
+	if (f->source == NULL) /* no source in dump? */
+		f->source = psource; /* reuse parent's source */
+	f->linedefined = ip.linedefined;
+	f->lastlinedefined = ip.lastlinedefined;
+	f->numparams = ip.numparams;
+	f->is_vararg = ip.is_vararg;
+	f->maxstacksize = ip.maxstacksize;
+	luaU::retainimage(im);
+	f->image = im; /* from now on, 'freeproto' leaves the arrays below alone */
+	f->lazy = cast_int(index) + 1;
+	f->lazydebug = cast_int(index) + 1;
+	f->code = const_cast<Instruction *>(at<Instruction>(ip.code, ip.sizecode));
+	f->sizecode = ip.sizecode;
+	f->lineinfo = const_cast<ls_byte *>(at<ls_byte>(ip.lineinfo, ip.sizelineinfo));
+	f->sizelineinfo = ip.sizelineinfo;
+	f->abslineinfo = const_cast<AbsLineInfo *>(
+		at<AbsLineInfo>(ip.abslineinfo, ip.sizeabslineinfo));
+	f->sizeabslineinfo = ip.sizeabslineinfo;
+	const ImageUpvalue *ups = at<ImageUpvalue>(ip.upvalues, ip.sizeupvalues);
+	f->upvalues = luaM::newvectorchecked<Upvaldesc>(L, ip.sizeupvalues);
+	f->sizeupvalues = ip.sizeupvalues;
+	for (i = 0; i < ip.sizeupvalues; i++) /* make array valid for GC */
+		f->upvalues[i].name = NULL;
+	for (i = 0; i < ip.sizeupvalues; i++)
+	{
+		f->upvalues[i].instack = ups[i].instack;
+		f->upvalues[i].idx = ups[i].idx;
+		f->upvalues[i].kind = ups[i].kind;
+	}
+}
+
+
+/*
+** Load the rest of stub 'f'. Nested prototypes must come after their
+** parent, so that a bad image cannot make a function its own ancestor.
+*/
+void ImageLoad::body (Proto *f)
+{
+	l_uint32 index = cast_uint(f->lazy - 1);
+	if (index >= h->nprotos)
+		error("bad function reference");
+	const ImageProto &ip = protos[index];
+	int i;
+	/* drop what a failed attempt may have left */
+	luaM::freearray(L, f->k, f->sizek);
+	luaM::freearray(L, f->p, f->sizep);
+	f->k = NULL;
+	f->sizek = 0;
+	f->p = NULL;
+	f->sizep = 0;
+	/* constants */
+	const ImageConstant *ks = at<ImageConstant>(ip.k, ip.sizek);
+	f->k = luaM::newvectorchecked<TValue>(L, ip.sizek);
+	f->sizek = ip.sizek;
+	for (i = 0; i < ip.sizek; i++)
+		setnilvalue(&f->k[i]);
+	for (i = 0; i < ip.sizek; i++)
+	{
+		TValue *o = &f->k[i];
+		switch (ks[i].tt)
+		{
+			case LUA_VNIL:
+				break;
+			case LUA_VFALSE:
+				setbfvalue(o);
+				break;
+			case LUA_VTRUE:
+				setbtvalue(o);
+				break;
+			case LUA_VNUMFLT:
+				setfltvalue(o, ks[i].v.n);
+				break;
+			case LUA_VNUMINT:
+				setivalue(o, ks[i].v.i);
+				break;
+			case LUA_VSHRSTR:
+			case LUA_VLNGSTR:
+			{
+				TString *ts = string(f, ks[i].str);
+				if (ts == NULL)
+					error("bad format for constant string");
+				setsvalue2n(L, o, ts);
+				break;
+			}
+			default:
+				error("bad constant");
+		}
+	}
+	/* nested functions, as stubs */
+	const l_uint32 *ps = at<l_uint32>(ip.p, ip.sizep);
+	f->p = luaM::newvectorchecked<Proto *>(L, ip.sizep);
+	f->sizep = ip.sizep;
+	for (i = 0; i < ip.sizep; i++)
+		f->p[i] = NULL;
+	for (i = 0; i < ip.sizep; i++)
+	{
+		if (ps[i] <= index || ps[i] >= h->nprotos)
+			error("bad function reference");
+		f->p[i] = luaF::newproto(L);
+		luaC_objbarrier(L, f, f->p[i]);
+		stub(ps[i], f->p[i], f->source);
+	}
+	f->lazy = 0;
+	luai_verifycode(L, f);
+}
+
+
+/*
+** Load the names of the upvalues and local variables of stub 'f'
+*/
+void ImageLoad::debug (Proto *f)
+{
+	l_uint32 index = cast_uint(f->lazydebug - 1);
+	if (index >= h->nprotos)
+		error("bad function reference");
+	const ImageProto &ip = protos[index];
+	int i;
+	/* drop what a failed attempt may have left */
+	luaM::freearray(L, f->locvars, f->sizelocvars);
+	f->locvars = NULL;
+	f->sizelocvars = 0;
+	const ImageUpvalue *ups = at<ImageUpvalue>(ip.upvalues, ip.sizeupvalues);
+	for (i = 0; i < f->sizeupvalues; i++)
+		f->upvalues[i].name = string(f, ups[i].name);
+	const ImageLocVar *vars = at<ImageLocVar>(ip.locvars, ip.sizelocvars);
+	f->locvars = luaM::newvectorchecked<LocVar>(L, ip.sizelocvars);
+	f->sizelocvars = ip.sizelocvars;
+	for (i = 0; i < ip.sizelocvars; i++)
+		f->locvars[i].varname = NULL;
+	for (i = 0; i < ip.sizelocvars; i++)
+	{
+		f->locvars[i].varname = string(f, vars[i].varname);
+		f->locvars[i].startpc = vars[i].startpc;
+		f->locvars[i].endpc = vars[i].endpc;
+	}
+	f->lazydebug = 0;
+}
+
+
+/*
+** Set up 'S' to load more of stub 'f'. The image was checked when the
+** stub was made, but for what only the rest of the stub refers to.
+*/
+static void reopen(ImageLoad &S, Proto *f)
+{
+	if (f->source != NULL)
+		S.name = chunkname(getstr(f->source));
+	S.h = reinterpret_cast<const ImageHeader *>(S.im->data);
+	S.size = S.h->size;
+	S.strings = reinterpret_cast<const ImageString *>(S.im->data + S.h->strings);
+	S.protos = reinterpret_cast<const ImageProto *>(S.im->data + S.h->protos);
+}
+
+
+/*
+** Load the body of a prototype left as a stub by 'undumpimage'
+*/
+void luaU::loadbody(lua_State *L, Proto *f)
+{
+	lua_assert(f->lazy && f->image != NULL);
+	ImageLoad S {L, f->image, "?", 0, NULL, NULL, NULL};
+	reopen(S, f);
+	S.body(f);
+}
+
+
+/*
+** Load the variable names of a prototype left as a stub by
+** 'undumpimage', for the debug interface
+*/
+void luaU::loaddebug(lua_State *L, Proto *f)
+{
+	lua_assert(f->lazydebug && f->image != NULL);
+	ImageLoad S {L, f->image, "?", 0, NULL, NULL, NULL};
+	reopen(S, f);
+	S.debug(f);
+}
+
+
+/*
+** Load everything still missing under 'f', for whoever needs the whole
+** tree (e.g. 'luaU::dump')
+*/
+void luaU::loadtree(lua_State *L, Proto *f)
+{
+	if (f->lazy)
+		luaU::loadbody(L, f);
+	if (f->lazydebug)
+		luaU::loaddebug(L, f);
+	for (int i = 0; i < f->sizep; i++)
+		luaU::loadtree(L, f->p[i]);
+}
+
+
+struct ImageRead
+{
+	const char *p;
+	size_t n;
+};
+
+
+static const char *readimage(lua_State *L, void *ud, size_t *size)
+{
+	auto *r = static_cast<ImageRead *>(ud);
+	UNUSED(L);
+	if (r->n == 0)
+		return NULL;
+	*size = r->n;
+	r->n = 0;
+	return r->p;
+}
+
+
+/*
+** Load a precompiled chunk held in memory. An image is used in place,
+** with its prototypes each keeping a reference to 'im', and loaded
+** lazily: the main function is left a stub, as is each nested function
+** until its parent is called. A chunk in the standard format is just
+** read from 'im'.
+*/
+LClosure *luaU::undumpimage(lua_State *L, ChunkImage *im, const char *name)
+{
+	if (im->size < 6 || memcmp(im->data, LUA_SIGNATURE, 4) != 0)
+	{
+		luaO_pushfstring(L, "%s: bad binary format (not a binary chunk)",
+							  chunkname(name));
+		luaD::lthrow(L, LUA_ERRSYNTAX);
+	}
+	if (im->data[5] != LUAC_FORMAT_IMAGE)
+	{
+		ImageRead r {im->data, im->size};
+		ZIO z;
+		z.init(L, readimage, &r);
+		z.zgetc(); /* skip 1st char, as 'f_parser' does */
+		return luaU::undump(L, &z, name);
+	}
+	ImageLoad S {L, im, chunkname(name), 0, NULL, NULL, NULL};
+	S.header();
+	if (im->data[4] != LUAC_VERSION)
+		S.error("version mismatch");
+	LClosure *cl = luaF::newLclosure(L, S.h->nupvalues);
+	setclLvalue2s(L, L->top.p, cl);
+	luaD::inctop(L);
+	cl->p = luaF::newproto(L);
+	luaC_objbarrier(L, cl, cl->p);
+	S.stub(0, cl->p, NULL);
+	if (cl->nupvalues != cl->p->sizeupvalues)
+		S.error("bad main function");
+	return cl;
+}
+
+/* }====================================================== */
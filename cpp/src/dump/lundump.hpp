@@ -7,6 +7,8 @@
 #ifndef lundump_h
 #define lundump_h
 
+#include <atomic>
+
 #include "llimits.hpp"
 #include "lobject.hpp"
 #include "lzio.hpp"
@@ -23,13 +25,121 @@ constexpr auto LUAC_NUM =	static_cast<lua_Number>(370.5);
 */
 constexpr auto LUAC_VERSION =  (((LUA_VERSION_NUM / 100) * 16) + LUA_VERSION_NUM % 100);
 constexpr auto LUAC_FORMAT =	0;	/* this is the official format */
+constexpr auto LUAC_FORMAT_IMAGE =	1;	/* laid out to be used in place */
+
+
+/*
+** Image format: a precompiled chunk laid out so that a loader can point
+** prototypes' code and line information straight into it, e.g. from a
+** read-only mapping of the file, and create each string once from a
+** table of them. Everything is in native byte order and aligned for its
+** type; offsets count from the start of the image (which the loader
+** keeps aligned to at least 8 bytes). Prototypes are listed parents
+** first; the main function is the first one.
+*/
+struct ImageHeader
+{
+	char signature[4]; /* LUA_SIGNATURE */
+	lu_byte version; /* LUAC_VERSION */
+	lu_byte format; /* LUAC_FORMAT_IMAGE */
+	char data[6]; /* LUAC_DATA */
+	lu_byte sizes[3]; /* of Instruction, lua_Integer and lua_Number */
+	lu_byte nupvalues; /* of the main function */
+	lua_Integer checkint; /* LUAC_INT */
+	lua_Number checknum; /* LUAC_NUM */
+	l_uint32 size; /* of the whole image */
+	l_uint32 nstrings;
+	l_uint32 strings; /* ImageString[nstrings] */
+	l_uint32 nprotos;
+	l_uint32 protos; /* ImageProto[nprotos] */
+	l_uint32 unused;
+};
+
+/* string references are an index in the string table plus one, 0 for none */
+struct ImageString
+{
+	l_uint32 offset; /* of its bytes, followed by a '\0' */
+	l_uint32 len;
+};
+
+struct ImageConstant
+{
+	lu_byte tt; /* variant tag */
+	lu_byte unused[3];
+	l_uint32 str; /* for strings */
+	union
+	{
+		lua_Integer i;
+		lua_Number n;
+	} v;
+};
+
+struct ImageUpvalue
+{
+	l_uint32 name;
+	lu_byte instack;
+	lu_byte idx;
+	lu_byte kind;
+	lu_byte unused;
+};
+
+struct ImageLocVar
+{
+	l_uint32 varname;
+	int startpc;
+	int endpc;
+};
+
+/* each array is its size followed by its offset */
+struct ImageProto
+{
+	l_uint32 source; /* 0 for the same as its parent's */
+	int linedefined;
+	int lastlinedefined;
+	lu_byte numparams;
+	lu_byte is_vararg;
+	lu_byte maxstacksize;
+	lu_byte unused;
+	int sizecode; l_uint32 code; /* Instruction[], used in place */
+	int sizek; l_uint32 k; /* ImageConstant[] */
+	int sizeupvalues; l_uint32 upvalues; /* ImageUpvalue[] */
+	int sizep; l_uint32 p; /* l_uint32[], indices of nested prototypes */
+	int sizelineinfo; l_uint32 lineinfo; /* ls_byte[], used in place */
+	int sizeabslineinfo; l_uint32 abslineinfo; /* AbsLineInfo[], used in place */
+	int sizelocvars; l_uint32 locvars; /* ImageLocVar[] */
+};
+
+
+/*
+** A loaded image, kept while any prototype points into it and handed
+** back to its owner after that; prototypes can be shared by states on
+** other threads (see 'lua_clonestate'), hence the atomic count.
+*/
+struct ChunkImage
+{
+	std::atomic<int> refs;
+	const char *data;
+	size_t size;
+	lua_ImageRelease release;
+	void *ud;
+};
 
 namespace luaU {
 /* load one chunk */
 LUAI_FUNCA undump (lua_State* L, ZIO* Z, const char* name) -> LClosure*;
+LUAI_FUNCA undumpimage (lua_State* L, ChunkImage* im, const char* name) -> LClosure*;
+LUAI_FUNCA loadbody (lua_State* L, Proto* f) -> void;
+LUAI_FUNCA loaddebug (lua_State* L, Proto* f) -> void;
+LUAI_FUNCA loadtree (lua_State* L, Proto* f) -> void;
 
 /* dump one chunk*/
 LUAI_FUNCA dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip) -> int;
+LUAI_FUNCA dumpimage (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip) -> int;
+
+/* images; 'newimage' gives NULL (having released 'data') if out of memory */
+LUAI_FUNCA newimage (const void* data, size_t size, lua_ImageRelease release, void* ud) -> ChunkImage*;
+LUAI_FUNCA retainimage (ChunkImage* im) -> void;
+LUAI_FUNCA releaseimage (ChunkImage* im) -> void;
 
 }
 
@@ -1,6 +1,12 @@
 #include "./stb_image.hpp"
 
 #include <cstring>
+#include <new>
+#include <atomic>
+#include <algorithm>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 #include <cstdint>
 
@@ -157,7 +163,7 @@ struct DecodeContext
 			{
 				break;
 			}
-			if (node->freed && node->size <= size)
+			if (node->freed && node->size >= size)
 			{
 				maybe_freed = node;
 				break;
@@ -177,7 +183,7 @@ struct DecodeContext
 			return nullptr;
 		}
 
-		const auto entry = static_cast<Allocation*>(outs);
+		const auto entry = new (outs) Allocation();
 		entry->size = size;
 		entry->freed = false;
 		entry->next = head.next;
@@ -188,6 +194,10 @@ struct DecodeContext
 
 	auto free (void* thing) -> void
 	{
+		if (thing == nullptr)
+		{
+			return;
+		}
 		auto entry = Allocation::get_address(thing);
 		if (entry->magic != 292202)
 		{
@@ -207,12 +217,22 @@ struct DecodeContext
 			free(thing);
 			return nullptr;
 		}
+		if (thing == nullptr)
+		{
+			return allocate(news);
+		}
 		auto a = Allocation::get_address(thing);
 		if (a->size >= news)
 		{
 			return thing;
 		}
-		return allocate(news);
+		auto grown = allocate(news);
+		if (grown != nullptr)
+		{
+			std::memcpy(grown, thing, a->size);
+			free(thing);
+		}
+		return grown;
 	}
 
 	template<typename T>
@@ -329,6 +349,32 @@ static auto check_png_header (DecodeContext &s) -> void
 	}
 }
 
+// where finished RGBA8 rows go when they're handed out as they're decoded
+// instead of collected into a whole image
+struct RowTarget
+{
+	// either written here, stride bytes apart...
+	uint8_t* dest = nullptr;
+	size_t stride = 0;
+
+	// ...or passed to the callback one at a time through 'scratch'
+	RowCallback* callback = nullptr;
+	void* user = nullptr;
+	uint8_t* scratch = nullptr;
+
+	// only rows in [first, last) are finished. rows above the band still
+	// have to be unfiltered since the ones below depend on them, but
+	// nothing past it is touched at all
+	size_t first = 0;
+	size_t last = SIZE_MAX;
+	bool stopped = false;
+
+	auto active () const -> bool
+	{
+		return dest != nullptr || callback != nullptr;
+	}
+};
+
 struct PNG
 {
 	DecodeContext& context;
@@ -336,6 +382,16 @@ struct PNG
 	uint8_t *expanded = nullptr;
 	uint8_t *out = nullptr;
 	int pixel_bit_depth = 0;
+	bool interlaced = false;
+
+	// when rows are active, each row is finished as soon as it's unfiltered
+	// and 'out' only ever holds a single row. the rest is what finishing a
+	// row needs, filled in right before unfiltering starts
+	RowTarget rows;
+	uint8_t const* palette = nullptr;
+	bool has_trans = false;
+	uint8_t tc[3] = {};
+	uint16_t tc16[3] = {};
 
 	explicit PNG (DecodeContext& ctx): context(ctx)
 	{
@@ -404,90 +460,185 @@ static void create_png_alpha_expand8(
 	}
 }
 
-// create the png data from post-deflated data
-static int create_png_image_raw(
-	PNG *a,
-	uint8_t *raw,
-	size_t raw_len,
-	size_t out_n,
+// finishes a row of 'n' channel samples (8 or 16 bit, native endian) into
+// RGBA8, keying out the tRNS colour if there is one
+template<typename T>
+static auto store_rgba8_samples (
+	uint8_t const* src_bytes,
 	size_t x,
-	size_t y,
-	size_t depth,
-	size_t color)
+	size_t n,
+	bool keyed,
+	T const (&key)[3],
+	uint8_t* dst) -> void
 {
-	auto bytes = (depth == 16 ? 2 : 1);
-	auto s = a->context;
-	uint32_t i;
-	auto stride = x * out_n * bytes;
-	int k;
-	auto img_n = s.image_component_count; // copy it into a local for later
-
-	auto output_bytes = out_n * bytes;
-	auto filter_bytes = img_n * bytes;
-	auto width = x;
+	static constexpr auto SHIFT = (sizeof(T) - 1) * 8;
+	const auto has_color = n >= 3;
+	const auto has_alpha = (n & 1) == 0;
+	auto src = reinterpret_cast<T const*>(src_bytes);
+	for (size_t i = 0; i < x; ++i, src += n, dst += 4)
+	{
+		dst[0] = static_cast<uint8_t>(src[0] >> SHIFT);
+		dst[1] = static_cast<uint8_t>((has_color ? src[1] : src[0]) >> SHIFT);
+		dst[2] = static_cast<uint8_t>((has_color ? src[2] : src[0]) >> SHIFT);
+		dst[3] = has_alpha ? static_cast<uint8_t>(src[n - 1] >> SHIFT) : 255;
+		if (keyed && src[0] == key[0] && (!has_color || (src[1] == key[1] && src[2] == key[2])))
+		{
+			dst[3] = 0;
+		}
+	}
+}
 
-	if (out_n != s.image_component_count && out_n != s.image_component_count+1)
+// the per-row version of the tRNS, palette and channel conversion passes
+// that the normal path runs over the whole image once it's done
+static auto store_rgba8_row (
+	PNG const& z,
+	uint8_t const* src,
+	size_t x,
+	size_t out_n,
+	size_t depth,
+	uint8_t* dst) -> void
+{
+	if (z.palette != nullptr)
 	{
-		throw STBIErr("assertion error: out_n != component count");
+		for (size_t i = 0; i < x; ++i)
+		{
+			std::memcpy(dst + i * 4, z.palette + src[i] * 4, 4);
+		}
 	}
-	a->out = s.allocate_t<uint8_t>(x * y * output_bytes);
-	if (a->out == nullptr)
+	else if (depth == 16)
 	{
-		throw STBIErr("out of memory");
+		store_rgba8_samples<uint16_t>(src, x, out_n, z.has_trans, z.tc16, dst);
 	}
-
-	// note: error exits here don't need to clean up a->out individually,
-	// stbi__do_png always does on error.
-	if (!fma3sizes_valid(img_n, x, depth, 7))
+	else
 	{
-		throw STBIErr("image too large");
+		store_rgba8_samples<uint8_t>(src, x, out_n, z.has_trans, z.tc, dst);
 	}
-	auto img_width_bytes = (((img_n * x * depth) + 7) >> 3);
-	if (!fma2sizes_valid(img_width_bytes, y, img_width_bytes))
+}
+
+// unfilters and expands a png's rows one at a time. create_png_image_raw
+// runs it over a whole inflated image, streaming decodes run it over rows
+// as inflate hands them out
+struct RowUnfilter
+{
+	PNG* a;
+	DecodeContext& s;
+	size_t out_n;
+	size_t x;
+	size_t y;
+	size_t depth;
+	size_t color;
+
+	size_t bytes;
+	size_t stride;
+	size_t img_n;
+	size_t output_bytes;
+	size_t filter_bytes;
+	size_t width;
+	size_t img_width_bytes;
+	uint8_t* filter_buf;
+	bool row_target;
+
+	// the next row to unfilter
+	size_t j = 0;
+
+	RowUnfilter (
+		PNG *a,
+		size_t out_n,
+		size_t x,
+		size_t y,
+		size_t depth,
+		size_t color
+	): a(a), s(a->context), out_n(out_n), x(x), y(y), depth(depth), color(color)
 	{
-		throw STBIErr("image too large");
+		bytes = (depth == 16 ? 2 : 1);
+		stride = x * out_n * bytes;
+		img_n = s.image_component_count; // copy it into a local for later
+
+		output_bytes = out_n * bytes;
+		filter_bytes = img_n * bytes;
+		width = x;
+
+		if (out_n != s.image_component_count && out_n != s.image_component_count+1)
+		{
+			throw STBIErr("assertion error: out_n != component count");
+		}
+		// when rows are finished as they go, only the current one needs to exist
+		row_target = a->rows.active();
+		a->out = s.allocate_t<uint8_t>((row_target ? 1 : y) * x * output_bytes);
+		if (a->out == nullptr)
+		{
+			throw STBIErr("out of memory");
+		}
+
+		// note: error exits here don't need to clean up a->out individually,
+		// stbi__do_png always does on error.
+		if (!fma3sizes_valid(img_n, x, depth, 7))
+		{
+			throw STBIErr("image too large");
+		}
+		img_width_bytes = (((img_n * x * depth) + 7) >> 3);
+		if (!fma2sizes_valid(img_width_bytes, y, img_width_bytes))
+		{
+			throw STBIErr("image too large");
+		}
+
+		// Allocate two scan lines worth of filter workspace buffer.
+		filter_buf = s.allocate_t<uint8_t>(img_width_bytes * 2);
+		if (!filter_buf)
+		{
+			throw STBIErr("out of memory");
+		}
+
+		// Filtering for low-bit-depth images
+		if (depth < 8)
+		{
+			filter_bytes = 1;
+			width = img_width_bytes;
+		}
 	}
-	auto img_len = (img_width_bytes + 1) * y;
 
-	// we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
-	// but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
-	// so just check for raw_len < img_len always.
-	if (raw_len < img_len)
+	// inflated bytes per row, counting the filter type byte
+	auto raw_row_size () const -> size_t
 	{
-		throw STBIErr("not enough pixels");
+		return img_width_bytes + 1;
 	}
 
-	// Allocate two scan lines worth of filter workspace buffer.
-	auto filter_buf = s.allocate_t<uint8_t>(img_width_bytes * 2);
-	if (!filter_buf)
+	auto raw_image_size () const -> size_t
 	{
-		throw STBIErr("out of memory");
+		return raw_row_size() * y;
 	}
 
-	// Filtering for low-bit-depth images
-	if (depth < 8)
+	auto done () const -> bool
 	{
-		filter_bytes = 1;
-		width = img_width_bytes;
+		return j >= y || j >= a->rows.last || a->rows.stopped;
 	}
 
-	static auto paeth = [](int a, int b, int c) {
-		// This formulation looks very different from the reference in the PNG spec, but is
-		// actually equivalent and has favorable data dependencies and admits straightforward
-		// generation of branch-free code, which helps performance significantly.
-		int thresh = c * 3 - (a + b);
-		int lo = a < b ? a : b;
-		int hi = a < b ? b : a;
-		int t0 = (hi <= thresh) ? lo : c;
-		return thresh <= lo ? hi : t0;
-	};
+	auto finish () -> void
+	{
+		s.free(filter_buf);
+		filter_buf = nullptr;
+	}
 
-	for (auto j = 0; j < y; ++j)
+	// unfilters the next row from 'raw', which holds raw_row_size() bytes
+	auto decode_row (uint8_t const* raw) -> void
 	{
+		static auto paeth = [](int a, int b, int c) {
+			// This formulation looks very different from the reference in the PNG spec, but is
+			// actually equivalent and has favorable data dependencies and admits straightforward
+			// generation of branch-free code, which helps performance significantly.
+			int thresh = c * 3 - (a + b);
+			int lo = a < b ? a : b;
+			int hi = a < b ? b : a;
+			int t0 = (hi <= thresh) ? lo : c;
+			return thresh <= lo ? hi : t0;
+		};
+
+		uint32_t i;
+		int k;
 		// cur/prior filter buffers alternate
 		auto cur = filter_buf + (j & 1) * img_width_bytes;
 		auto prior = filter_buf + (~j & 1) * img_width_bytes;
-		auto dest = a->out + stride * j;
+		auto dest = row_target ? a->out : a->out + stride * j;
 		auto nk = width * filter_bytes;
 		auto filter = *raw++;
 
@@ -551,7 +702,12 @@ static int create_png_image_raw(
 				break;
 		}
 
-		raw += nk;
+		// rows above a band only had to be unfiltered for the ones after them
+		if (row_target && j < a->rows.first)
+		{
+			++j;
+			return;
+		}
 
 		// expand decoded bits in cur to dest, also adding an extra alpha channel if desired
 		if (depth < 8)
@@ -659,15 +815,64 @@ static int create_png_image_raw(
 				}
 			}
 		}
+
+		if (row_target)
+		{
+			finish_row(dest);
+		}
+		++j;
+	}
+
+	auto finish_row (uint8_t const* dest) -> void
+	{
+		auto& rows = a->rows;
+		if (rows.dest != nullptr)
+		{
+			store_rgba8_row(*a, dest, x, out_n, depth, rows.dest + (j - rows.first) * rows.stride);
+			return;
+		}
+		store_rgba8_row(*a, dest, x, out_n, depth, rows.scratch);
+		if (!rows.callback(rows.user, j, rows.scratch, x * 4))
+		{
+			rows.stopped = true;
+		}
 	}
+};
 
-	stbi_free(filter_buf);
+// create the png data from post-deflated data
+static int create_png_image_raw(
+	PNG *a,
+	uint8_t *raw,
+	size_t raw_len,
+	size_t out_n,
+	size_t x,
+	size_t y,
+	size_t depth,
+	size_t color)
+{
+	auto rows = RowUnfilter(a, out_n, x, y, depth, color);
+
+	// we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
+	// but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
+	// so just check for raw_len < img_len always.
+	if (raw_len < rows.raw_image_size())
+	{
+		throw STBIErr("not enough pixels");
+	}
+
+	while (!rows.done())
+	{
+		rows.decode_row(raw);
+		raw += rows.raw_row_size();
+	}
+
+	rows.finish();
 	return 1;
 }
 
 static int parse_png_file(PNG& z, size_t scan, size_t req_comp)
 {
-	auto s = z.context;
+	auto& s = z.context;
 
 	z.expanded = nullptr;
 	z.idata = nullptr;
@@ -758,6 +963,7 @@ static int parse_png_file(PNG& z, size_t scan, size_t req_comp)
 				{
 					throw stbi__err("bad interlace method", "Corrupt PNG");
 				}
+				z.interlaced = interlace != 0;
 				if (s.image_wide <= 0 || s.image_tall <= 0)
 				{
 					throw STBIErr("image has 0 dimensions in an axis");
@@ -941,6 +1147,14 @@ static int parse_png_file(PNG& z, size_t scan, size_t req_comp)
 				{
 					throw stbi__err("no IDAT", "Corrupt PNG");
 				}
+				if ((req_comp == s.image_component_count + 1 && req_comp != 3 && !pal_img_n) || has_trans)
+				{
+					s.img_out_n = s.image_component_count + 1;
+				}
+				else
+				{
+					s.img_out_n = s.image_component_count;
+				}
 				// initial guess for decoded data size to avoid unnecessary reallocs
 				bpl = (s.image_wide * z.pixel_bit_depth + 7) / 8; // bytes per line, per component
 				raw_len = bpl * s.image_tall * s.image_component_count /* pixels */ + s.image_tall /* filter mode per row */;
@@ -962,6 +1176,61 @@ static int parse_png_file(PNG& z, size_t scan, size_t req_comp)
 					return static_cast<DecodeContext*>(self)->reallocate(p, news);
 				};
 
+				if (z.rows.active())
+				{
+					if (interlace)
+					{
+						throw STBIErr("assertion error: row target given for an interlaced image");
+					}
+					z.palette = pal_img_n ? palette : nullptr;
+					z.has_trans = has_trans;
+					std::memcpy(z.tc, tc, sizeof(tc));
+					std::memcpy(z.tc16, tc16, sizeof(tc16));
+
+					// unfilter rows as soon as inflate has them, so neither the
+					// inflated image nor the unfiltered one ever exist whole
+					auto rows = RowUnfilter(
+						&z,
+						s.img_out_n,
+						s.image_wide,
+						s.image_tall,
+						z.pixel_bit_depth,
+						color
+					);
+					zctx.initial_size = Zlib::WINDOW_SIZE + rows.raw_row_size() * 2;
+					zctx.consume_self = &rows;
+					zctx.consume = [](auto self, auto data, auto len) -> size_t {
+						auto& rows = *static_cast<RowUnfilter*>(self);
+						const auto row_size = rows.raw_row_size();
+						size_t used = 0;
+						while (!rows.done() && len - used >= row_size)
+						{
+							rows.decode_row(data + used);
+							used += row_size;
+						}
+						return rows.done() ? Zlib::Context::STOP : used;
+					};
+					try
+					{
+						zctx.decode_streaming();
+					}
+					catch (Zlib::Err& er)
+					{
+						throw STBIErr(er.reason);
+					}
+					if (!rows.done())
+					{
+						throw STBIErr("not enough pixels");
+					}
+					rows.finish();
+					s.free(z.out);
+					z.out = nullptr;
+					stbi_free(z.idata);
+					z.idata = nullptr;
+					s.get32be();
+					return 1;
+				}
+
 				try
 				{
 					z.expanded = zctx.decode_malloc_guesssize_headerflag();
@@ -979,14 +1248,6 @@ static int parse_png_file(PNG& z, size_t scan, size_t req_comp)
 				}
 				stbi_free(z.idata);
 				z.idata = nullptr;
-				if ((req_comp == s.image_component_count + 1 && req_comp != 3 && !pal_img_n) || has_trans)
-				{
-					s.img_out_n = s.image_component_count + 1;
-				}
-				else
-				{
-					s.img_out_n = s.image_component_count;
-				}
 				const auto pic_wide = z.context.image_wide;
 				const auto pic_tall = z.context.image_tall;
 				{
@@ -998,61 +1259,66 @@ static int parse_png_file(PNG& z, size_t scan, size_t req_comp)
 					auto _interlaced = interlace;
 					if (!_interlaced)
 					{
-						return create_png_image_raw(
-							&z,
-							_image_data,
-							_image_data_len,
-							_out_n,
-							pic_wide,
-							pic_tall,
-							_depth,
-							_color
-						);
-					}
-
-					// de-interlacing
-					auto out_bytes = _out_n * (_depth == 16 ? 2 : 1);
-					auto final = s.allocate_t<uint8_t>(pic_wide * pic_tall * out_bytes);
-					if (!final)
-					{
-						throw STBIErr("out of memory");
+						if (!create_png_image_raw(
+								&z,
+								_image_data,
+								_image_data_len,
+								_out_n,
+								pic_wide,
+								pic_tall,
+								_depth,
+								_color
+						))
+						{
+							return false;
+						}
 					}
-					for (int p = 0; p < 7; ++p)
+					else
 					{
-						int xorig[] = {0, 4, 0, 2, 0, 1, 0};
-						int yorig[] = {0, 0, 4, 0, 2, 0, 1};
-						int xspc[] = {8, 8, 4, 4, 2, 2, 1};
-						int yspc[] = {8, 8, 8, 4, 4, 2, 2};
-						// pass1_x[4] = 0, pass1_x[5] = 1, pass1_x[12] = 1
-						auto x = (pic_wide - xorig[p] + xspc[p] - 1) / xspc[p];
-						auto y = (pic_tall - yorig[p] + yspc[p] - 1) / yspc[p];
-						if (x && y)
+						// de-interlacing
+						auto out_bytes = _out_n * (_depth == 16 ? 2 : 1);
+						auto final = s.allocate_t<uint8_t>(pic_wide * pic_tall * out_bytes);
+						if (!final)
 						{
-							auto img_len = ((((z.context.image_component_count * x * _depth) + 7) >> 3) + 1) * y;
-							if (!create_png_image_raw(&z, _image_data, _image_data_len, _out_n, x, y, _depth, _color))
-							{
-								stbi_free(final);
-								return false;
-							}
-							for (int jj = 0; jj < y; ++jj)
+							throw STBIErr("out of memory");
+						}
+						for (int p = 0; p < 7; ++p)
+						{
+							int xorig[] = {0, 4, 0, 2, 0, 1, 0};
+							int yorig[] = {0, 0, 4, 0, 2, 0, 1};
+							int xspc[] = {8, 8, 4, 4, 2, 2, 1};
+							int yspc[] = {8, 8, 8, 4, 4, 2, 2};
+							// pass1_x[4] = 0, pass1_x[5] = 1, pass1_x[12] = 1
+							auto x = (pic_wide - xorig[p] + xspc[p] - 1) / xspc[p];
+							auto y = (pic_tall - yorig[p] + yspc[p] - 1) / yspc[p];
+							if (x && y)
 							{
-								for (int ii = 0; ii < x; ++ii)
+								auto img_len = ((((z.context.image_component_count * x * _depth) + 7) >> 3) + 1) * y;
+								if (!create_png_image_raw(&z, _image_data, _image_data_len, _out_n, x, y, _depth, _color))
+								{
+									s.free(final);
+									return false;
+								}
+								for (int jj = 0; jj < y; ++jj)
 								{
-									auto out_y = jj * yspc[p] + yorig[p];
-									auto out_x = ii * xspc[p] + xorig[p];
-									std::memcpy(
-										final + out_y * pic_wide * out_bytes + out_x * out_bytes,
-										z.out + (jj * x + ii) * out_bytes,
-										out_bytes
-									);
+									for (int ii = 0; ii < x; ++ii)
+									{
+										auto out_y = jj * yspc[p] + yorig[p];
+										auto out_x = ii * xspc[p] + xorig[p];
+										std::memcpy(
+											final + out_y * pic_wide * out_bytes + out_x * out_bytes,
+											z.out + (jj * x + ii) * out_bytes,
+											out_bytes
+										);
+									}
 								}
+								s.free(z.out);
+								_image_data += img_len;
+								_image_data_len -= img_len;
 							}
-							stbi_free(z.out);
-							_image_data += img_len;
-							_image_data_len -= img_len;
 						}
+						z.out = final;
 					}
-					z.out = final;
 				}
 				if (has_trans)
 				{
@@ -1208,7 +1474,7 @@ static int parse_png_file(PNG& z, size_t scan, size_t req_comp)
 auto get_valuessss (
 	uint64_t *out_wide,
 	uint64_t *out_tall,
-	DecodeContext s,
+	DecodeContext& s,
 	size_t bits_per_channel
 ) -> uint8_t*
 {
@@ -1254,7 +1520,7 @@ auto get_valuessss (
 				auto good = s.allocate_t<uint8_t>(req_comp * xx * yy);
 				if (good == nullptr)
 				{
-					stbi_free(data);
+					s.free(data);
 					throw STBIErr("out of memory");
 				}
 
@@ -1352,8 +1618,8 @@ auto get_valuessss (
 
 				if (CONV_FUNC == nullptr)
 				{
-					stbi_free(data);
-					stbi_free(good);
+					s.free(data);
+					s.free(good);
 					throw STBIErr("unsupported format conversion");
 				}
 
@@ -1375,7 +1641,7 @@ auto get_valuessss (
 					}
 				}
 
-				stbi_free(data);
+				s.free(data);
 				result = good;
 			}
 			else
@@ -1390,7 +1656,7 @@ auto get_valuessss (
 				auto good = s.allocate_t<uint16_t>(req_comp * xx * yy);
 				if (good == nullptr)
 				{
-					stbi_free(data);
+					s.free(data);
 					throw STBIErr("out of memory");
 				}
 
@@ -1487,8 +1753,8 @@ auto get_valuessss (
 
 				if (CONV_FUNC == nullptr)
 				{
-					stbi_free(data);
-					stbi_free(good);
+					s.free(data);
+					s.free(good);
 					throw STBIErr("unsupported format conversion");
 				}
 
@@ -1510,7 +1776,7 @@ auto get_valuessss (
 					}
 				}
 
-				stbi_free(data);
+				s.free(data);
 				result = good;
 			}
 			endp:
@@ -1522,9 +1788,9 @@ auto get_valuessss (
 			}
 		}
 	}
-	stbi_free(p.out);
+	s.free(p.out);
 	p.out = nullptr;
-	stbi_free(p.expanded);
+	s.free(p.expanded);
 	p.expanded = nullptr;
 	stbi_free(p.idata);
 	p.idata = nullptr;
@@ -1545,6 +1811,15 @@ trueend:
 
 
 
+	if (out_wide != nullptr)
+	{
+		*out_wide = p.context.image_wide;
+	}
+	if (out_tall != nullptr)
+	{
+		*out_tall = p.context.image_tall;
+	}
+
 	if (bits_per_channel != 8)
 	{
 		auto orig = static_cast<uint16_t *>(true_result);
@@ -1565,25 +1840,22 @@ trueend:
 		return reduced;
 	}
 
-	if (out_wide != nullptr)
-	{
-		*out_wide = p.context.image_wide;
-	}
-	if (out_tall != nullptr)
-	{
-		*out_tall = p.context.image_tall;
-	}
 	return static_cast<uint8_t*>(true_result);
 }
 
-auto coyote_stbi_load_from_memory(
-	DllInterface *interface,
-	uint64_t *out_wide,
-	uint64_t *out_tall) -> uint8_t*
+// decodes a single interface's png, filling in its result union.
+// everything the decode touches lives in the local DecodeContext, so
+// this is safe to run for different interfaces on different threads
+// as long as the allocator given is
+static auto decode_interface (
+	DllInterface* interface,
+	AllocatorCallback* allocator
+) -> uint8_t*
 {
+	interface->is_success = false;
 	try
 	{
-		if (interface->allocator == nullptr)
+		if (allocator == nullptr)
 		{
 			throw STBIErr("no memory allocator callback defined");
 		}
@@ -1591,7 +1863,7 @@ auto coyote_stbi_load_from_memory(
 		auto s = DecodeContext(
 			interface->source_png_buffer,
 			interface->source_png_size,
-			interface->allocator
+			allocator
 		);
 
 		// default is 8 so most paths don't have to be changed
@@ -1601,14 +1873,23 @@ auto coyote_stbi_load_from_memory(
 		// (at least a FOURCC or distinctive magic number first)
 		check_png_header(s);
 		s.rewind();
+		uint64_t wide = 0;
+		uint64_t tall = 0;
 		auto value = get_valuessss(
-			out_wide,
-			out_tall,
+			&wide,
+			&tall,
 			s,
 			bits_per_channel
 		);
 		if (value == nullptr)
-			return nullptr;
+		{
+			throw STBIErr("failed to decode image");
+		}
+		interface->is_success = true;
+		interface->result.success.pic_data = value;
+		interface->result.success.pic_data_size = wide * tall * 4;
+		interface->result.success.pic_wide = wide;
+		interface->result.success.pic_tall = tall;
 		return value;
 	}
 	catch (STBIErr& e)
@@ -1618,6 +1899,300 @@ auto coyote_stbi_load_from_memory(
 	}
 }
 
+auto coyote_stbi_load_from_memory(
+	DllInterface *interface,
+	uint64_t *out_wide,
+	uint64_t *out_tall) -> uint8_t*
+{
+	auto value = decode_interface(interface, interface->allocator);
+	if (value == nullptr)
+	{
+		return nullptr;
+	}
+	if (out_wide != nullptr)
+	{
+		*out_wide = interface->result.success.pic_wide;
+	}
+	if (out_tall != nullptr)
+	{
+		*out_tall = interface->result.success.pic_tall;
+	}
+	return value;
+}
+
+auto coyote_stbi_load_batch(
+	DllInterface *interfaces,
+	uint64_t interface_count,
+	uint64_t thread_count,
+	AllocatorCallback* const* thread_allocators) -> uint64_t
+{
+	if (interfaces == nullptr || interface_count == 0)
+	{
+		return 0;
+	}
+	if (thread_count == 0)
+	{
+		thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	// no point in waking up workers that won't get an image
+	thread_count = std::min(thread_count, interface_count);
+
+	// workers pull the next undecoded image off a shared cursor, so a few
+	// large images don't leave the rest of the pool idle
+	std::atomic<uint64_t> cursor = 0;
+	std::atomic<uint64_t> success_count = 0;
+
+	const auto worker = [&](uint64_t worker_index) {
+		auto allocator = thread_allocators != nullptr
+			? thread_allocators[worker_index]
+			: nullptr;
+		uint64_t succeeded = 0;
+		while (true)
+		{
+			const auto i = cursor.fetch_add(1, std::memory_order_relaxed);
+			if (i >= interface_count)
+			{
+				break;
+			}
+			auto interface = &interfaces[i];
+			if (decode_interface(interface, allocator != nullptr ? allocator : interface->allocator))
+			{
+				succeeded++;
+			}
+		}
+		success_count.fetch_add(succeeded, std::memory_order_relaxed);
+	};
+
+	std::vector<std::thread> workers;
+	try
+	{
+		workers.reserve(thread_count - 1);
+		for (uint64_t i = 1; i < thread_count; ++i)
+		{
+			workers.emplace_back(worker, i);
+		}
+	}
+	catch (std::system_error&)
+	{
+		// couldn't get as many threads as asked for. whoever did start
+		// (including us) will just pick up the slack
+	}
+	// the calling thread is worker 0
+	worker(0);
+	for (auto& t: workers)
+	{
+		t.join();
+	}
+
+	return success_count.load();
+}
+
+auto coyote_stbi_load_into(
+	DllInterface *interface,
+	uint8_t *dest,
+	uint64_t dest_size,
+	uint64_t dest_stride,
+	uint64_t *out_wide,
+	uint64_t *out_tall) -> uint32_t
+{
+	interface->is_success = false;
+	try
+	{
+		if (interface->allocator == nullptr)
+		{
+			throw STBIErr("no memory allocator callback defined");
+		}
+		if (dest == nullptr)
+		{
+			throw STBIErr("no destination buffer given");
+		}
+
+		auto s = DecodeContext(
+			interface->source_png_buffer,
+			interface->source_png_size,
+			interface->allocator
+		);
+		auto header = PNG(s);
+		parse_png_file(header, STBI__SCAN_header, 0);
+
+		const auto wide = s.image_wide;
+		const auto tall = s.image_tall;
+		const auto row_size = wide * 4;
+		if (dest_stride == 0)
+		{
+			dest_stride = row_size;
+		}
+		if (dest_stride < row_size)
+		{
+			throw STBIErr("destination stride is smaller than a row");
+		}
+		if (!fma2sizes_valid(tall - 1, dest_stride, row_size))
+		{
+			throw STBIErr("image too large");
+		}
+		const auto required_size = (tall - 1) * dest_stride + row_size;
+		if (dest_size < required_size)
+		{
+			throw STBIErr("destination buffer too small");
+		}
+
+		s.rewind();
+		if (header.interlaced)
+		{
+			// interlace passes are scattered over the whole image, so rows
+			// can't be finished one at a time. decode it the normal way and
+			// copy it over instead
+			size_t bits_per_channel = 8;
+			auto pixels = get_valuessss(nullptr, nullptr, s, bits_per_channel);
+			for (size_t y = 0; y < tall; ++y)
+			{
+				std::memcpy(dest + y * dest_stride, pixels + y * row_size, row_size);
+			}
+			s.free(pixels);
+		}
+		else
+		{
+			auto p = PNG(s);
+			p.rows.dest = dest;
+			p.rows.stride = dest_stride;
+			parse_png_file(p, STBI__SCAN_load, 4);
+		}
+
+		interface->is_success = true;
+		interface->result.success.pic_data = dest;
+		interface->result.success.pic_data_size = required_size;
+		interface->result.success.pic_wide = wide;
+		interface->result.success.pic_tall = tall;
+		if (out_wide != nullptr)
+		{
+			*out_wide = wide;
+		}
+		if (out_tall != nullptr)
+		{
+			*out_tall = tall;
+		}
+		return true;
+	}
+	catch (STBIErr& e)
+	{
+		return interface->set_failure(e.reason);
+	}
+}
+
+auto coyote_stbi_load_rows(
+	DllInterface *interface,
+	RowCallback *callback,
+	void *user,
+	uint64_t first_row,
+	uint64_t row_count,
+	uint64_t *out_wide,
+	uint64_t *out_tall) -> uint32_t
+{
+	interface->is_success = false;
+	try
+	{
+		if (interface->allocator == nullptr)
+		{
+			throw STBIErr("no memory allocator callback defined");
+		}
+		if (callback == nullptr)
+		{
+			throw STBIErr("no row callback given");
+		}
+
+		auto s = DecodeContext(
+			interface->source_png_buffer,
+			interface->source_png_size,
+			interface->allocator
+		);
+		auto header = PNG(s);
+		parse_png_file(header, STBI__SCAN_header, 0);
+
+		const auto wide = s.image_wide;
+		const auto tall = s.image_tall;
+		const auto row_size = wide * 4;
+		if (first_row >= tall)
+		{
+			throw STBIErr("first row is past the end of the image");
+		}
+		if (row_count == 0 || row_count > tall - first_row)
+		{
+			row_count = tall - first_row;
+		}
+
+		s.rewind();
+		if (header.interlaced)
+		{
+			// same as load_into, interlaced images only come whole
+			size_t bits_per_channel = 8;
+			auto pixels = get_valuessss(nullptr, nullptr, s, bits_per_channel);
+			for (auto y = first_row; y < first_row + row_count; ++y)
+			{
+				if (!callback(user, y, pixels + y * row_size, row_size))
+				{
+					break;
+				}
+			}
+			s.free(pixels);
+		}
+		else
+		{
+			auto p = PNG(s);
+			p.rows.callback = callback;
+			p.rows.user = user;
+			p.rows.scratch = s.allocate_t<uint8_t>(row_size);
+			if (p.rows.scratch == nullptr)
+			{
+				throw STBIErr("out of memory");
+			}
+			p.rows.first = first_row;
+			p.rows.last = first_row + row_count;
+			parse_png_file(p, STBI__SCAN_load, 4);
+			s.free(p.rows.scratch);
+		}
+
+		// no image is kept, the callback saw all there is
+		interface->is_success = true;
+		interface->result.success.pic_data = nullptr;
+		interface->result.success.pic_data_size = 0;
+		interface->result.success.pic_wide = wide;
+		interface->result.success.pic_tall = tall;
+		if (out_wide != nullptr)
+		{
+			*out_wide = wide;
+		}
+		if (out_tall != nullptr)
+		{
+			*out_tall = tall;
+		}
+		return true;
+	}
+	catch (STBIErr& e)
+	{
+		return interface->set_failure(e.reason);
+	}
+}
+
+auto coyote_stbi_get_dimensions(
+	DllInterface *res,
+	uint64_t *out_wide,
+	uint64_t *out_tall) -> uint32_t
+{
+	if (!res->is_success)
+	{
+		return false;
+	}
+	if (out_wide != nullptr)
+	{
+		*out_wide = res->result.success.pic_wide;
+	}
+	if (out_tall != nullptr)
+	{
+		*out_tall = res->result.success.pic_tall;
+	}
+	return true;
+}
+
 auto coyote_stbi_info_from_memory(
 	DllInterface *interface,
 	uint64_t *out_pic_wide,
@@ -1687,12 +2262,12 @@ auto coyote_stbi_get_success(DllInterface *res, uint64_t *out_size) -> uint8_t *
 		return nullptr;
 	}
 
-	auto [s, p] = res->result.success;
+	const auto& success = res->result.success;
 	if (out_size != nullptr)
 	{
-		*out_size = s;
+		*out_size = success.pic_data_size;
 	}
-	return p;
+	return success.pic_data;
 }
 
 auto coyote_stbi_interface_setup(
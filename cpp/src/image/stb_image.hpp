@@ -25,6 +25,15 @@ struct STBIErr final : std::exception
 
 using AllocatorCallback = auto (uint64_t size) -> void*;
 
+// given each RGBA8 row as it's decoded. pixels is only valid during the
+// call. returning 0 stops decoding, the load still counts as a success
+using RowCallback = auto (
+	void* user,
+	uint64_t row,
+	uint8_t const* pixels,
+	uint64_t size
+) -> uint32_t;
+
 
 struct DllInterface
 {
@@ -39,6 +48,8 @@ struct DllInterface
 		{
 			size_t pic_data_size;
 			uint8_t* pic_data;
+			uint64_t pic_wide;
+			uint64_t pic_tall;
 		} success;
 
 		struct
@@ -74,12 +85,57 @@ STBIDEF coyote_stbi_get_success (DllInterface* res, uint64_t* out_size) -> uint8
 
 STBIDEF coyote_stbi_load_from_memory(
 	DllInterface *interface,
-	uint8_t const *source_png_buffer,
-	uint64_t source_length,
 	uint64_t *out_wide,
 	uint64_t *out_tall
 ) -> uint8_t*;
 
+// decodes every interface in the array on a pool of worker threads.
+// thread_count of 0 uses one thread per hardware core. if thread_allocators
+// isn't null, it holds one allocator per worker thread which is used instead
+// of each interface's own allocator.
+// each interface reports its own success or failure, same as a single load;
+// returns how many of them decoded successfully.
+STBIDEF coyote_stbi_load_batch(
+	DllInterface *interfaces,
+	uint64_t interface_count,
+	uint64_t thread_count,
+	AllocatorCallback* const* thread_allocators
+) -> uint64_t;
+
+// decodes straight into caller memory instead of allocating the output image.
+// rows are RGBA8 and dest_stride bytes apart (0 means tightly packed), so
+// dest_size needs to be at least (tall - 1) * dest_stride + wide * 4.
+// the allocator is still used for decode scratch memory.
+STBIDEF coyote_stbi_load_into(
+	DllInterface *interface,
+	uint8_t *dest,
+	uint64_t dest_size,
+	uint64_t dest_stride,
+	uint64_t *out_wide,
+	uint64_t *out_tall
+) -> uint32_t;
+
+// decodes row by row, handing each one to the callback instead of keeping
+// the image. only rows from first_row on are given, row_count of them (0 means
+// all the way down), and decoding stops after the last of those. memory use
+// stays around a few rows plus the deflate window regardless of image size,
+// except for interlaced images, which still get decoded whole first.
+STBIDEF coyote_stbi_load_rows(
+	DllInterface *interface,
+	RowCallback *callback,
+	void *user,
+	uint64_t first_row,
+	uint64_t row_count,
+	uint64_t *out_wide,
+	uint64_t *out_tall
+) -> uint32_t;
+
+STBIDEF coyote_stbi_get_dimensions(
+	DllInterface *res,
+	uint64_t *out_wide,
+	uint64_t *out_tall
+) -> uint32_t;
+
 STBIDEF coyote_stbi_info_from_memory(
 	DllInterface *interface,
 	uint64_t *out_pic_wide,
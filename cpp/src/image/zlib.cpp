@@ -199,6 +199,11 @@ struct ZHuffman
 	}
 };
 
+// thrown out of the inflate loop when a streaming consumer asks to stop
+struct ZStop
+{
+};
+
 // zlib-from-memory implementation for PNG reading
 //    because PNG allows splitting the zlib stream arbitrarily,
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
@@ -218,6 +223,11 @@ struct ZBuffer
 	uint8_t* zout_end;
 	bool z_expandable;
 
+	// streaming only: first byte the consumer hasn't taken yet, and how
+	// much has been slid off the front of the buffer so far
+	uint8_t* zpending = nullptr;
+	size_t zdiscarded = 0;
+
 	ZHuffman z_length;
 	ZHuffman z_distance;
 
@@ -270,10 +280,51 @@ struct ZBuffer
 		num_bits -= n;
 		return k;
 	}
+	// hands everything not yet consumed over, then slides the buffer down
+	// so only what's still unconsumed and the back reference window stay
+	auto zflush () -> void
+	{
+		const auto used = this->context->consume(
+			this->context->consume_self,
+			this->zpending,
+			this->zout - this->zpending
+		);
+		if (used == Zlib::Context::STOP)
+		{
+			throw ZStop();
+		}
+		this->zpending += used;
+		auto keep = this->zout_start;
+		if (static_cast<size_t>(this->zout - this->zout_start) > Zlib::WINDOW_SIZE)
+		{
+			keep = this->zout - Zlib::WINDOW_SIZE;
+		}
+		if (this->zpending < keep)
+		{
+			keep = this->zpending;
+		}
+		const auto shift = keep - this->zout_start;
+		if (shift > 0)
+		{
+			std::memmove(this->zout_start, keep, this->zout - keep);
+			this->zout -= shift;
+			this->zpending -= shift;
+			this->zdiscarded += shift;
+		}
+	}
 	auto zexpand (uint8_t* zout, int n) -> void
 	{
 		// need to make room for n bytes
 		this->zout = zout;
+		if (this->context->consume != nullptr)
+		{
+			// streaming, try making room by giving data away first
+			this->zflush();
+			if (this->zout + n <= this->zout_end)
+			{
+				return;
+			}
+		}
 		if (!this->z_expandable)
 		{
 			throw Zlib::Err("output buffer limit");
@@ -293,12 +344,17 @@ struct ZBuffer
 			}
 			limit *= 2;
 		}
+		const auto pending = this->zpending - this->zout_start;
 		auto q = this->context->realloc_t(this->zout_start, old_limit, limit);
 		// STBI_NOTUSED(old_limit);
 		if (q == nullptr)
 		{
 			throw Zlib::Err("outofmem");
 		}
+		if (this->zpending != nullptr)
+		{
+			this->zpending = q + pending;
+		}
 		this->zout = q + cur;
 		this->zout_start = q;
 		this->zout_end = q + limit;
@@ -369,277 +425,283 @@ struct ZBuffer
 };
 
 
-auto Zlib::Context::decode_malloc_guesssize_headerflag () -> uint8_t *
+// the inflate itself, shared by the collecting and the streaming decode.
+// 'a' has to have its input and output set up already
+static auto zinflate (ZBuffer& a, bool parse_header) -> void
 {
-	const auto p = this->malloc_t<uint8_t>(this->initial_size);
-	if (p == nullptr)
+	if (parse_header)
 	{
-		throw Zlib::Err("Out of memory");
+		int cmf = a.read_u8();
+		int cm = cmf & 15;
+		/* int cinfo = cmf >> 4; */
+		int flg = a.read_u8();
+		if (a.eof())
+		{
+			// zlib spec
+			throw Zlib::Err("bad zlib header");
+		}
+		if ((cmf * 256 + flg) % 31 != 0)
+		{
+			// zlib spec
+			throw Zlib::Err("bad zlib header");
+		}
+		if (flg & 32)
+		{
+			// preset dictionary not allowed in png
+			throw Zlib::Err("no preset dict");
+		}
+		if (cm != 8)
+		{
+			// DEFLATE required for png
+			throw Zlib::Err("bad compression");
+		}
+		// window = 1 << (8 + cinfo)... but who cares, we fully buffer output
 	}
-	ZBuffer a;
-	a.zbuffer = this->buffer;
-	a.zbuffer_end = this->buffer + this->len;
-	try
+	a.num_bits = 0;
+	a.code_buffer = 0;
+	a.hit_zeof_once = 0;
+	uint8_t final;
+	do
 	{
-		// zdo_zlib(&a, p, this->initial_size, true, this->parse_header);
-		a.zout_start = p;
-		a.zout = p;
-		a.zout_end = p + this->initial_size;
-		a.z_expandable = this->parse_header;
-
-
-		if (parse_header)
+		final = a.read_bits_t<1>();
+		if (const auto type = a.read_bits_t<2>(); type == 0)
 		{
-			int cmf = a.read_u8();
-			int cm = cmf & 15;
-			/* int cinfo = cmf >> 4; */
-			int flg = a.read_u8();
-			if (a.eof())
+			uint8_t header[4];
+			if (a.num_bits & 7)
 			{
-				// zlib spec
-				throw Zlib::Err("bad zlib header");
+				a.read_bits(a.num_bits & 7); // discard
 			}
-			if ((cmf * 256 + flg) % 31 != 0)
+			// drain the bit-packed data into header
+
+			auto pev_bits = a.num_bits;
+			int k = 0;
+			while (a.num_bits > 0)
 			{
-				// zlib spec
-				throw Zlib::Err("bad zlib header");
+				// suppress MSVC run-time check
+				header[k++] = static_cast<uint8_t>(a.code_buffer & 255);
+				a.code_buffer >>= 8;
+				a.num_bits -= 8;
+				if (a.num_bits > pev_bits)
+				{
+					throw Zlib::Err("zlib corrupt");
+				}
 			}
-			if (flg & 32)
+			// now fill header the normal way
+			while (k < 4)
 			{
-				// preset dictionary not allowed in png
-				throw Zlib::Err("no preset dict");
+				header[k++] = a.read_u8();
 			}
-			if (cm != 8)
+			int len = header[1] * 256 + header[0];
+			int nlen = header[3] * 256 + header[2];
+			if (nlen != (len ^ 0xffff))
 			{
-				// DEFLATE required for png
-				throw Zlib::Err("bad compression");
+				throw Zlib::Err("zlib corrupt");
 			}
-			// window = 1 << (8 + cinfo)... but who cares, we fully buffer output
+			if (a.zbuffer + len > a.zbuffer_end)
+			{
+				throw Zlib::Err("read past buffer");
+			}
+			if (a.zout + len > a.zout_end)
+			{
+				a.zexpand(a.zout, len);
+			}
+			std::memcpy(a.zout, a.zbuffer, len);
+			a.zbuffer += len;
+			a.zout += len;
 		}
-		a.num_bits = 0;
-		a.code_buffer = 0;
-		a.hit_zeof_once = 0;
-		uint8_t final;
-		do
+		else if (type == 3)
+		{
+			throw Zlib::Err("zdo_zlib: type == 3");
+		}
+		else
 		{
-			final = a.read_bits_t<1>();
-			if (const auto type = a.read_bits_t<2>(); type == 0)
+			if (type == 1)
 			{
-				uint8_t header[4];
-				if (a.num_bits & 7)
+				// use fixed code lengths
+				a.z_length.zbuild_huffman(DEFAULT_LENGTH, ZNSYMS);
+				a.z_distance.zbuild_huffman(DEFAULT_DISTANCE, 32);
+			}
+			else
+			{
+				// zcompute_huffman_codes
+				ZHuffman z_codelength;
+				uint8_t lencodes[286 + 32 + 137]; //padding for maximum single op
+
+				const int hlit  = a.read_bits_t<5, 257>();
+				const int hdist = a.read_bits_t<5, 1>();
+				const int hclen = a.read_bits_t<4, 4>();
+				const int ntot = hlit + hdist;
+
+				uint8_t codelength_sizes[19] = {};
+				for (int i = 0; i < hclen; ++i)
 				{
-					a.read_bits(a.num_bits & 7); // discard
+					int s = a.read_bits(3);
+					codelength_sizes[LENGTH_DE_ZIGZAG[i]] = (uint8_t) s;
 				}
-				// drain the bit-packed data into header
+				z_codelength.zbuild_huffman(codelength_sizes, 19);
 
-				auto pev_bits = a.num_bits;
-				int k = 0;
-				while (a.num_bits > 0)
+				int n = 0;
+				while (n < ntot)
 				{
-					// suppress MSVC run-time check
-					header[k++] = static_cast<uint8_t>(a.code_buffer & 255);
-					a.code_buffer >>= 8;
-					a.num_bits -= 8;
-					if (a.num_bits > pev_bits)
+					int c = a.zhuffman_decode(z_codelength);
+					if (c < 0 || c >= 19)
+					{
+						throw Zlib::Err("bad codelengths");
+					}
+					if (c < 16)
 					{
-						throw Zlib::Err("zlib corrupt");
+						lencodes[n++] = static_cast<uint8_t>(c);
+					}
+					else
+					{
+						uint8_t fill = 0;
+						if (c == 16)
+						{
+							c = a.read_bits_t<2, 3>();
+							if (n == 0)
+							{
+								throw Zlib::Err("bad codelengths");
+							}
+							fill = lencodes[n - 1];
+						}
+						else if (c == 17)
+						{
+							c = a.read_bits_t<3, 3>();
+						}
+						else if (c == 18)
+						{
+							c = a.read_bits_t<7, 11>();
+						}
+						else
+						{
+							throw Zlib::Err("bad codelengths");
+						}
+						if (ntot - n < c)
+						{
+							throw Zlib::Err("bad codelengths");
+						}
+						std::memset(lencodes + n, fill, c);
+						n += c;
 					}
 				}
-				// now fill header the normal way
-				while (k < 4)
-				{
-					header[k++] = a.read_u8();
-				}
-				int len = header[1] * 256 + header[0];
-				int nlen = header[3] * 256 + header[2];
-				if (nlen != (len ^ 0xffff))
-				{
-					throw Zlib::Err("zlib corrupt");
-				}
-				if (a.zbuffer + len > a.zbuffer_end)
-				{
-					throw Zlib::Err("read past buffer");
-				}
-				if (a.zout + len > a.zout_end)
+				if (n != ntot)
 				{
-					a.zexpand(a.zout, len);
+					throw Zlib::Err("bad codelengths");
 				}
-				std::memcpy(a.zout, a.zbuffer, len);
-				a.zbuffer += len;
-				a.zout += len;
+				a.z_length.zbuild_huffman(lencodes, hlit);
+				a.z_distance.zbuild_huffman(lencodes + hlit, hdist);
 			}
-			else if (type == 3)
-			{
-				throw Zlib::Err("zdo_zlib: type == 3");
-			}
-			else
+
+			// zparse_huffman_block
+			auto zout = a.zout;
+			for (;;)
 			{
-				if (type == 1)
+				if (int z = a.zhuffman_decode(a.z_length); z < 256)
 				{
-					// use fixed code lengths
-					a.z_length.zbuild_huffman(DEFAULT_LENGTH, ZNSYMS);
-					a.z_distance.zbuild_huffman(DEFAULT_DISTANCE, 32);
+					if (z < 0)
+					{
+						// error in huffman codes
+						throw Zlib::Err("bad huffman code");
+					}
+					if (zout >= a.zout_end)
+					{
+						a.zexpand(zout, 1);
+						zout = a.zout;
+					}
+					*zout++ = static_cast<char>(z);
 				}
 				else
 				{
-					// zcompute_huffman_codes
-					ZHuffman z_codelength;
-					uint8_t lencodes[286 + 32 + 137]; //padding for maximum single op
-
-					const int hlit  = a.read_bits_t<5, 257>();
-					const int hdist = a.read_bits_t<5, 1>();
-					const int hclen = a.read_bits_t<4, 4>();
-					const int ntot = hlit + hdist;
-
-					uint8_t codelength_sizes[19] = {};
-					for (int i = 0; i < hclen; ++i)
+					if (z == 256)
 					{
-						int s = a.read_bits(3);
-						codelength_sizes[LENGTH_DE_ZIGZAG[i]] = (uint8_t) s;
+						a.zout = zout;
+						if (a.hit_zeof_once && a.num_bits < 16)
+						{
+							// The first time we hit zeof, we inserted 16 extra zero bits into our bit
+							// buffer so the decoder can just do its speculative decoding. But if we
+							// actually consumed any of those bits (which is the case when num_bits < 16),
+							// the stream actually read past the end so it is malformed.
+							throw Zlib::Err("unexpected end");
+						}
+						break;
 					}
-					z_codelength.zbuild_huffman(codelength_sizes, 19);
-
-					int n = 0;
-					while (n < ntot)
+					else
 					{
-						int c = a.zhuffman_decode(z_codelength);
-						if (c < 0 || c >= 19)
+						if (z >= 286)
 						{
-							throw Zlib::Err("bad codelengths");
+							throw Zlib::Err("bad huffman code");
 						}
-						if (c < 16)
+						// per DEFLATE, length codes 286 and 287 must not appear in compressed data
+						z -= 257;
+						int len = ZLENGTH_BASE[z];
+						if (ZLENGTH_EXTRA[z])
 						{
-							lencodes[n++] = static_cast<uint8_t>(c);
+							len += a.read_bits(ZLENGTH_EXTRA[z]);
 						}
-						else
+						z = a.zhuffman_decode(a.z_distance);
+						if (z < 0 || z >= 30)
 						{
-							uint8_t fill = 0;
-							if (c == 16)
-							{
-								c = a.read_bits_t<2, 3>();
-								if (n == 0)
-								{
-									throw Zlib::Err("bad codelengths");
-								}
-								fill = lencodes[n - 1];
-							}
-							else if (c == 17)
-							{
-								c = a.read_bits_t<3, 3>();
-							}
-							else if (c == 18)
-							{
-								c = a.read_bits_t<7, 11>();
-							}
-							else
-							{
-								throw Zlib::Err("bad codelengths");
-							}
-							if (ntot - n < c)
-							{
-								throw Zlib::Err("bad codelengths");
-							}
-							std::memset(lencodes + n, fill, c);
-							n += c;
+							throw Zlib::Err("bad huffman code");
 						}
-					}
-					if (n != ntot)
-					{
-						throw Zlib::Err("bad codelengths");
-					}
-					a.z_length.zbuild_huffman(lencodes, hlit);
-					a.z_distance.zbuild_huffman(lencodes + hlit, hdist);
-				}
-
-				// zparse_huffman_block
-				auto zout = a.zout;
-				for (;;)
-				{
-					if (int z = a.zhuffman_decode(a.z_length); z < 256)
-					{
-						if (z < 0)
+						// per DEFLATE, distance codes 30 and 31 must not appear in compressed data
+						int dist = ZDIST_BASE[z];
+						if (ZDIST_EXTRA[z])
 						{
-							// error in huffman codes
-							throw Zlib::Err("bad huffman code");
+							dist += a.read_bits(ZDIST_EXTRA[z]);
 						}
-						if (zout >= a.zout_end)
+						if (zout - a.zout_start < dist)
 						{
-							a.zexpand(zout, 1);
+							throw Zlib::Err("bad dist");
+						}
+						if (len > a.zout_end - zout)
+						{
+							a.zexpand(zout, len);
 							zout = a.zout;
 						}
-						*zout++ = static_cast<char>(z);
-					}
-					else
-					{
-						if (z == 256)
+						auto p2 = zout - dist;
+						if (dist == 1)
 						{
-							a.zout = zout;
-							if (a.hit_zeof_once && a.num_bits < 16)
+							// run of one byte; common in images.
+							auto v = *p2;
+							if (len)
 							{
-								// The first time we hit zeof, we inserted 16 extra zero bits into our bit
-								// buffer so the decoder can just do its speculative decoding. But if we
-								// actually consumed any of those bits (which is the case when num_bits < 16),
-								// the stream actually read past the end so it is malformed.
-								throw Zlib::Err("unexpected end");
+								do *zout++ = v; while (--len);
 							}
 						}
 						else
 						{
-							if (z >= 286)
-							{
-								throw Zlib::Err("bad huffman code");
-							}
-							// per DEFLATE, length codes 286 and 287 must not appear in compressed data
-							z -= 257;
-							int len = ZLENGTH_BASE[z];
-							if (ZLENGTH_EXTRA[z])
-							{
-								len += a.read_bits(ZLENGTH_EXTRA[z]);
-							}
-							z = a.zhuffman_decode(a.z_distance);
-							if (z < 0 || z >= 30)
-							{
-								throw Zlib::Err("bad huffman code");
-							}
-							// per DEFLATE, distance codes 30 and 31 must not appear in compressed data
-							int dist = ZDIST_BASE[z];
-							if (ZDIST_EXTRA[z])
-							{
-								dist += a.read_bits(ZDIST_EXTRA[z]);
-							}
-							if (zout - a.zout_start < dist)
-							{
-								throw Zlib::Err("bad dist");
-							}
-							if (len > a.zout_end - zout)
-							{
-								a.zexpand(zout, len);
-								zout = a.zout;
-							}
-							auto p2 = zout - dist;
-							if (dist == 1)
+							if (len)
 							{
-								// run of one byte; common in images.
-								auto v = *p2;
-								if (len)
-								{
-									do *zout++ = v; while (--len);
-								}
-							}
-							else
-							{
-								if (len)
-								{
-									do *zout++ = *p2++; while (--len);
-								}
+								do *zout++ = *p2++; while (--len);
 							}
 						}
 					}
 				}
 			}
-		} while (!final);
+		}
+	} while (!final);
+}
+
+auto Zlib::Context::decode_malloc_guesssize_headerflag () -> uint8_t *
+{
+	const auto p = this->malloc_t<uint8_t>(this->initial_size);
+	if (p == nullptr)
+	{
+		throw Zlib::Err("Out of memory");
+	}
+	ZBuffer a;
+	a.context = this;
+	a.zbuffer = this->buffer;
+	a.zbuffer_end = this->buffer + this->len;
+	try
+	{
+		a.zout_start = p;
+		a.zout = p;
+		a.zout_end = p + this->initial_size;
+		a.z_expandable = this->parse_header;
+
+		zinflate(a, this->parse_header);
 
-//
 		this->out_len = a.zout - a.zout_start;
 		return a.zout_start;
 	}
@@ -650,3 +712,44 @@ auto Zlib::Context::decode_malloc_guesssize_headerflag () -> uint8_t *
 	}
 }
 
+auto Zlib::Context::decode_streaming () -> void
+{
+	if (this->consume == nullptr)
+	{
+		throw Zlib::Err("no consumer given to a streaming decode");
+	}
+	const auto p = this->malloc_t<uint8_t>(this->initial_size);
+	if (p == nullptr)
+	{
+		throw Zlib::Err("Out of memory");
+	}
+	ZBuffer a;
+	a.context = this;
+	a.zbuffer = this->buffer;
+	a.zbuffer_end = this->buffer + this->len;
+	a.zout_start = p;
+	a.zout = p;
+	a.zout_end = p + this->initial_size;
+	a.zpending = p;
+	// the buffer only has to grow if a consumer sits on more than fits
+	a.z_expandable = true;
+	try
+	{
+		zinflate(a, this->parse_header);
+		// whatever's left after the last block
+		a.zflush();
+	}
+	catch (ZStop&)
+	{
+		// consumer had all it wanted
+	}
+	catch (...)
+	{
+		// decode errors, or whatever the consumer threw
+		this->free_t(a.zout_start);
+		throw;
+	}
+	this->out_len = a.zdiscarded + (a.zout - a.zout_start);
+	this->free_t(a.zout_start);
+}
+
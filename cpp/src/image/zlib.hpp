@@ -20,6 +20,9 @@ namespace Zlib {
 		}
 	};
 
+	// how far back a deflate back reference can reach
+	static constexpr size_t WINDOW_SIZE = 32768;
+
 	struct Context
 	{
 		using MallocCallback = auto (void* self, size_t size) -> void*;
@@ -48,6 +51,24 @@ namespace Zlib {
 		size_t out_len = 0;
 		uint8_t parse_header = false;
 
+		// when set, output gets handed over as it's produced instead of the
+		// whole stream being collected: the callback is given everything it
+		// hasn't consumed yet and returns how many bytes of that it used, or
+		// STOP to end decoding early. only what's unconsumed plus the last
+		// WINDOW_SIZE bytes are kept, so the buffer stays around initial_size
+		using ConsumeCallback = auto (
+			void* self,
+			uint8_t const* data,
+			size_t len
+		) -> size_t;
+
+		static constexpr size_t STOP = SIZE_MAX;
+
+		void* consume_self = nullptr;
+
+		ConsumeCallback*
+		consume = nullptr;
+
 		template<typename T>
 		auto free_t (T* p)
 		{
@@ -79,6 +100,10 @@ namespace Zlib {
 		}
 
 		auto decode_malloc_guesssize_headerflag() -> uint8_t*;
+
+		// decodes through 'consume'. out_len ends up as the total amount of
+		// data that was produced
+		auto decode_streaming() -> void;
 	};
 }
 
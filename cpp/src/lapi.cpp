@@ -1129,6 +1129,7 @@ LUA_API void lua_callk(lua_State *L, int nargs, int nresults,
 	api_check(L, L->status == LUA_OK, "cannot do calls on non-normal thread");
 	checkresults(L, nargs, nresults);
 	func = L->top.p - (nargs + 1);
+	RunningThread running(L);
 	if (k != NULL && L->yieldable())
 	{
 		/* need to prepare continuation? */
@@ -1182,6 +1183,7 @@ LUA_API int lua_pcallk(lua_State *L, int nargs, int nresults, int errfunc,
 		func = luaD::savestack(L, o);
 	}
 	c.func = L->top.p - (nargs + 1); /* function to be called */
+	RunningThread running(L);
 	if (k == NULL || !L->yieldable())
 	{
 		/* no continuation or no yieldable? */
@@ -1211,6 +1213,24 @@ LUA_API int lua_pcallk(lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
+/*
+** Set the global table as the 1st upvalue of a just loaded function
+*/
+static void setenvupvalue(lua_State *L)
+{
+	LClosure *f = clLvalue(s2v(L->top.p - 1)); /* get new function */
+	if (f->nupvalues >= 1)
+	{
+		/* does it have an upvalue? */
+		/* get global table from registry */
+		const TValue *gt = getGtable(L);
+		/* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
+		setobj(L, f->upvals[0]->v.p, gt);
+		luaC_barrier(L, f->upvals[0], gt);
+	}
+}
+
+
 LUA_API int lua_load(lua_State *L, lua_Reader reader, void *data,
 							const char *chunkname, const char *mode)
 {
@@ -1221,25 +1241,63 @@ LUA_API int lua_load(lua_State *L, lua_Reader reader, void *data,
 	z.init(L, reader, data);
 	// luaZ_init(L, &z, reader, data);
 	status = luaD::protectedparser(L, &z, chunkname, mode);
-	if (status == LUA_OK)
+	if (status == LUA_OK) /* no errors? */
+		setenvupvalue(L);
+	lua_unlock(L);
+	return status;
+}
+
+
+/*
+** Load a precompiled chunk from memory. An image (see 'lua_dumpimage')
+** is used in place: 'data' must stay valid, and 8-byte aligned, until
+** 'release' is called, which happens once no function loaded from it
+** is left, in any state. 'release' is also called if the load fails.
+*/
+LUA_API int lua_loadimage(lua_State *L, const void *data, size_t size,
+								  const char *chunkname, const char *mode,
+								  lua_ImageRelease release, void *ud)
+{
+	int status;
+	lua_lock(L);
+	if (!chunkname) chunkname = "?";
+	ChunkImage *im = luaU::newimage(data, size, release, ud);
+	if (im == NULL)
 	{
-		/* no errors? */
-		LClosure *f = clLvalue(s2v(L->top.p - 1)); /* get new function */
-		if (f->nupvalues >= 1)
-		{
-			/* does it have an upvalue? */
-			/* get global table from registry */
-			const TValue *gt = getGtable(L);
-			/* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
-			setobj(L, f->upvals[0]->v.p, gt);
-			luaC_barrier(L, f->upvals[0], gt);
-		}
+		setsvalue2s(L, L->top.p, G(L)->memerrmsg);
+		api_incr_top(L);
+		lua_unlock(L);
+		return LUA_ERRMEM;
 	}
+	status = luaD::protectedimage(L, im, chunkname, mode);
+	luaU::releaseimage(im); /* loaded functions hold their own references */
+	if (status == LUA_OK)
+		setenvupvalue(L);
 	lua_unlock(L);
 	return status;
 }
 
 
+static void f_loadtree(lua_State *L, void *ud)
+{
+	luaU::loadtree(L, static_cast<Proto *>(ud));
+}
+
+
+/*
+** Load what an image left lazy in 'p', so that all of it can be dumped.
+** It runs in protected mode and gives an error status only, leaving the
+** stack as it was.
+*/
+static int loadtree(lua_State *L, Proto *p)
+{
+	ptrdiff_t top = luaD::savestack(L, L->top.p);
+	int status = luaD::pcall(L, f_loadtree, p, top, 0);
+	L->top.p = luaD::restorestack(L, top); /* remove any error message */
+	return status;
+}
+
+
 LUA_API int lua_dump(lua_State *L, lua_Writer writer, void *data, int strip)
 {
 	int status;
@@ -1248,7 +1306,33 @@ LUA_API int lua_dump(lua_State *L, lua_Writer writer, void *data, int strip)
 	api_checknelems(L, 1);
 	o = s2v(L->top.p - 1);
 	if (isLfunction(o))
-		status = luaU::dump(L, getproto(o), writer, data, strip);
+	{
+		Proto *p = getproto(o); /* 'o' may move with the stack */
+		status = loadtree(L, p); /* nothing left in an image */
+		if (status == LUA_OK)
+			status = luaU::dump(L, p, writer, data, strip);
+	}
+	else
+		status = 1;
+	lua_unlock(L);
+	return status;
+}
+
+
+LUA_API int lua_dumpimage(lua_State *L, lua_Writer writer, void *data, int strip)
+{
+	int status;
+	TValue *o;
+	lua_lock(L);
+	api_checknelems(L, 1);
+	o = s2v(L->top.p - 1);
+	if (isLfunction(o))
+	{
+		Proto *p = getproto(o); /* 'o' may move with the stack */
+		status = loadtree(L, p); /* nothing left in an image */
+		if (status == LUA_OK)
+			status = luaU::dumpimage(L, p, writer, data, strip);
+	}
 	else
 		status = 1;
 	lua_unlock(L);
@@ -1481,6 +1565,15 @@ void lua_setwarnf(lua_State *L, lua_WarnFunction f, void *ud)
 }
 
 
+LUA_API void lua_setiterator(lua_State *L, int what, lua_CFunction f)
+{
+	lua_lock(L);
+	api_check(L, 0 <= what && what < LUA_NUMITERATORS, "invalid iterator");
+	G(L)->iterators[what] = f;
+	lua_unlock(L);
+}
+
+
 void lua_warning(lua_State *L, const char *msg, int tocont)
 {
 	lua_lock(L);
@@ -1503,7 +1596,7 @@ LUA_API void *lua_newuserdatauv(lua_State *L, size_t size, int nuvalue)
 }
 
 
-static const char *aux_upvalue(TValue *fi, int n, TValue **val,
+static const char *aux_upvalue(lua_State *L, TValue *fi, int n, TValue **val,
 										GCObject **owner)
 {
 	switch (ttypetag(fi))
@@ -1526,6 +1619,8 @@ static const char *aux_upvalue(TValue *fi, int n, TValue **val,
 				return NULL; /* 'n' not in [1, p->sizeupvalues] */
 			*val = f->upvals[n - 1]->v.p;
 			if (owner) *owner = obj2gco(f->upvals[n - 1]);
+			if (p->lazydebug) /* names still in its image? */
+				luaG_loaddebug(L, p);
 			name = p->upvalues[n - 1].name;
 			return (name == NULL) ? "(no name)" : getstr(name);
 		}
@@ -1539,7 +1634,7 @@ LUA_API const char *lua_getupvalue(lua_State *L, int funcindex, int n)
 	const char *name;
 	TValue *val = NULL; /* to avoid warnings */
 	lua_lock(L);
-	name = aux_upvalue(index2value(L, funcindex), n, &val, NULL);
+	name = aux_upvalue(L, index2value(L, funcindex), n, &val, NULL);
 	if (name)
 	{
 		setobj2s(L, L->top.p, val);
@@ -1559,7 +1654,7 @@ LUA_API const char *lua_setupvalue(lua_State *L, int funcindex, int n)
 	lua_lock(L);
 	fi = index2value(L, funcindex);
 	api_checknelems(L, 1);
-	name = aux_upvalue(fi, n, &val, &owner);
+	name = aux_upvalue(L, fi, n, &val, &owner);
 	if (name)
 	{
 		L->top.p--;
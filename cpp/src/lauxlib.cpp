@@ -17,6 +17,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 
 /*
 ** This file uses only the official API of Lua.
@@ -883,6 +887,614 @@ static int skipcomment(FILE *f, int *cp)
 }
 
 
+/*
+** {======================================================
+** Mapped files: a precompiled file is mapped into memory and given to
+** 'lua_loadimage', so that an image is used in place. 'mapfile' gives
+** NULL if the file cannot be mapped, for the caller to read it as a
+** stream instead; 'unmapfile' takes the mapping's base as 'ud'.
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define l_fileid(st)	(static_cast<long long>((st).st_mtime))
+
+static char *mapfile(FILE *f, size_t *size)
+{
+	struct stat st;
+	if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+		 static_cast<unsigned long long>(st.st_size) > MAX_SIZET)
+		return NULL;
+	*size = static_cast<size_t>(st.st_size);
+	void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	return (data == MAP_FAILED) ? NULL : static_cast<char *>(data);
+}
+
+
+static void unmapfile(void *ud, const void *data, size_t size)
+{
+	munmap(ud, size + (static_cast<const char *>(data) - static_cast<char *>(ud)));
+}
+
+
+/* create a new file in 'dir', its name left in 'tmp' */
+static FILE *tempfile(lua_State *L, const char *dir, const char **tmp)
+{
+	char *name = static_cast<char *>(
+		lua_newuserdatauv(L, strlen(dir) + sizeof(LUA_DIRSEP "luaXXXXXX"), 0));
+	strcpy(name, dir);
+	strcat(name, LUA_DIRSEP "luaXXXXXX");
+	int fd = mkstemp(name);
+	if (fd == -1)
+		return NULL;
+	*tmp = name;
+	FILE *f = fdopen(fd, "wb");
+	if (f == NULL)
+	{
+		close(fd);
+		remove(name);
+	}
+	return f;
+}
+
+
+#define l_replacefile(from,to)	(rename(from, to) == 0)
+
+#elif defined(LUA_USE_WINDOWS)	/* }{ */
+
+#include <io.h>
+#include <sys/stat.h>
+#include <windows.h>
+
+#define l_fileid(st)	(static_cast<long long>((st).st_mtime))
+
+#if !defined(S_ISREG)
+#define S_ISREG(m)	(((m) & S_IFMT) == S_IFREG)
+#endif
+
+static char *mapfile(FILE *f, size_t *size)
+{
+	auto file = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(f)));
+	LARGE_INTEGER sz;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &sz) ||
+		 sz.QuadPart <= 0 ||
+		 static_cast<unsigned long long>(sz.QuadPart) > MAX_SIZET)
+		return NULL;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+		return NULL;
+	void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping); /* the view keeps it */
+	*size = static_cast<size_t>(sz.QuadPart);
+	return static_cast<char *>(data);
+}
+
+
+static void unmapfile(void *ud, const void *data, size_t size)
+{
+	(void) data; (void) size; /* not used */
+	UnmapViewOfFile(ud);
+}
+
+
+/* create a new file in 'dir', its name left in 'tmp' */
+static FILE *tempfile(lua_State *L, const char *dir, const char **tmp)
+{
+	char *name = static_cast<char *>(lua_newuserdatauv(L, MAX_PATH, 0));
+	if (GetTempFileNameA(dir, "lua", 0, name) == 0)
+		return NULL;
+	*tmp = name;
+	FILE *f = fopen(name, "wb");
+	if (f == NULL)
+		remove(name);
+	return f;
+}
+
+
+#define l_replacefile(from,to)	MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING)
+
+#else				/* }{ */
+
+static char *mapfile(FILE *f, size_t *size)
+{
+	(void) f; (void) size;
+	return NULL;
+}
+
+
+static void unmapfile(void *ud, const void *data, size_t size)
+{
+	(void) ud; (void) data; (void) size;
+}
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Compiled-chunk cache: with a cache directory set (see
+** 'luaL_setchunkcache'), a text file loaded by 'luaL_loadfilex' is kept
+** there compiled, as an image, one entry per source path. An entry is
+** used only if the modification time, size and contents of the source
+** still match it. Entries are written to a new file and renamed into
+** place, so that readers never see a partial one; readers map entries,
+** so a replaced entry stays valid for whoever loaded it.
+** =======================================================
+*/
+
+#define CHUNKCACHE	"_CHUNKCACHE"
+#define CACHEENV	"LUA_CACHEDIR"
+
+/* header of a cache entry; the image follows, still 8-byte aligned */
+struct CacheHeader
+{
+	char magic[8];
+	long long fileid; /* source's modification time */
+	unsigned long long size; /* source's size */
+	unsigned long long hash; /* of the source's contents */
+};
+
+static const char cachemagic[8] = {'\x1b', 'L', 'c', 'a', 'c', 'h', 'e', '1'};
+
+
+/* FNV-1a */
+static unsigned long long hashbytes(const char *s, size_t l)
+{
+	unsigned long long h = 14695981039346656037ull;
+	for (size_t i = 0; i < l; i++)
+		h = (h ^ static_cast<unsigned char>(s[i])) * 1099511628211ull;
+	return h;
+}
+
+
+/*
+** Read the text file 'filename' onto the stack and fill 'h' to match
+** it. Gives the start of its code, past a BOM and a first-line comment,
+** or NULL (having pushed nothing) if the file cannot be read or holds
+** a binary chunk.
+*/
+static const char *readsource(lua_State *L, const char *filename,
+										CacheHeader *h)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return NULL;
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	size_t n;
+	do
+	{
+		char *p = luaL_prepbuffer(&b);
+		n = fread(p, 1, LUAL_BUFFERSIZE, f);
+		luaL_addsize(&b, n);
+	} while (n == LUAL_BUFFERSIZE);
+	bool readerror = ferror(f);
+	fclose(f);
+	luaL_pushresult(&b);
+	size_t len;
+	const char *src = lua_tolstring(L, -1, &len);
+	/* skip BOM and a first-line comment, as 'skipcomment' does */
+	const char *body = src;
+	if (len >= 3 && memcmp(body, "\xEF\xBB\xBF", 3) == 0)
+		body += 3;
+	if (body < src + len && *body == '#')
+	{
+		const char *nl = static_cast<const char *>(memchr(body, '\n', src + len - body));
+		body = (nl != NULL) ? nl : src + len; /* keep the newline */
+	}
+	if (readerror || (body < src + len && *body == LUA_SIGNATURE[0]))
+	{
+		lua_pop(L, 1);
+		return NULL; /* a binary chunk goes the usual way */
+	}
+	memcpy(h->magic, cachemagic, sizeof(h->magic));
+	h->fileid = 0;
+#if defined(l_fileid)
+	struct stat st;
+	if (stat(filename, &st) == 0)
+		h->fileid = l_fileid(st);
+#endif
+	h->size = len;
+	h->hash = hashbytes(src, len);
+	return body;
+}
+
+
+#if defined(l_replacefile)	/* { */
+
+
+static int writeentry(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	(void) L; /* not used */
+	return fwrite(p, 1, sz, static_cast<FILE *>(ud)) != sz;
+}
+
+
+/*
+** Put the function on the top into the cache as 'entry'; any failure
+** just leaves the cache as it was
+*/
+static void storeentry(lua_State *L, const char *dir, const char *entry,
+							  const CacheHeader *h)
+{
+	const char *tmp;
+	FILE *f = tempfile(L, dir, &tmp);
+	if (f == NULL)
+	{
+		lua_pop(L, 1); /* name buffer */
+		return;
+	}
+	lua_pushvalue(L, -2); /* function */
+	bool ok = fwrite(h, sizeof(*h), 1, f) == 1 &&
+				 lua_dumpimage(L, writeentry, f, 0) == 0;
+	lua_pop(L, 1);
+	ok = (fclose(f) == 0) && ok;
+	if (!ok || !l_replacefile(tmp, entry))
+		remove(tmp);
+	lua_pop(L, 1); /* name buffer */
+}
+
+
+/*
+** Load the source on the top, whose code starts at 'body' and whose
+** header is 'h', from its entry in cache directory 'dir', compiling it
+** (and storing the entry) on a miss. Leaves the function or an error
+** message above the source.
+*/
+static int loadentry(lua_State *L, const char *dir, const char *body,
+							const CacheHeader *h, const char *filename,
+							const char *chunkname, const char *mode)
+{
+	const char *src = lua_tostring(L, -1);
+	/* code compiled at another optimization level is another entry */
+	const char *level = (mode != NULL) ? strpbrk(mode, "0123456789") : NULL;
+	char key[24];
+	snprintf(key, sizeof(key), "%016llx%s%.1s", hashbytes(filename, strlen(filename)),
+				(level != NULL) ? "-O" : "", (level != NULL) ? level : "");
+	const char *entry = lua_pushfstring(L, "%s" LUA_DIRSEP "%s.luac", dir, key);
+	int status = -1;
+	FILE *f = fopen(entry, "rb");
+	if (f != NULL)
+	{
+		size_t size;
+		char *data = mapfile(f, &size);
+		fclose(f);
+		if (data != NULL)
+		{
+			if (size > sizeof(*h) && memcmp(data, h, sizeof(*h)) == 0)
+			{
+				status = lua_loadimage(L, data + sizeof(*h), size - sizeof(*h),
+											  chunkname, NULL, unmapfile, data);
+				if (status != LUA_OK)
+				{
+					lua_pop(L, 1); /* a bad entry: compile it again */
+					status = -1;
+				}
+			}
+			else
+				unmapfile(data, data, size);
+		}
+	}
+	if (status == -1)
+	{
+		status = luaL_loadbufferx(L, body, src + h->size - body, chunkname, mode);
+		if (status == LUA_OK)
+			storeentry(L, dir, entry, h);
+	}
+	lua_remove(L, -2); /* entry name */
+	return status;
+}
+
+
+/*
+** Load 'filename' through the cache, leaving the function or an error
+** message on the top. Gives -1 (having pushed nothing) when the cache
+** is off or not fit for this file, for the caller to load it as usual.
+*/
+static int loadcached(lua_State *L, const char *filename,
+							 const char *chunkname, const char *mode)
+{
+	int base = lua_gettop(L);
+	if (mode != NULL && strchr(mode, 't') == NULL)
+		return -1; /* let the usual path refuse it */
+	int t = lua_getfield(L, LUA_REGISTRYINDEX, CHUNKCACHE);
+	if (t == LUA_TNIL)
+	{
+		lua_pop(L, 1);
+		lua_pushstring(L, getenv(CACHEENV));
+		t = lua_type(L, -1);
+	}
+	struct stat st;
+	CacheHeader h;
+	const char *body;
+	if (t != LUA_TSTRING || stat(filename, &st) != 0 || !S_ISREG(st.st_mode) ||
+		 (body = readsource(L, filename, &h)) == NULL)
+	{
+		lua_settop(L, base);
+		return -1;
+	}
+	int status = loadentry(L, lua_tostring(L, -2), body, &h, filename,
+								  chunkname, mode);
+	lua_replace(L, base + 1);
+	lua_settop(L, base + 1);
+	return status;
+}
+
+#else				/* }{ */
+
+static int loadentry(lua_State *L, const char *dir, const char *body,
+							const CacheHeader *h, const char *filename,
+							const char *chunkname, const char *mode)
+{
+	(void) dir; (void) filename; /* no cache: just compile it */
+	const char *src = lua_tostring(L, -1);
+	return luaL_loadbufferx(L, body, src + h->size - body, chunkname, mode);
+}
+
+
+static int loadcached(lua_State *L, const char *filename,
+							 const char *chunkname, const char *mode)
+{
+	(void) L; (void) filename; (void) chunkname; (void) mode;
+	return -1;
+}
+
+#endif				/* } */
+
+
+LUALIB_API void luaL_setchunkcache(lua_State *L, const char *dir)
+{
+	if (dir != NULL)
+		lua_pushstring(L, dir);
+	else
+		lua_pushboolean(L, 0);
+	lua_setfield(L, LUA_REGISTRYINDEX, CHUNKCACHE);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Prefetched chunks: 'luaL_prefetch' compiles a list of text files
+** together, on worker threads, each with a scratch state of its own.
+** Each function is dumped as an image, kept in the registry until the
+** first 'luaL_loadfilex' of that file takes it and loads it in place,
+** provided the file still has the contents it was compiled from. A file
+** that does not compile is left out, for its load to report the error
+** as usual.
+** =======================================================
+*/
+
+#define PREFETCHED	"_PREFETCHED"
+#define PREFETCHEDMT	"_PREFETCHED*"
+
+typedef struct Prefetched
+{
+	char *data; /* image, from 'malloc'; NULL if none */
+	size_t size;
+	char level; /* optimization level in the mode, '\0' if none */
+	CacheHeader h; /* of the source it was compiled from */
+} Prefetched;
+
+
+static void freeimage(void *ud, const void *data, size_t size)
+{
+	(void) data; (void) size; /* not used */
+	free(ud);
+}
+
+
+static int prefetchgc(lua_State *L)
+{
+	auto p = static_cast<Prefetched *>(lua_touserdata(L, 1));
+	free(p->data);
+	p->data = NULL;
+	return 0;
+}
+
+
+/* a cloned state gets its own copy of the image, or none */
+static int prefetchclone(lua_State *L)
+{
+	auto p = static_cast<Prefetched *>(lua_touserdata(L, 1));
+	if (p->data != NULL)
+	{
+		char *data = static_cast<char *>(malloc(p->size));
+		if (data != NULL)
+			memcpy(data, p->data, p->size);
+		p->data = data;
+	}
+	return 0;
+}
+
+
+static const luaL_Reg prefetchmt[] = {
+	{"__gc", prefetchgc},
+	{"__clone", prefetchclone},
+	{NULL, NULL}
+};
+
+
+static char modelevel(const char *mode)
+{
+	const char *level = (mode != NULL) ? strpbrk(mode, "0123456789") : NULL;
+	return (level != NULL) ? *level : '\0';
+}
+
+
+static int writeimage(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	(void) L; /* not used */
+	auto img = static_cast<Prefetched *>(ud);
+	char *data = static_cast<char *>(realloc(img->data, img->size + sz));
+	if (data == NULL)
+		return 1;
+	memcpy(data + img->size, p, sz);
+	img->data = data;
+	img->size += sz;
+	return 0;
+}
+
+
+/*
+** Compile 'filename' in a state of its own, leaving its image in 'img'.
+** Runs on a worker thread. 'cache' is the chunk cache to use, if any.
+** (A binary file is left out: it is already loaded in place.)
+*/
+static void prefetchfile(const char *filename, const char *mode,
+								 const char *cache, Prefetched *img)
+{
+	lua_State *L = luaL_newstate();
+	if (L == NULL)
+		return;
+	const char *chunkname = lua_pushfstring(L, "@%s", filename);
+	const char *body = readsource(L, filename, &img->h);
+	if (body != NULL)
+	{
+		const char *src = lua_tostring(L, -1);
+		int status = (cache != NULL)
+							 ? loadentry(L, cache, body, &img->h, filename, chunkname, mode)
+							 : luaL_loadbufferx(L, body, src + img->h.size - body, chunkname, mode);
+		if (status == LUA_OK && lua_dumpimage(L, writeimage, img, 0) != 0)
+		{
+			free(img->data);
+			img->data = NULL;
+		}
+	}
+	lua_close(L);
+}
+
+
+LUALIB_API int luaL_prefetch(lua_State *L, const char *const *files, int n,
+									  const char *mode)
+{
+	std::vector<const char *> names;
+	std::vector<Prefetched *> imgs;
+	if (mode != NULL && strchr(mode, 't') == NULL)
+		return 0; /* only text files are compiled */
+	/* the workers use the same chunk cache */
+	int t = lua_getfield(L, LUA_REGISTRYINDEX, CHUNKCACHE);
+	if (t == LUA_TNIL)
+	{
+		lua_pop(L, 1);
+		lua_pushstring(L, getenv(CACHEENV));
+		t = lua_type(L, -1);
+	}
+	const char *cache = (t == LUA_TSTRING) ? lua_tostring(L, -1) : NULL;
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, PREFETCHED);
+	lua_newtable(L); /* this call's images, by name, kept until the end */
+	for (int i = 0; i < n; i++)
+	{
+		if (lua_getfield(L, -1, files[i]) != LUA_TNIL)
+		{
+			lua_pop(L, 1);
+			continue; /* a repeated name */
+		}
+		lua_pop(L, 1);
+		auto img = static_cast<Prefetched *>(lua_newuserdatauv(L, sizeof(Prefetched), 0));
+		img->data = NULL;
+		img->size = 0;
+		img->level = modelevel(mode);
+		if (luaL_newmetatable(L, PREFETCHEDMT))
+			luaL_setfuncs(L, prefetchmt, 0);
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -3, files[i]);
+		lua_setfield(L, -3, files[i]);
+		names.push_back(files[i]);
+		imgs.push_back(img);
+	}
+	int m = static_cast<int>(names.size());
+	std::atomic<int> next{0};
+	auto work = [&]
+	{
+		for (int i; (i = next.fetch_add(1)) < m;)
+			prefetchfile(names[i], mode, cache, imgs[i]);
+	};
+	std::vector<std::thread> workers;
+	unsigned int nworkers = std::thread::hardware_concurrency();
+	try
+	{
+		while (workers.size() + 1 < nworkers && workers.size() + 1 < static_cast<size_t>(m))
+			workers.emplace_back(work);
+	}
+	catch (...)
+	{
+		/* run with the workers there are */
+	}
+	work(); /* this thread works too */
+	for (auto &w : workers)
+		w.join();
+	int count = 0;
+	for (int i = 0; i < m; i++)
+	{
+		if (imgs[i]->data != NULL)
+			count++;
+		else
+		{
+			lua_pushnil(L);
+			lua_setfield(L, -3, names[i]);
+		}
+	}
+	lua_pop(L, 3); /* images, table and cache */
+	return count;
+}
+
+
+/*
+** Load 'filename' from its prefetched image, if there is one fit for
+** 'mode' and the file has not changed since, leaving the function or an
+** error message on the top. Gives -1 (having pushed nothing) otherwise.
+*/
+static int loadprefetched(lua_State *L, const char *filename,
+								  const char *chunkname, const char *mode)
+{
+	if (lua_getfield(L, LUA_REGISTRYINDEX, PREFETCHED) != LUA_TTABLE)
+	{
+		lua_pop(L, 1);
+		return -1;
+	}
+	lua_getfield(L, -1, filename);
+	auto p = static_cast<Prefetched *>(luaL_testudata(L, -1, PREFETCHEDMT));
+	if (p == NULL || p->data == NULL || p->level != modelevel(mode) ||
+		 (mode != NULL && strchr(mode, 't') == NULL))
+	{
+		lua_pop(L, 2);
+		return -1;
+	}
+	/* the image is used once, in any case */
+	lua_pushnil(L);
+	lua_setfield(L, -3, filename);
+	CacheHeader h;
+	if (readsource(L, filename, &h) == NULL)
+	{
+		lua_pop(L, 2);
+		return -1;
+	}
+	lua_pop(L, 1); /* source */
+	if (h.size != p->h.size || h.hash != p->h.hash)
+	{
+		lua_pop(L, 2); /* changed since: compile it again */
+		return -1;
+	}
+	char *data = p->data;
+	size_t size = p->size;
+	p->data = NULL; /* the function takes it */
+	lua_pop(L, 2);
+	return lua_loadimage(L, data, size, chunkname, NULL, freeimage, data);
+}
+
+/* }====================================================== */
+
+
 LUALIB_API int luaL_loadfilex(lua_State *L, const char *filename,
 										const char *mode)
 {
@@ -898,6 +1510,14 @@ LUALIB_API int luaL_loadfilex(lua_State *L, const char *filename,
 	else
 	{
 		lua_pushfstring(L, "@%s", filename);
+		status = loadprefetched(L, filename, lua_tostring(L, -1), mode);
+		if (status == -1)
+			status = loadcached(L, filename, lua_tostring(L, -1), mode);
+		if (status != -1)
+		{
+			lua_remove(L, fnameindex);
+			return status;
+		}
 		errno = 0;
 		lf.f = fopen(filename, "r");
 		if (lf.f == NULL) return errfile(L, "open", fnameindex);
@@ -915,7 +1535,21 @@ LUALIB_API int luaL_loadfilex(lua_State *L, const char *filename,
 			errno = 0;
 			lf.f = freopen(filename, "rb", lf.f); /* reopen in binary mode */
 			if (lf.f == NULL) return errfile(L, "reopen", fnameindex);
-			skipcomment(lf.f, &c); /* re-read initial portion */
+			/* map it, unless something comes before the chunk */
+			if (!skipcomment(lf.f, &c) && c == LUA_SIGNATURE[0] &&
+				 ftell(lf.f) == 1)
+			{
+				size_t size;
+				char *data = mapfile(lf.f, &size);
+				if (data != NULL)
+				{
+					fclose(lf.f);
+					status = lua_loadimage(L, data, size, lua_tostring(L, -1),
+												  mode, unmapfile, data);
+					lua_remove(L, fnameindex);
+					return status;
+				}
+			}
 		}
 	}
 	if (c != EOF)
@@ -119,6 +119,21 @@ LUALIB_API int (luaL_loadfilex)(lua_State *L, const char *filename,
 
 LUALIB_API int luaL_loadfile (lua_State* L, const char* f);
 
+/*
+** Keep text files loaded by 'luaL_loadfilex' compiled in directory
+** 'dir' (which must exist); NULL turns that off. Without a call, the
+** directory in environment variable LUA_CACHEDIR, if any, is used.
+*/
+LUALIB_API void (luaL_setchunkcache)(lua_State *L, const char *dir);
+
+/*
+** Compile the 'n' text files in 'files' on worker threads, for the next
+** 'luaL_loadfilex' of each with the same 'mode' to load it precompiled.
+** Returns how many of them compiled.
+*/
+LUALIB_API int (luaL_prefetch)(lua_State *L, const char *const *files, int n,
+										 const char *mode);
+
 LUALIB_API int (luaL_loadbufferx)(lua_State *L, const char *buff, size_t sz,
 											const char *name, const char *mode);
 
@@ -0,0 +1,465 @@
+/*
+** $Id: lclone.c $
+** Cloning a state from an initialized template
+** See Copyright Notice in lua.h
+*/
+
+#define lclone_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "lua.hpp"
+
+#include "ldebug.hpp"
+#include "ldo.hpp"
+#include "lfunc.hpp"
+#include "lgc.hpp"
+#include "lmem.hpp"
+#include "lobject.hpp"
+#include "lstate.hpp"
+#include "lstring.hpp"
+#include "ltable.hpp"
+#include "ltm.hpp"
+#include "dump/lundump.hpp"
+
+
+/*
+** original -> copy, open addressed; one probe for most lookups matters
+** here, as every reference in the template goes through it
+*/
+struct CopyMap
+{
+	std::vector<std::pair<const GCObject *, GCObject *>> slots;
+	size_t mask = 0;
+
+	void reserve (size_t n)
+	{
+		size_t size = 16;
+		while (size < n * 2)
+			size <<= 1;
+		slots.assign(size, {nullptr, nullptr});
+		mask = size - 1;
+	}
+
+	static size_t hash (const GCObject *o)
+	{
+		auto h = reinterpret_cast<uintptr_t>(o);
+		return static_cast<size_t>((h >> 4) * 0x9E3779B97F4A7C15ull >> 16);
+	}
+
+	/* the slot for 'o', empty if it has no copy yet */
+	std::pair<const GCObject *, GCObject *> &find (const GCObject *o)
+	{
+		for (size_t i = hash(o); ; i++)
+		{
+			auto &slot = slots[i & mask];
+			if (slot.first == o || slot.first == nullptr)
+				return slot;
+		}
+	}
+};
+
+
+/*
+** Copies everything reachable from a template's registry and basic-type
+** metatables into a new state, object by object, keeping shared objects
+** shared. Each object is made as soon as it is first reached and filled
+** in later from a worklist, so deep graphs don't recurse. The collector
+** of the new state stays stopped until the copy is complete.
+**
+** Userdata are copied byte for byte. Those holding resources of their
+** own should have a '__clone' metamethod, called with the copy once the
+** whole state is built, to take their own reference or to give it up.
+** Until then copies due a finalizer carry a placeholder metatable with
+** a '__gc' that does nothing, so a clone that fails half way releases
+** nothing it never took. (They are registered for finalization as they
+** are made, while still at the head of 'allgc', as registering walks
+** that list.)
+*/
+struct Cloner
+{
+	lua_State *from;
+	lua_State *L;
+	CopyMap copies;
+	std::vector<std::pair<GCObject *, GCObject *>> work; /* original, copy */
+	std::vector<std::pair<GCObject *, Table *>> metatables; /* copy, its mt */
+	Table *gcmark = nullptr;
+
+	static int nogc (lua_State *L)
+	{
+		UNUSED(L);
+		return 0;
+	}
+
+	/*
+	** registers copy 'c' for finalization if the original has a finalizer
+	** (its metatable 'mt')
+	*/
+	void finalizable (GCObject *c, Table *mt)
+	{
+		if (mt == nullptr || notm(luaH_getshortstr(mt, G(from)->tmname[TM_GC])))
+			return;
+		if (gcmark == nullptr)
+		{
+			gcmark = luaH_newt(L);
+			TValue k, v;
+			setsvalue(L, &k, G(L)->tmname[TM_GC]);
+			setfvalue(&v, nogc);
+			luaH_set(L, gcmark, &k, &v);
+			invalidateTMcache(gcmark);
+		}
+		if (c->tt == LUA_VTABLE)
+			gco2t(c)->metatable = gcmark;
+		else
+			gco2u(c)->metatable = gcmark;
+		luaC_checkfinalizer(L, c, gcmark);
+	}
+
+	GCObject *object (GCObject *o)
+	{
+		auto &slot = copies.find(o);
+		if (slot.first != nullptr)
+			return slot.second;
+		GCObject *c;
+		switch (o->tt)
+		{
+			case LUA_VSHRSTR:
+			case LUA_VLNGSTR:
+			{
+				TString *ts = gco2ts(o);
+				c = obj2gco(luaS::newlstr(L, getstr(ts), tsslen(ts)));
+				slot = {o, c};
+				return c; /* nothing to fill */
+			}
+			case LUA_VTABLE:
+				c = obj2gco(luaH_newt(L));
+				finalizable(c, gco2t(o)->metatable);
+				break;
+			case LUA_VLCL:
+				c = obj2gco(luaF::newLclosure(L, gco2lcl(o)->nupvalues));
+				break;
+			case LUA_VCCL:
+			{
+				CClosure *cl = luaF::newCclosure(L, gco2ccl(o)->nupvalues);
+				cl->f = gco2ccl(o)->f;
+				for (int i = 0; i < cl->nupvalues; i++)
+					setnilvalue(&cl->upvalue[i]);
+				c = obj2gco(cl);
+				break;
+			}
+			case LUA_VUSERDATA:
+			{
+				Udata *u = gco2u(o);
+				Udata *nu = luaS::newudata(L, u->len, u->nuvalue);
+				std::memcpy(getudatamem(nu), getudatamem(u), u->len);
+				c = obj2gco(nu);
+				finalizable(c, u->metatable);
+				break;
+			}
+			case LUA_VPROTO:
+				c = obj2gco(luaF::newproto(L));
+				break;
+			case LUA_VUPVAL:
+			{
+				UpVal *uv = gco2upv(luaC_newobj(L, LUA_VUPVAL, sizeof(UpVal)));
+				uv->v.p = &uv->u.value;
+				setnilvalue(uv->v.p);
+				c = obj2gco(uv);
+				break;
+			}
+			default: /* threads other than the main one */
+				luaG_runerror(L, "cannot clone a state holding a coroutine");
+		}
+		slot = {o, c};
+		work.emplace_back(o, c);
+		return c;
+	}
+
+	void value (TValue *to, const TValue *v)
+	{
+		if (iscollectable(v))
+		{
+			setgcovalue(L, to, object(gcvalue(v)));
+		}
+		else
+		{
+			setobj(L, to, v);
+		}
+	}
+
+	TString *string (TString *ts)
+	{
+		return ts == nullptr ? nullptr : gco2ts(object(obj2gco(ts)));
+	}
+
+	void table (Table *t, Table *nt)
+	{
+		unsigned int asize = luaH_realasize(t);
+		unsigned int hsize = 0;
+		for (int i = 0; i < sizenode(t); i++)
+			hsize += !isempty(gval(gnode(t, i)));
+		luaH_resize(L, nt, asize, hsize);
+		for (unsigned int i = 0; i < asize; i++)
+			value(&nt->array[i], &t->array[i]);
+		for (int i = 0; i < sizenode(t); i++)
+		{
+			Node *n = gnode(t, i);
+			if (isempty(gval(n)))
+				continue;
+			TValue k, key, val;
+			getnodekey(L, &k, n);
+			value(&key, &k);
+			value(&val, gval(n));
+			luaH_set(L, nt, &key, &val);
+		}
+		invalidateTMcache(nt);
+		if (t->metatable != nullptr)
+			metatables.emplace_back(obj2gco(nt), gco2t(object(obj2gco(t->metatable))));
+	}
+
+	void proto (Proto *f, Proto *nf)
+	{
+		nf->numparams = f->numparams;
+		nf->is_vararg = f->is_vararg;
+		nf->maxstacksize = f->maxstacksize;
+		nf->linedefined = f->linedefined;
+		nf->lastlinedefined = f->lastlinedefined;
+		if (f->image != nullptr)
+		{
+			/* share the arrays that live in the image */
+			luaU::retainimage(f->image);
+			nf->image = f->image;
+			nf->lazy = f->lazy;
+			nf->lazydebug = f->lazydebug;
+			nf->code = f->code;
+			nf->sizecode = f->sizecode;
+			nf->lineinfo = f->lineinfo;
+			nf->sizelineinfo = f->sizelineinfo;
+			nf->abslineinfo = f->abslineinfo;
+			nf->sizeabslineinfo = f->sizeabslineinfo;
+		}
+		else
+		{
+			nf->code = luaM::newvectorchecked<Instruction>(L, f->sizecode);
+			nf->sizecode = f->sizecode;
+			if (f->sizecode > 0)
+				std::memcpy(nf->code, f->code, f->sizecode * sizeof(Instruction));
+			nf->lineinfo = luaM::newvectorchecked<ls_byte>(L, f->sizelineinfo);
+			nf->sizelineinfo = f->sizelineinfo;
+			if (f->sizelineinfo > 0)
+				std::memcpy(nf->lineinfo, f->lineinfo, f->sizelineinfo * sizeof(ls_byte));
+			nf->abslineinfo = luaM::newvectorchecked<AbsLineInfo>(L, f->sizeabslineinfo);
+			nf->sizeabslineinfo = f->sizeabslineinfo;
+			if (f->sizeabslineinfo > 0)
+				std::memcpy(nf->abslineinfo, f->abslineinfo, f->sizeabslineinfo * sizeof(AbsLineInfo));
+		}
+		nf->k = luaM::newvectorchecked<TValue>(L, f->sizek);
+		nf->sizek = f->sizek;
+		for (int i = 0; i < f->sizek; i++)
+			setnilvalue(&nf->k[i]);
+		for (int i = 0; i < f->sizek; i++)
+			value(&nf->k[i], &f->k[i]);
+		nf->p = luaM::newvectorchecked<Proto *>(L, f->sizep);
+		nf->sizep = f->sizep;
+		for (int i = 0; i < f->sizep; i++)
+			nf->p[i] = nullptr;
+		for (int i = 0; i < f->sizep; i++)
+			nf->p[i] = gco2p(object(obj2gco(f->p[i])));
+		nf->upvalues = luaM::newvectorchecked<Upvaldesc>(L, f->sizeupvalues);
+		nf->sizeupvalues = f->sizeupvalues;
+		for (int i = 0; i < f->sizeupvalues; i++)
+		{
+			nf->upvalues[i] = f->upvalues[i];
+			nf->upvalues[i].name = nullptr;
+		}
+		for (int i = 0; i < f->sizeupvalues; i++)
+			nf->upvalues[i].name = string(f->upvalues[i].name);
+		nf->locvars = luaM::newvectorchecked<LocVar>(L, f->sizelocvars);
+		nf->sizelocvars = f->sizelocvars;
+		for (int i = 0; i < f->sizelocvars; i++)
+		{
+			nf->locvars[i] = f->locvars[i];
+			nf->locvars[i].varname = nullptr;
+		}
+		for (int i = 0; i < f->sizelocvars; i++)
+			nf->locvars[i].varname = string(f->locvars[i].varname);
+		nf->source = string(f->source);
+	}
+
+	void fill (GCObject *o, GCObject *c)
+	{
+		switch (o->tt)
+		{
+			case LUA_VTABLE:
+				table(gco2t(o), gco2t(c));
+				break;
+			case LUA_VLCL:
+			{
+				LClosure *cl = gco2lcl(o);
+				LClosure *ncl = gco2lcl(c);
+				ncl->p = gco2p(object(obj2gco(cl->p)));
+				for (int i = 0; i < cl->nupvalues; i++)
+				{
+					if (cl->upvals[i] != nullptr)
+						ncl->upvals[i] = gco2upv(object(obj2gco(cl->upvals[i])));
+				}
+				break;
+			}
+			case LUA_VCCL:
+			{
+				CClosure *cl = gco2ccl(o);
+				for (int i = 0; i < cl->nupvalues; i++)
+					value(&gco2ccl(c)->upvalue[i], &cl->upvalue[i]);
+				break;
+			}
+			case LUA_VUSERDATA:
+			{
+				Udata *u = gco2u(o);
+				Udata *nu = gco2u(c);
+				for (int i = 0; i < u->nuvalue; i++)
+					value(&nu->uv[i].uv, &u->uv[i].uv);
+				if (u->metatable != nullptr)
+					metatables.emplace_back(c, gco2t(object(obj2gco(u->metatable))));
+				break;
+			}
+			case LUA_VPROTO:
+				proto(gco2p(o), gco2p(c));
+				break;
+			case LUA_VUPVAL:
+				/* an upvalue still open in the template is copied as closed */
+				value(gco2upv(c)->v.p, gco2upv(o)->v.p);
+				break;
+		}
+	}
+
+	void run ()
+	{
+		global_State *tg = G(from);
+		global_State *g = G(L);
+		size_t n = 0;
+		for (GCObject *o = tg->allgc; o != nullptr; o = o->next)
+			n++;
+		for (GCObject *o = tg->finobj; o != nullptr; o = o->next)
+			n++;
+		copies.reserve(n);
+		copies.find(obj2gco(tg->mainthread)) = {obj2gco(tg->mainthread), obj2gco(g->mainthread)};
+		copies.find(gcvalue(&tg->l_registry)) = {gcvalue(&tg->l_registry), gcvalue(&g->l_registry)};
+		work.emplace_back(gcvalue(&tg->l_registry), gcvalue(&g->l_registry));
+		for (int i = 0; i < LUA_NUMTYPES; i++)
+		{
+			if (tg->mt[i] != nullptr)
+				g->mt[i] = gco2t(object(obj2gco(tg->mt[i])));
+		}
+		while (!work.empty())
+		{
+			auto [o, c] = work.back();
+			work.pop_back();
+			fill(o, c);
+		}
+		TString *name = luaS::newliteral(L, "__clone");
+		for (auto [c, mt] : metatables)
+		{
+			const TValue *tm = luaH_getshortstr(mt, name);
+			if (!notm(tm))
+				luaD::checkstack(L, 2);
+			if (c->tt == LUA_VTABLE)
+				gco2t(c)->metatable = mt;
+			else
+				gco2u(c)->metatable = mt;
+			if (notm(tm))
+				continue;
+			setobj2s(L, L->top.p, tm);
+			setgcovalue(L, s2v(L->top.p + 1), c);
+			L->top.p += 2;
+			luaD::callnoyield(L, L->top.p - 2, 0);
+		}
+	}
+};
+
+
+static void f_clone(lua_State *L, void *ud)
+{
+	UNUSED(L);
+	static_cast<Cloner *>(ud)->run();
+}
+
+
+/* copy error message 's' into the caller's buffer, if any */
+static void cloneerror(char *msg, size_t size, const char *s, size_t l)
+{
+	if (msg == nullptr || size == 0)
+		return;
+	l = (l < size - 1) ? l : size - 1;
+	std::memcpy(msg, s, l);
+	msg[l] = '\0';
+}
+
+
+/*
+** Makes a new state with its own copy of everything in 'from': registry,
+** globals, loaded modules and metatables, so a state set up once can be
+** used as a template for others. 'from' has to be idle, with no calls
+** running, and is only read, so several threads may clone it at once.
+** Returns NULL on failure, with the reason written to 'msg' (at most
+** 'size' bytes, ending in a zero) unless 'msg' is NULL.
+*/
+LUA_API lua_State *lua_clonestate(lua_State *from, char *msg, size_t size)
+{
+	global_State *tg = G(from);
+	lua_State *L = lua_newstate(tg->frealloc, tg->ud);
+	if (L == nullptr)
+	{
+		cloneerror(msg, size, "not enough memory", LL("not enough memory"));
+		return nullptr;
+	}
+	global_State *g = G(L);
+	g->panic = tg->panic;
+	g->warnf = tg->warnf;
+	g->ud_warn = (tg->ud_warn == tg->mainthread) ? L : tg->ud_warn;
+	for (int i = 0; i < LUA_NUMITERATORS; i++)
+		g->iterators[i] = tg->iterators[i];
+	g->gcpause = tg->gcpause;
+	g->gcstepmul = tg->gcstepmul;
+	g->gcstepsize = tg->gcstepsize;
+	g->genmajormul = tg->genmajormul;
+	g->genminormul = tg->genminormul;
+	L->hookmask = tg->mainthread->hookmask;
+	L->basehookcount = tg->mainthread->basehookcount;
+	L->hook = tg->mainthread->hook;
+	L->resethookcount();
+	std::memcpy(
+		lua_getextraspace(L),
+		lua_getextraspace(tg->mainthread),
+		LUA_EXTRASPACE
+	);
+	Cloner cloner {from, L, {}, {}, {}};
+	g->gcstp |= GCSTPUSR; /* no collection while half built */
+	int status = luaD::rawrunprotected(L, f_clone, &cloner);
+	if (status != LUA_OK)
+	{
+		if (status == LUA_ERRMEM)
+			cloneerror(msg, size, "not enough memory", LL("not enough memory"));
+		else if (ttisstring(s2v(L->top.p - 1)))
+		{
+			TString *ts = tsvalue(s2v(L->top.p - 1));
+			cloneerror(msg, size, getstr(ts), tsslen(ts));
+		}
+		else
+			cloneerror(msg, size, "error while cloning state",
+						LL("error while cloning state"));
+		lua_close(L);
+		return nullptr;
+	}
+	g->gcstp &= ~GCSTPUSR;
+	luaE_setdebt(g, 0);
+	if (tg->gckind == KGC_GEN)
+		luaC_changemode(L, KGC_GEN);
+	return L;
+}
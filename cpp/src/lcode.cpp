@@ -351,10 +351,6 @@ void luaK_patchtohere(FuncState *fs, int list)
 }
 
 
-/* limit for difference between lines in relative line info. */
-#define LIMLINEDIFF	0x80
-
-
 /*
 ** Save line info for a new instruction. If difference from last line
 ** does not fit in a byte, of after that many instructions, save a new
@@ -2118,6 +2114,39 @@ static int finaltarget(Instruction *code, int i)
 }
 
 
+/*
+** Replace unconditional jumps to a return by a copy of that return.
+** Jumps that are part of a test must stay, and so must jumps to a
+** return that takes its values up to the stack top, as it depends
+** on the instruction before it.
+*/
+static void threadreturns(FuncState *fs)
+{
+	int i;
+	Instruction *code = fs->f->code;
+	for (i = 0; i < fs->pc; i++)
+	{
+		if (GET_OPCODE(code[i]) == OP_JMP &&
+			(i == 0 || !testTMode(GET_OPCODE(code[i - 1]))))
+		{
+			Instruction ret = code[i + GETARG_sJ(code[i]) + 1];
+			switch (GET_OPCODE(ret))
+			{
+				case OP_RETURN:
+					if (GETARG_B(ret) == 0) /* multiple results? */
+						break;
+					/* FALLTHROUGH */
+				case OP_RETURN0:
+				case OP_RETURN1:
+					code[i] = ret;
+					break;
+				default: break;
+			}
+		}
+	}
+}
+
+
 /*
 ** Do a final pass over the code of a function, doing small peephole
 ** optimizations and adjustments.
@@ -2155,4 +2184,6 @@ void luaK_finish(FuncState *fs)
 			default: break;
 		}
 	}
+	if (fs->ls->optlevel > 0)
+		threadreturns(fs);
 }
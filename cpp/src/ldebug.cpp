@@ -21,6 +21,7 @@
 #include "ldebug.hpp"
 #include "ldo.hpp"
 #include "lfunc.hpp"
+#include "lmem.hpp"
 #include "lobject.hpp"
 #include "lopcodes.hpp"
 #include "lstate.hpp"
@@ -28,6 +29,7 @@
 #include "ltable.hpp"
 #include "ltm.hpp"
 #include "lvm.hpp"
+#include "dump/lundump.hpp"
 
 
 #define LuaClosure(f)		((f) != NULL && (f)->c.tt == LUA_VLCL)
@@ -148,6 +150,20 @@ LUA_API void lua_sethook(lua_State *L, lua_Hook func, int mask, int count)
 }
 
 
+/*
+** Ask the thread running Lua code to take a profiler sample before its
+** next instruction. Like 'lua_sethook', this can be called during a
+** signal (or with the thread running the state suspended). All traps
+** are set, so that a sample taken in a C function is not lost if it
+** returns to a Lua frame other than the innermost one.
+*/
+void luaG_requestsample(global_State *g)
+{
+	g->samplepending = 1;
+	settraps(g->running->ci);
+}
+
+
 LUA_API lua_Hook lua_gethook(lua_State *L)
 {
 	return L->hook;
@@ -186,6 +202,30 @@ LUA_API int lua_getstack(lua_State *L, int level, lua_Debug *ar)
 }
 
 
+static void f_loaddebug(lua_State *L, void *ud)
+{
+	luaU::loaddebug(L, static_cast<Proto *>(ud));
+}
+
+
+/*
+** Load the variable names an image left lazy in 'p'. The debug interface
+** gives no errors for this: if loading fails (e.g. out of memory), 'p'
+** answers as a stripped function would until a later call manages it.
+*/
+void luaG_loaddebug(lua_State *L, Proto *p)
+{
+	ptrdiff_t top = luaD::savestack(L, L->top.p);
+	if (luaD::rawrunprotected(L, f_loaddebug, p) != LUA_OK)
+	{
+		L->top.p = luaD::restorestack(L, top); /* remove any error message */
+		luaM::freearray(L, p->locvars, p->sizelocvars); /* partial names */
+		p->locvars = NULL;
+		p->sizelocvars = 0;
+	}
+}
+
+
 static const char *upvalname(const Proto *p, int uv)
 {
 	TString *s = check_exp(uv < p->sizeupvalues, p->upvalues[uv].name);
@@ -218,7 +258,10 @@ const char *luaG_findlocal(lua_State *L, CallInfo *ci, int n, StkId *pos)
 	{
 		if (n < 0) /* access to vararg values? */
 			return findvararg(ci, n, pos);
-		name = luaF::getlocalname(ci_func(ci)->p, n, currentpc(ci));
+		Proto *p = ci_func(ci)->p;
+		if (p->lazydebug) /* names still in its image? */
+			luaG_loaddebug(L, p);
+		name = luaF::getlocalname(p, n, currentpc(ci));
 	}
 	if (name == nullptr)
 	{
@@ -249,7 +292,12 @@ LUA_API const char *lua_getlocal(lua_State *L, const lua_Debug *ar, int n)
 		if (!isLfunction(s2v(L->top.p - 1))) /* not a Lua function? */
 			name = NULL;
 		else /* consider live variables at function start (parameters) */
-			name = luaF::getlocalname(clLvalue(s2v(L->top.p - 1))->p, n, 0);
+		{
+			Proto *p = clLvalue(s2v(L->top.p - 1))->p;
+			if (p->lazydebug) /* names still in its image? */
+				luaG_loaddebug(L, p);
+			name = luaF::getlocalname(p, n, 0);
+		}
 	}
 	else
 	{
@@ -578,6 +626,14 @@ static const char *basicgetobjname(const Proto *p, int *ppc, int reg,
 				int b = GETARG_B(i); /* move from 'b' to 'a' */
 				if (b < GETARG_A(i))
 					return basicgetobjname(p, ppc, b, name); /* get name for 'b' */
+				/* else maybe an upvalue 'luaK_optimize' loaded before a loop */
+				int upc = findsetreg(p, pc, b);
+				if (upc != -1 && GET_OPCODE(p->code[upc]) == OP_GETUPVAL)
+				{
+					*ppc = upc;
+					*name = upvalname(p, GETARG_B(p->code[upc]));
+					return "upvalue";
+				}
 				break;
 			}
 			case OP_GETUPVAL: {
@@ -769,7 +825,12 @@ static const char *funcnamefromcall(lua_State *L, CallInfo *ci,
 		return "metamethod"; /* report it as such */
 	}
 	if (ci->isLua())
-		return funcnamefromcode(L, ci_func(ci)->p, currentpc(ci), name);
+	{
+		Proto *p = ci_func(ci)->p;
+		if (p->lazydebug) /* names still in its image? */
+			luaG_loaddebug(L, p);
+		return funcnamefromcode(L, p, currentpc(ci), name);
+	}
 	return NULL;
 }
 
@@ -834,13 +895,16 @@ static const char *varinfo(lua_State *L, const TValue *o)
 	const char *kind = nullptr;
 	if (ci->isLua())
 	{
+		Proto *p = ci_func(ci)->p;
+		if (p->lazydebug) /* names still in its image? */
+			luaG_loaddebug(L, p);
 		kind = getupvalname(ci, o, &name); /* check whether 'o' is an upvalue */
 		if (!kind)
 		{
 			/* not an upvalue? */
 			int reg = instack(ci, o); /* try a register */
 			if (reg >= 0) /* is 'o' a register? */
-				kind = getobjname(ci_func(ci)->p, currentpc(ci), reg, &name);
+				kind = getobjname(p, currentpc(ci), reg, &name);
 		}
 	}
 	return formatvarinfo(L, kind, name);
@@ -1059,6 +1123,12 @@ int luaG_traceexec(lua_State *L, const Instruction *pc)
 	lu_byte mask = L->hookmask;
 	const Proto *p = ci_func(ci)->p;
 	int counthook;
+	if (l_unlikely(G(L)->samplepending))
+	{
+		/* profiler asked for a sample */
+		ci->u.l.savedpc = pc + 1; /* as 'currentpc' expects it */
+		luaG_takesample(L);
+	}
 	if (!(mask & (LUA_MASKLINE | LUA_MASKCOUNT)))
 	{
 		/* no hooks? */
@@ -23,6 +23,9 @@
 */
 constexpr auto ABSLINEINFO =	(-0x80);
 
+/* limit for difference between lines in relative line info. */
+constexpr auto LIMLINEDIFF =	0x80;
+
 /*
 ** MAXimum number of successive Instructions WiTHout ABSolute line
 ** information. (A power of two allows fast divisions.)
@@ -31,6 +34,7 @@ constexpr auto MAXIWTHABS = 128;
 
 LUAI_FUNCA luaG_getfuncline (const Proto *f, int pc) -> int;
 LUAI_FUNCA luaG_findlocal (lua_State *L, CallInfo *ci, int n, StkId *pos) -> const char*;
+LUAI_FUNCA luaG_loaddebug (lua_State *L, Proto *p) -> void;
 LUAI_FUNC l_noret luaG_typeerror (lua_State *L, const TValue *o, const char *opname);
 LUAI_FUNC l_noret luaG_callerror (lua_State *L, const TValue *o);
 LUAI_FUNC l_noret luaG_forerror (lua_State *L, const TValue *o, const char *what);
@@ -43,6 +47,11 @@ LUAI_FUNCA luaG_addinfo (lua_State *L, const char *msg, TString *src, int line)
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
 LUAI_FUNCA luaG_traceexec (lua_State *L, const Instruction *pc) -> int;
 LUAI_FUNCA luaG_tracecall (lua_State *L) -> int;
+LUAI_FUNCA luaG_requestsample (global_State *g) -> void;
+
+/* sampling profiler (lprofile.cpp) */
+LUAI_FUNCA luaG_takesample (lua_State *L) -> void;
+LUAI_FUNCA luaG_freeprofiler (lua_State *L) -> void;
 
 
 #endif
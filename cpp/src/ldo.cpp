@@ -24,6 +24,7 @@
 #include "lmem.hpp"
 #include "lobject.hpp"
 #include "lopcodes.hpp"
+#include "lopt.hpp"
 #include "lparser.hpp"
 #include "lstate.hpp"
 #include "lstring.hpp"
@@ -639,6 +640,8 @@ retry:
 		case LUA_VLCL: {
 			/* Lua function */
 			Proto *p = clLvalue(s2v(func))->p;
+			if (l_unlikely(p->lazy)) /* body still in its image? */
+				luaU::loadbody(L, p);
 			int fsize = p->maxstacksize; /* frame size */
 			int nfixparams = p->numparams;
 			int i;
@@ -690,6 +693,8 @@ retry:
 			/* Lua function */
 			CallInfo *ci;
 			Proto *p = clLvalue(s2v(func))->p;
+			if (l_unlikely(p->lazy)) /* body still in its image? */
+				luaU::loadbody(L, p);
 			int narg = cast_int(L->top.p - func) - 1; /* number of real arguments */
 			int nfixparams = p->numparams;
 			int fsize = p->maxstacksize; /* frame size */
@@ -980,9 +985,12 @@ LUA_API int lua_resume(lua_State *L, lua_State *from, int nargs,
 	L->nCcalls++;
 	luai_userstateresume(L, nargs);
 	api_checknelems(L, (L->status == LUA_OK) ? nargs + 1 : nargs);
-	status = luaD::rawrunprotected(L, resume, &nargs);
-	/* continue running after recoverable errors */
-	status = precover(L, status);
+	{
+		RunningThread running(L);
+		status = luaD::rawrunprotected(L, resume, &nargs);
+		/* continue running after recoverable errors */
+		status = precover(L, status);
+	}
 	if (l_likely(!errorstatus(status)))
 		lua_assert(status == L->status); /* normal end or yield */
 	else
@@ -1141,6 +1149,24 @@ static void checkmode(lua_State *L, const char *mode, const char *x)
 }
 
 
+/*
+** The optimization level for the parser is given by a digit in the
+** load mode (e.g., "t1" or "bt2"); without one, there is no
+** optimization. Levels up to 2 are the parser's own; level 3 also runs
+** the bytecode optimizer over the result.
+*/
+static int optlevel(const char *mode)
+{
+	if (mode)
+	{
+		for (; *mode; mode++)
+			if ('0' <= *mode && *mode <= '9')
+				return *mode - '0';
+	}
+	return 0;
+}
+
+
 static void f_parser(lua_State *L, void *ud)
 {
 	LClosure *cl;
@@ -1154,7 +1180,10 @@ static void f_parser(lua_State *L, void *ud)
 	else
 	{
 		checkmode(L, p->mode, "text");
-		cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+		int level = optlevel(p->mode);
+		cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c, level);
+		if (level >= 3)
+			luaK_optimize(L, cl->p);
 	}
 	lua_assert(cl->nupvalues == cl->p->sizeupvalues);
 	luaF::initupvals(L, cl);
@@ -1176,6 +1205,8 @@ int luaD::protectedparser(lua_State *L, ZIO *z, const char *name,
 	p.dyd.gt.size = 0;
 	p.dyd.label.arr = NULL;
 	p.dyd.label.size = 0;
+	p.dyd.assigned.arr = NULL;
+	p.dyd.assigned.size = 0;
 	p.buff.initbuffer(L);
 	// luaZ_initbuffer(L, &p.buff);
 	status = luaD::pcall(L, f_parser, &p, luaD::savestack(L, L->top.p), L->errfunc);
@@ -1184,6 +1215,44 @@ int luaD::protectedparser(lua_State *L, ZIO *z, const char *name,
 	luaM::freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
 	luaM::freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
 	luaM::freearray(L, p.dyd.label.arr, p.dyd.label.size);
+	luaM::freearray(L, p.dyd.assigned.arr, p.dyd.assigned.size);
+	L->decnny();
+	return status;
+}
+
+
+struct SImage
+{
+	/* data to 'f_image' */
+	ChunkImage *im;
+	const char *mode;
+	const char *name;
+};
+
+
+static void f_image(lua_State *L, void *ud)
+{
+	struct SImage *p = cast(struct SImage *, ud);
+	checkmode(L, p->mode, "binary");
+	LClosure *cl = luaU::undumpimage(L, p->im, p->name);
+	lua_assert(cl->nupvalues == cl->p->sizeupvalues);
+	luaF::initupvals(L, cl);
+}
+
+
+/*
+** Load a precompiled chunk held in memory, in protected mode.
+*/
+int luaD::protectedimage(lua_State *L, ChunkImage *im, const char *name,
+								const char *mode)
+{
+	struct SImage p;
+	int status;
+	L->incnny(); /* cannot yield during loading */
+	p.im = im;
+	p.name = name;
+	p.mode = mode;
+	status = luaD::pcall(L, f_image, &p, luaD::savestack(L, L->top.p), L->errfunc);
 	L->decnny();
 	return status;
 }
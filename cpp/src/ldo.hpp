@@ -39,6 +39,12 @@ LUAI_FUNCA protectedparser (
 	const char *name,
 	const char *mode
 ) -> int;
+LUAI_FUNCA protectedimage (
+	lua_State *L,
+	struct ChunkImage *im,
+	const char *name,
+	const char *mode
+) -> int;
 
 LUAI_FUNCA hook (
 	lua_State *L,
@@ -21,6 +21,7 @@
 #include "lmem.hpp"
 #include "lobject.hpp"
 #include "lstate.hpp"
+#include "dump/lundump.hpp"
 
 
 CClosure *luaF::newCclosure(lua_State *L, int nupvals)
@@ -288,17 +289,25 @@ Proto *luaF::newproto(lua_State *L)
 	f->linedefined = 0;
 	f->lastlinedefined = 0;
 	f->source = NULL;
+	f->image = NULL;
+	f->lazy = 0;
+	f->lazydebug = 0;
 	return f;
 }
 
 
 void luaF::freeproto(lua_State *L, Proto *f)
 {
-	luaM::freearray(L, f->code, f->sizecode);
+	if (f->image == NULL)
+	{
+		luaM::freearray(L, f->code, f->sizecode);
+		luaM::freearray(L, f->lineinfo, f->sizelineinfo);
+		luaM::freearray(L, f->abslineinfo, f->sizeabslineinfo);
+	}
+	else /* those are in the image */
+		luaU::releaseimage(f->image);
 	luaM::freearray(L, f->p, f->sizep);
 	luaM::freearray(L, f->k, f->sizek);
-	luaM::freearray(L, f->lineinfo, f->sizelineinfo);
-	luaM::freearray(L, f->abslineinfo, f->sizeabslineinfo);
 	luaM::freearray(L, f->locvars, f->sizelocvars);
 	luaM::freearray(L, f->upvalues, f->sizeupvalues);
 	luaM::free(L, f);
@@ -0,0 +1,521 @@
+#ifndef COYOTE_ARRAY_LIB
+#define COYOTE_ARRAY_LIB
+
+#include <cstring>
+#include <cstdint>
+
+#include "llimits.hpp"
+#include "../lua.hpp"
+#include "../lauxlib.hpp"
+#include "../lualib.hpp"
+
+/*
+** typed arrays: a userdata over a run of f32, f64 or i32 elements that
+** scripts index like a table. the elements either live in the userdata
+** itself or in memory the host owns (see coyote_pusharray), so large
+** numeric data can go back and forth without a table in the middle
+*/
+namespace CoyoteArray {
+
+using Byte = lu_byte;
+
+enum class ElementType : int
+{
+	Float32 = COYOTE_ARRAY_F32,
+	Float64 = COYOTE_ARRAY_F64,
+	Int32 = COYOTE_ARRAY_I32,
+};
+
+static constexpr const char* typenames[] = {"f32", "f64", "i32", nullptr};
+
+
+struct Array
+{
+	void* data;
+	size_t count;
+	ElementType type;
+	// elements of arrays Lua owns; 'data' points here for those
+	alignas(double) Byte own[];
+
+	static auto elementsize (ElementType type) -> size_t
+	{
+		switch (type)
+		{
+			case ElementType::Float32: return sizeof(float);
+			case ElementType::Float64: return sizeof(double);
+			case ElementType::Int32: return sizeof(int32_t);
+		}
+		return 0;
+	}
+
+	static auto createsize (ElementType type, size_t count) -> size_t
+	{
+		return sizeof(Array) + (count * elementsize(type));
+	}
+
+	void push (lua_State* L, size_t i) const
+	{
+		switch (type)
+		{
+			case ElementType::Float32: {
+				lua_pushnumber(L, static_cast<float*>(data)[i]);
+				break;
+			}
+			case ElementType::Float64: {
+				lua_pushnumber(L, static_cast<double*>(data)[i]);
+				break;
+			}
+			case ElementType::Int32: {
+				lua_pushinteger(L, static_cast<int32_t*>(data)[i]);
+				break;
+			}
+		}
+	}
+
+	/*
+	** sets element 'i' to the value at 'idx', which has to fit the type
+	*/
+	void store (lua_State* L, size_t i, int idx)
+	{
+		int isnum;
+		switch (type)
+		{
+			case ElementType::Float32: {
+				lua_Number v = lua_tonumberx(L, idx, &isnum);
+				if (!isnum)
+				{
+					luaL_error(L, "cannot store a %s in an f32 array", luaL_typename(L, idx));
+				}
+				static_cast<float*>(data)[i] = static_cast<float>(v);
+				break;
+			}
+			case ElementType::Float64: {
+				lua_Number v = lua_tonumberx(L, idx, &isnum);
+				if (!isnum)
+				{
+					luaL_error(L, "cannot store a %s in an f64 array", luaL_typename(L, idx));
+				}
+				static_cast<double*>(data)[i] = static_cast<double>(v);
+				break;
+			}
+			case ElementType::Int32: {
+				lua_Integer v = lua_tointegerx(L, idx, &isnum);
+				if (!isnum)
+				{
+					luaL_error(L, "cannot store a %s in an i32 array",
+						lua_type(L, idx) == LUA_TNUMBER ? "non-integer number" : luaL_typename(L, idx));
+				}
+				if (v < INT32_MIN || v > INT32_MAX)
+				{
+					luaL_error(L, "value %I out of range for an i32 array", v);
+				}
+				static_cast<int32_t*>(data)[i] = static_cast<int32_t>(v);
+				break;
+			}
+		}
+	}
+};
+
+
+#define COYOTE_ARRAY_REG "COYOTE_ARRAY*"
+
+static auto l_check_array (lua_State* L, int idx) -> Array*
+{
+	return static_cast<Array*>(luaL_checkudata(L, idx, COYOTE_ARRAY_REG));
+}
+
+static auto l_test_array (lua_State* L, int idx) -> Array*
+{
+	return static_cast<Array*>(luaL_testudata(L, idx, COYOTE_ARRAY_REG));
+}
+
+/*
+** index of element 'arg' (1-based in Lua), erroring if it's outside the array
+*/
+static auto l_check_index (lua_State* L, const Array* a, int arg) -> size_t
+{
+	lua_Integer i = luaL_checkinteger(L, arg);
+	luaL_argcheck(L, i >= 1 && static_cast<lua_Unsigned>(i) <= a->count, arg, "index out of range");
+	return static_cast<size_t>(i - 1);
+}
+
+
+static int m_index (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	if (lua_type(L, 2) == LUA_TNUMBER)
+	{
+		// a float with an integral value is that index, as for '__newindex'
+		int isint;
+		lua_Integer i = lua_tointegerx(L, 2, &isint);
+		if (isint && i >= 1 && static_cast<lua_Unsigned>(i) <= a->count)
+		{
+			a->push(L, static_cast<size_t>(i - 1));
+		}
+		else
+		{
+			lua_pushnil(L);
+		}
+		return 1;
+	}
+	// anything else is a method name
+	lua_pushvalue(L, 2);
+	lua_rawget(L, lua_upvalueindex(1));
+	return 1;
+}
+
+static int m_newindex (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	a->store(L, l_check_index(L, a, 2), 3);
+	return 0;
+}
+
+static int m_len (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	lua_pushinteger(L, static_cast<lua_Integer>(a->count));
+	return 1;
+}
+
+static int m_tostring (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	lua_pushfstring(L, "array<%s>[%I]: %p",
+		typenames[static_cast<int>(a->type)], static_cast<lua_Integer>(a->count), a->data);
+	return 1;
+}
+
+/*
+** a cloned state's copy of an array Lua owns points back into the
+** template's; views keep pointing at the host memory
+*/
+static int m_clone (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	if (lua_rawlen(L, 1) > sizeof(Array))
+	{
+		a->data = a->own;
+	}
+	return 0;
+}
+
+static int m_type (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	lua_pushstring(L, typenames[static_cast<int>(a->type)]);
+	return 1;
+}
+
+
+template<typename T, typename Acc>
+static auto l_sum (const Array* a) -> Acc
+{
+	auto p = static_cast<const T*>(a->data);
+	Acc s = 0;
+	for (size_t i = 0; i < a->count; i++)
+	{
+		s += p[i];
+	}
+	return s;
+}
+
+static int m_sum (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	switch (a->type)
+	{
+		case ElementType::Float32: {
+			lua_pushnumber(L, l_sum<float, double>(a));
+			break;
+		}
+		case ElementType::Float64: {
+			lua_pushnumber(L, l_sum<double, double>(a));
+			break;
+		}
+		case ElementType::Int32: {
+			lua_pushinteger(L, l_sum<int32_t, lua_Integer>(a));
+			break;
+		}
+	}
+	return 1;
+}
+
+/*
+** index of the smallest (or largest) element; NaNs are skipped unless
+** there is nothing else
+*/
+template<typename T, bool Max>
+static auto l_extreme (const Array* a) -> size_t
+{
+	auto p = static_cast<const T*>(a->data);
+	size_t best = 0;
+	for (size_t i = 1; i < a->count; i++)
+	{
+		if (Max ? (p[i] > p[best] || p[best] != p[best]) : (p[i] < p[best] || p[best] != p[best]))
+		{
+			best = i;
+		}
+	}
+	return best;
+}
+
+template<bool Max>
+static int m_extreme (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	if (a->count == 0)
+	{
+		return 0;
+	}
+	size_t i = 0;
+	switch (a->type)
+	{
+		case ElementType::Float32: i = l_extreme<float, Max>(a); break;
+		case ElementType::Float64: i = l_extreme<double, Max>(a); break;
+		case ElementType::Int32: i = l_extreme<int32_t, Max>(a); break;
+	}
+	a->push(L, i);
+	lua_pushinteger(L, static_cast<lua_Integer>(i + 1));
+	return 2;
+}
+
+/*
+** a:map(f) sets every element to f(value, index), in place
+*/
+static int m_map (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	for (size_t i = 0; i < a->count; i++)
+	{
+		lua_pushvalue(L, 2);
+		a->push(L, i);
+		lua_pushinteger(L, static_cast<lua_Integer>(i + 1));
+		lua_call(L, 2, 1);
+		if (i >= a->count)
+		{
+			// detached by the host while 'f' ran
+			break;
+		}
+		a->store(L, i, -1);
+		lua_pop(L, 1);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+/*
+** a:totable([t]) copies the elements into t (or a new table) from 1
+*/
+static int m_totable (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	if (lua_isnoneornil(L, 2))
+	{
+		lua_createtable(L, a->count > INT32_MAX ? 0 : static_cast<int>(a->count), 0);
+	}
+	else
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		lua_settop(L, 2);
+	}
+	for (size_t i = 0; i < a->count; i++)
+	{
+		a->push(L, i);
+		lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+	}
+	return 1;
+}
+
+/*
+** a:fromtable(t [, first]) copies t[1..#t] into the array starting at
+** element 'first' (1 by default)
+*/
+static int m_fromtable (lua_State* L)
+{
+	auto a = l_check_array(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_Integer first = luaL_optinteger(L, 3, 1);
+	lua_Unsigned n = lua_rawlen(L, 2);
+	luaL_argcheck(L, first >= 1 && static_cast<lua_Unsigned>(first - 1) <= a->count
+		&& n <= a->count - static_cast<size_t>(first - 1), 2, "table does not fit in the array");
+	for (lua_Unsigned i = 0; i < n; i++)
+	{
+		lua_rawgeti(L, 2, static_cast<lua_Integer>(i + 1));
+		a->store(L, static_cast<size_t>(first - 1) + i, -1);
+		lua_pop(L, 1);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+static constexpr luaL_Reg methods[] = {
+	{"type", m_type},
+	{"sum", m_sum},
+	{"min", m_extreme<false>},
+	{"max", m_extreme<true>},
+	{"map", m_map},
+	{"totable", m_totable},
+	{"fromtable", m_fromtable},
+	luaL_Reg::end(),
+};
+
+static constexpr luaL_Reg metamethods[] = {
+	{"__newindex", m_newindex},
+	{"__len", m_len},
+	{"__tostring", m_tostring},
+	{"__clone", m_clone},
+	luaL_Reg::end(),
+};
+
+/*
+** pushes the array metatable, making it on first use so the host can push
+** arrays whether or not the library was opened
+*/
+static void l_push_meta (lua_State* L)
+{
+	if (luaL_newmetatable(L, COYOTE_ARRAY_REG))
+	{
+		luaL_setfuncs(L, metamethods, 0);
+		luaL_newlib(L, methods);
+		lua_pushcclosure(L, m_index, 1);
+		lua_setfield(L, -2, "__index");
+	}
+}
+
+static auto l_create_array (lua_State* L, ElementType type, size_t count, void* data) -> Array*
+{
+	size_t size = Array::createsize(type, data == nullptr ? count : 0);
+	auto a = static_cast<Array*>(lua_newuserdatauv(L, size, 0));
+	a->count = count;
+	a->type = type;
+	a->data = data;
+	if (data == nullptr)
+	{
+		a->data = a->own;
+		std::memset(a->own, 0, count * Array::elementsize(type));
+	}
+	l_push_meta(L);
+	lua_setmetatable(L, -2);
+	return a;
+}
+
+static auto l_check_count (lua_State* L, lua_Integer count, ElementType type, int arg) -> size_t
+{
+	luaL_argcheck(L, count >= 0
+		&& static_cast<lua_Unsigned>(count) <= (MAX_SIZET - sizeof(Array)) / Array::elementsize(type),
+		arg, "invalid array size");
+	return static_cast<size_t>(count);
+}
+
+/*
+** array.new(type, n): n zeroed elements of 'type' ("f32", "f64" or "i32")
+*/
+static int f_new (lua_State* L)
+{
+	auto type = static_cast<ElementType>(luaL_checkoption(L, 1, nullptr, typenames));
+	l_create_array(L, type, l_check_count(L, luaL_checkinteger(L, 2), type, 2), nullptr);
+	return 1;
+}
+
+/*
+** array.fromtable(type, t): a new array holding t[1..#t]
+*/
+static int f_fromtable (lua_State* L)
+{
+	auto type = static_cast<ElementType>(luaL_checkoption(L, 1, nullptr, typenames));
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_Unsigned n = lua_rawlen(L, 2);
+	auto a = l_create_array(L, type, l_check_count(L, static_cast<lua_Integer>(n), type, 2), nullptr);
+	for (lua_Unsigned i = 0; i < n; i++)
+	{
+		lua_rawgeti(L, 2, static_cast<lua_Integer>(i + 1));
+		a->store(L, i, -1);
+		lua_pop(L, 1);
+	}
+	return 1;
+}
+
+
+}
+
+
+/*
+** pushes an array over 'count' elements of 'type' at 'data', which the
+** host keeps alive (and doesn't move) for as long as scripts can reach
+** it, or until coyote_detacharray. with 'data' NULL the array owns zeroed
+** memory of its own instead. returns the elements
+*/
+LUALIB_API void* coyote_pusharray (lua_State* L, void* data, size_t count, int type)
+{
+	if (type < COYOTE_ARRAY_F32 || type > COYOTE_ARRAY_I32)
+	{
+		luaL_error(L, "invalid array type %d", type);
+	}
+	auto t = static_cast<CoyoteArray::ElementType>(type);
+	return CoyoteArray::l_create_array(L, t, count, data)->data;
+}
+
+/*
+** the elements of the array at 'idx', or NULL if it isn't one
+*/
+LUALIB_API void* coyote_toarray (lua_State* L, int idx, size_t* out_count, int* out_type)
+{
+	auto a = CoyoteArray::l_test_array(L, idx);
+	if (a == nullptr)
+	{
+		return nullptr;
+	}
+	if (out_count != nullptr)
+	{
+		*out_count = a->count;
+	}
+	if (out_type != nullptr)
+	{
+		*out_type = static_cast<int>(a->type);
+	}
+	return a->data;
+}
+
+/*
+** whether the array at 'idx' is over host memory rather than its own
+*/
+LUALIB_API int coyote_isarrayview (lua_State* L, int idx)
+{
+	auto a = CoyoteArray::l_test_array(L, idx);
+	return a != nullptr && a->data != a->own;
+}
+
+/*
+** cuts the array at 'idx' off from host memory about to go away; scripts
+** still holding it see an empty array
+*/
+LUALIB_API void coyote_detacharray (lua_State* L, int idx)
+{
+	auto a = CoyoteArray::l_test_array(L, idx);
+	if (a != nullptr && a->data != a->own)
+	{
+		a->data = nullptr;
+		a->count = 0;
+	}
+}
+
+
+static constexpr luaL_Reg arrayfuncs[] = {
+	{"new", CoyoteArray::f_new},
+	{"fromtable", CoyoteArray::f_fromtable},
+	luaL_Reg::end(),
+};
+
+LUALIB_API int createarraylib (lua_State* L)
+{
+	CoyoteArray::l_push_meta(L);
+	lua_pop(L, 1);
+	luaL_newlib(L, arrayfuncs);
+	return 1;
+}
+
+
+#endif
@@ -8,6 +8,7 @@
 #include "llimits.hpp"
 #include "../lua.hpp"
 #include "../lauxlib.hpp"
+#include "../lualib.hpp"
 
 namespace CoyoteBuffer {
 
@@ -64,6 +65,9 @@ static int f_create (lua_State* L)
 	}
 
 	auto f = l_create_buffer(L, count);
+	f->size = count;
+	f->cursor = 0;
+	f->order = std::endian::native;
 	f->fill(0);
 
 	luaL_setmetatable(L, COYOTE_BUFFER_REG);
@@ -71,7 +75,32 @@ static int f_create (lua_State* L)
 	return 1;
 }
 
+static auto l_test_buffer (lua_State* L, int idx) -> Buffer*
+{
+	return static_cast<Buffer*>(luaL_testudata(L, idx, COYOTE_BUFFER_REG));
+}
+
+
+}
 
+
+/*
+** lets the host write straight into a buffer's bytes (decoding an image
+** into it, for instance) instead of filling a copy and pushing it over.
+** returns NULL if the value at 'idx' isn't a buffer
+*/
+LUALIB_API void* coyote_tobuffer (lua_State* L, int idx, size_t* out_size)
+{
+	auto b = CoyoteBuffer::l_test_buffer(L, idx);
+	if (b == nullptr)
+	{
+		return nullptr;
+	}
+	if (out_size != nullptr)
+	{
+		*out_size = b->size;
+	}
+	return b->data;
 }
 
 
@@ -79,6 +108,26 @@ static int f_create (lua_State* L)
 
 
 
+/*
+** pushes a new zeroed buffer of 'size' bytes and returns its bytes, for C
+** code that makes buffers without going through buffer.create
+*/
+LUALIB_API void* coyote_newbuffer (lua_State* L, size_t size)
+{
+	auto f = CoyoteBuffer::l_create_buffer(L, size);
+	f->size = size;
+	f->cursor = 0;
+	f->order = std::endian::native;
+	f->fill(0);
+
+	// the metatable may not exist yet if the library was never opened
+	luaL_newmetatable(L, COYOTE_BUFFER_REG);
+	lua_setmetatable(L, -2);
+
+	return f->data;
+}
+
+
 static constexpr luaL_Reg funcs[] = {
 	{"create", CoyoteBuffer::f_create},
 	luaL_Reg::end(),
@@ -86,6 +135,9 @@ static constexpr luaL_Reg funcs[] = {
 
 LUALIB_API int createbufferlib (lua_State* L)
 {
+	// buffers are told apart from other userdata by this metatable
+	luaL_newmetatable(L, COYOTE_BUFFER_REG);
+	lua_pop(L, 1);
 	luaL_newlib(L, funcs);
 	return 1;
 }
@@ -0,0 +1,832 @@
+#ifndef COYOTE_FROZEN_LIB
+#define COYOTE_FROZEN_LIB
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../lua.hpp"
+#include "../lauxlib.hpp"
+#include "../lualib.hpp"
+
+/*
+** frozen tables: a table graph copied once into an immutable image outside
+** of any Lua heap, which every state in the process can then read through
+** proxies at no GC cost. the image only holds offsets from its start, so
+** it can be moved or mapped anywhere as a whole
+*/
+namespace CoyoteFrozen {
+
+enum class Tag : uint8_t
+{
+	Empty,  // unused hash slot
+	Nil,
+	False,
+	True,
+	Integer,
+	Number,
+	String,  // payload = offset of the bytes, len = their count
+	Table,   // payload = offset of its FrozenTable
+};
+
+struct Value
+{
+	Tag tag;
+	uint8_t pad[3];
+	uint32_t len;
+	int64_t payload;
+};
+
+struct Slot
+{
+	Value key;
+	Value value;
+};
+
+struct Table
+{
+	uint32_t narray;
+	uint32_t nhash;  // slots in the hash part, 0 or a power of 2
+	uint64_t array;  // offset of 'narray' Values, for keys 1..narray
+	uint64_t hash;   // offset of 'nhash' Slots
+};
+
+struct Header
+{
+	uint64_t magic;
+	uint64_t root;
+	uint64_t size;
+};
+
+static constexpr uint64_t MAGIC = 0x4E455A4F52465943;  // "CYFROZEN"
+
+struct Image
+{
+	std::atomic<int> refs;
+	alignas(16) char data[];
+
+	auto header () const -> const Header*
+	{
+		return reinterpret_cast<const Header*>(data);
+	}
+
+	auto table (uint64_t at) const -> const Table*
+	{
+		return reinterpret_cast<const Table*>(data + at);
+	}
+
+	auto values (uint64_t at) const -> const Value*
+	{
+		return reinterpret_cast<const Value*>(data + at);
+	}
+
+	auto slots (uint64_t at) const -> const Slot*
+	{
+		return reinterpret_cast<const Slot*>(data + at);
+	}
+};
+
+static void retain (Image* im)
+{
+	im->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void release (Image* im)
+{
+	if (im->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		im->~Image();
+		::operator delete(im);
+	}
+}
+
+
+static auto mix (uint64_t x) -> uint64_t
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EB;
+	x ^= x >> 31;
+	return x;
+}
+
+static auto hashbytes (const char* s, size_t n) -> uint64_t
+{
+	uint64_t h = 0xCBF29CE484222325;
+	for (size_t i = 0; i < n; i++)
+	{
+		h = (h ^ static_cast<uint8_t>(s[i])) * 0x100000001B3;
+	}
+	return h;
+}
+
+/*
+** 'v' as an integer key if it's a float with an exact integer value, the
+** way Lua itself treats such keys
+*/
+static auto floatkey (lua_Number v, lua_Integer* out) -> bool
+{
+	if (v >= -9223372036854775808.0 && v < 9223372036854775808.0)
+	{
+		auto i = static_cast<lua_Integer>(v);
+		if (static_cast<lua_Number>(i) == v)
+		{
+			*out = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static auto keyhash (const Value& k, const char* strings) -> uint64_t
+{
+	switch (k.tag)
+	{
+		case Tag::String: return hashbytes(strings + k.payload, k.len);
+		case Tag::Integer:
+		case Tag::Number:
+		case Tag::Table: return mix(static_cast<uint64_t>(k.payload) ^ static_cast<uint64_t>(k.tag));
+		default: return mix(static_cast<uint64_t>(k.tag));
+	}
+}
+
+
+#define COYOTE_FROZEN_REG "COYOTE_FROZEN*"
+#define COYOTE_FROZEN_CACHE "COYOTE_FROZEN_CACHE"
+
+struct Proxy
+{
+	Image* image;
+	uint64_t table;
+};
+
+static auto checkproxy (lua_State* L, int idx) -> Proxy*
+{
+	return static_cast<Proxy*>(luaL_checkudata(L, idx, COYOTE_FROZEN_REG));
+}
+
+
+/*
+** copies a table graph into an image. tables are laid out as they are
+** found, breadth first, with a worklist kept on the stack; strings are
+** stored once however often they appear
+*/
+struct Builder
+{
+	lua_State* L;
+	std::vector<char> out;
+	std::unordered_map<const void*, uint64_t> tables;
+	std::unordered_map<std::string, uint64_t> strings;
+	std::vector<uint64_t> order;
+	int pending = 0;
+
+	auto alloc (size_t n) -> uint64_t
+	{
+		size_t at = (out.size() + 7) & ~size_t(7);
+		out.resize(at + n, 0);
+		return at;
+	}
+
+	void write (uint64_t at, const void* p, size_t n)
+	{
+		std::memcpy(out.data() + at, p, n);
+	}
+
+	/*
+	** offset of the record for the table at 'idx', queueing it if new
+	*/
+	auto table (int idx) -> uint64_t
+	{
+		auto p = lua_topointer(L, idx);
+		auto found = tables.find(p);
+		if (found != tables.end())
+		{
+			return found->second;
+		}
+		auto at = alloc(sizeof(Table));
+		tables.emplace(p, at);
+		order.push_back(at);
+		lua_pushvalue(L, idx);
+		lua_rawseti(L, pending, static_cast<lua_Integer>(order.size()));
+		return at;
+	}
+
+	auto value (int idx) -> Value
+	{
+		Value v {};
+		switch (lua_type(L, idx))
+		{
+			case LUA_TNIL: {
+				v.tag = Tag::Nil;
+				break;
+			}
+			case LUA_TBOOLEAN: {
+				v.tag = lua_toboolean(L, idx) ? Tag::True : Tag::False;
+				break;
+			}
+			case LUA_TNUMBER: {
+				if (lua_isinteger(L, idx))
+				{
+					v.tag = Tag::Integer;
+					v.payload = lua_tointeger(L, idx);
+				}
+				else
+				{
+					lua_Number n = lua_tonumber(L, idx);
+					v.tag = Tag::Number;
+					std::memcpy(&v.payload, &n, sizeof(n));
+				}
+				break;
+			}
+			case LUA_TSTRING: {
+				size_t len;
+				const char* s = lua_tolstring(L, idx, &len);
+				if (len > UINT32_MAX)
+				{
+					luaL_error(L, "string too long to freeze");
+				}
+				auto [it, fresh] = strings.try_emplace(std::string(s, len), 0);
+				if (fresh)
+				{
+					it->second = alloc(len + 1);
+					write(it->second, s, len);
+				}
+				v.tag = Tag::String;
+				v.len = static_cast<uint32_t>(len);
+				v.payload = static_cast<int64_t>(it->second);
+				break;
+			}
+			case LUA_TTABLE: {
+				v.tag = Tag::Table;
+				v.payload = static_cast<int64_t>(table(idx));
+				break;
+			}
+			default: {
+				luaL_error(L, "cannot freeze a %s", luaL_typename(L, idx));
+				break;
+			}
+		}
+		return v;
+	}
+
+	void insert (uint64_t hash, uint32_t nhash, const Value& k, const Value& v)
+	{
+		auto h = keyhash(k, out.data());
+		for (uint32_t i = 0; ; i++)
+		{
+			auto at = hash + ((h + i) & (nhash - 1)) * sizeof(Slot);
+			Slot s;
+			std::memcpy(&s, out.data() + at, sizeof(s));
+			if (s.key.tag == Tag::Empty)
+			{
+				s.key = k;
+				s.value = v;
+				write(at, &s, sizeof(s));
+				return;
+			}
+		}
+	}
+
+	/*
+	** lays out the table at 'idx' into the record at 'rec'
+	*/
+	void fill (int idx, uint64_t rec)
+	{
+		luaL_checkstack(L, 4, "cannot freeze table");
+		auto narray = lua_rawlen(L, idx);
+		if (narray > UINT32_MAX)
+		{
+			luaL_error(L, "table too large to freeze");
+		}
+		Table t {};
+		t.narray = static_cast<uint32_t>(narray);
+		t.array = alloc(narray * sizeof(Value));
+		for (lua_Unsigned i = 0; i < narray; i++)
+		{
+			lua_rawgeti(L, idx, static_cast<lua_Integer>(i + 1));
+			auto v = value(-1);
+			write(t.array + i * sizeof(Value), &v, sizeof(v));
+			lua_pop(L, 1);
+		}
+		auto inarray = [&] {
+			if (!lua_isinteger(L, -2))
+			{
+				return false;
+			}
+			auto k = static_cast<lua_Unsigned>(lua_tointeger(L, -2));
+			return k - 1 < narray;
+		};
+		uint64_t count = 0;
+		lua_pushnil(L);
+		while (lua_next(L, idx))
+		{
+			count += !inarray();
+			lua_pop(L, 1);
+		}
+		uint64_t nhash = 0;
+		if (count > 0)
+		{
+			nhash = 1;
+			while (nhash < count * 2)
+			{
+				nhash <<= 1;
+			}
+		}
+		if (nhash > UINT32_MAX)
+		{
+			luaL_error(L, "table too large to freeze");
+		}
+		t.nhash = static_cast<uint32_t>(nhash);
+		t.hash = alloc(nhash * sizeof(Slot));
+		lua_pushnil(L);
+		while (lua_next(L, idx))
+		{
+			if (!inarray())
+			{
+				auto k = value(-2);
+				auto v = value(-1);
+				insert(t.hash, t.nhash, k, v);
+			}
+			lua_pop(L, 1);
+		}
+		write(rec, &t, sizeof(t));
+	}
+
+	auto build (int idx) -> Image*
+	{
+		idx = lua_absindex(L, idx);
+		lua_newtable(L);
+		pending = lua_gettop(L);
+		alloc(sizeof(Header));
+		auto root = table(idx);
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			lua_rawgeti(L, pending, static_cast<lua_Integer>(i + 1));
+			fill(lua_gettop(L), order[i]);
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+		Header h {MAGIC, root, out.size()};
+		write(0, &h, sizeof(h));
+		auto im = static_cast<Image*>(::operator new(sizeof(Image) + out.size()));
+		new (im) Image();
+		im->refs.store(1, std::memory_order_relaxed);
+		std::memcpy(im->data, out.data(), out.size());
+		return im;
+	}
+};
+
+
+static void pushproxy (lua_State* L, Image* im, uint64_t table);
+
+static void pushvalue (lua_State* L, Image* im, const Value& v)
+{
+	switch (v.tag)
+	{
+		case Tag::Empty:
+		case Tag::Nil: {
+			lua_pushnil(L);
+			break;
+		}
+		case Tag::False:
+		case Tag::True: {
+			lua_pushboolean(L, v.tag == Tag::True);
+			break;
+		}
+		case Tag::Integer: {
+			lua_pushinteger(L, v.payload);
+			break;
+		}
+		case Tag::Number: {
+			lua_Number n;
+			std::memcpy(&n, &v.payload, sizeof(n));
+			lua_pushnumber(L, n);
+			break;
+		}
+		case Tag::String: {
+			lua_pushlstring(L, im->data + v.payload, v.len);
+			break;
+		}
+		case Tag::Table: {
+			pushproxy(L, im, static_cast<uint64_t>(v.payload));
+			break;
+		}
+	}
+}
+
+/*
+** the value under the key at 'idx', or null if there is none
+*/
+static auto lookup (lua_State* L, const Image* im, const Table* t, int idx) -> const Value*
+{
+	Value k {};
+	uint64_t h = 0;
+	const char* s = nullptr;
+	switch (lua_type(L, idx))
+	{
+		case LUA_TNUMBER: {
+			lua_Integer i;
+			if (lua_isinteger(L, idx))
+			{
+				i = lua_tointeger(L, idx);
+			}
+			else if (!floatkey(lua_tonumber(L, idx), &i))
+			{
+				lua_Number n = lua_tonumber(L, idx);
+				k.tag = Tag::Number;
+				std::memcpy(&k.payload, &n, sizeof(n));
+				h = keyhash(k, im->data);
+				break;
+			}
+			if (static_cast<lua_Unsigned>(i) - 1 < t->narray)
+			{
+				return &im->values(t->array)[i - 1];
+			}
+			k.tag = Tag::Integer;
+			k.payload = i;
+			h = keyhash(k, im->data);
+			break;
+		}
+		case LUA_TSTRING: {
+			size_t len;
+			s = lua_tolstring(L, idx, &len);
+			k.tag = Tag::String;
+			k.len = static_cast<uint32_t>(len);
+			if (len > UINT32_MAX)
+			{
+				return nullptr;
+			}
+			h = hashbytes(s, len);
+			break;
+		}
+		case LUA_TBOOLEAN: {
+			k.tag = lua_toboolean(L, idx) ? Tag::True : Tag::False;
+			h = keyhash(k, im->data);
+			break;
+		}
+		case LUA_TUSERDATA: {
+			// a table key comes back as a proxy, and only one into the same
+			// image can name it
+			auto p = static_cast<Proxy*>(luaL_testudata(L, idx, COYOTE_FROZEN_REG));
+			if (p == nullptr || p->image != im)
+			{
+				return nullptr;
+			}
+			k.tag = Tag::Table;
+			k.payload = static_cast<int64_t>(p->table);
+			h = keyhash(k, im->data);
+			break;
+		}
+		default: {
+			return nullptr;
+		}
+	}
+	if (t->nhash == 0)
+	{
+		return nullptr;
+	}
+	auto slots = im->slots(t->hash);
+	for (uint32_t i = 0; i < t->nhash; i++)
+	{
+		const Slot& slot = slots[(h + i) & (t->nhash - 1)];
+		if (slot.key.tag == Tag::Empty)
+		{
+			return nullptr;
+		}
+		if (slot.key.tag != k.tag)
+		{
+			continue;
+		}
+		if (k.tag == Tag::String)
+		{
+			if (slot.key.len == k.len && std::memcmp(im->data + slot.key.payload, s, k.len) == 0)
+			{
+				return &slot.value;
+			}
+		}
+		else if (slot.key.payload == k.payload)
+		{
+			return &slot.value;
+		}
+	}
+	return nullptr;
+}
+
+
+static int m_index (lua_State* L)
+{
+	auto p = checkproxy(L, 1);
+	auto v = lookup(L, p->image, p->image->table(p->table), 2);
+	if (v == nullptr)
+	{
+		lua_pushnil(L);
+	}
+	else
+	{
+		pushvalue(L, p->image, *v);
+	}
+	return 1;
+}
+
+static int m_newindex (lua_State* L)
+{
+	checkproxy(L, 1);
+	return luaL_error(L, "attempt to modify a frozen table");
+}
+
+static int m_len (lua_State* L)
+{
+	auto p = checkproxy(L, 1);
+	lua_pushinteger(L, p->image->table(p->table)->narray);
+	return 1;
+}
+
+/*
+** upvalue 1 is the proxy, upvalue 2 how far along it is: array entries
+** first, then hash slots
+*/
+static int m_next (lua_State* L)
+{
+	auto p = checkproxy(L, lua_upvalueindex(1));
+	auto t = p->image->table(p->table);
+	auto pos = static_cast<uint64_t>(lua_tointeger(L, lua_upvalueindex(2)));
+	auto values = p->image->values(t->array);
+	for (; pos < t->narray; pos++)
+	{
+		if (values[pos].tag != Tag::Nil)
+		{
+			lua_pushinteger(L, static_cast<lua_Integer>(pos + 1));
+			lua_replace(L, lua_upvalueindex(2));
+			lua_pushinteger(L, static_cast<lua_Integer>(pos + 1));
+			pushvalue(L, p->image, values[pos]);
+			return 2;
+		}
+	}
+	auto slots = p->image->slots(t->hash);
+	for (; pos < uint64_t(t->narray) + t->nhash; pos++)
+	{
+		const Slot& s = slots[pos - t->narray];
+		if (s.key.tag != Tag::Empty && s.value.tag != Tag::Nil)
+		{
+			lua_pushinteger(L, static_cast<lua_Integer>(pos + 1));
+			lua_replace(L, lua_upvalueindex(2));
+			pushvalue(L, p->image, s.key);
+			pushvalue(L, p->image, s.value);
+			return 2;
+		}
+	}
+	lua_pushinteger(L, static_cast<lua_Integer>(pos));
+	lua_replace(L, lua_upvalueindex(2));
+	return 0;
+}
+
+static int m_pairs (lua_State* L)
+{
+	checkproxy(L, 1);
+	lua_pushvalue(L, 1);
+	lua_pushinteger(L, 0);
+	lua_pushcclosure(L, m_next, 2);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	return 3;
+}
+
+static int m_tostring (lua_State* L)
+{
+	auto p = checkproxy(L, 1);
+	lua_pushfstring(L, "frozen table: %p", static_cast<const void*>(p->image->table(p->table)));
+	return 1;
+}
+
+static int m_gc (lua_State* L)
+{
+	auto p = checkproxy(L, 1);
+	if (p->image != nullptr)
+	{
+		release(p->image);
+		p->image = nullptr;
+	}
+	return 0;
+}
+
+static int m_clone (lua_State* L)
+{
+	auto p = checkproxy(L, 1);
+	if (p->image != nullptr)
+	{
+		retain(p->image);
+	}
+	return 0;
+}
+
+static constexpr luaL_Reg metamethods[] = {
+	{"__index", m_index},
+	{"__newindex", m_newindex},
+	{"__len", m_len},
+	{"__pairs", m_pairs},
+	{"__tostring", m_tostring},
+	{"__gc", m_gc},
+	{"__clone", m_clone},
+	luaL_Reg::end(),
+};
+
+/*
+** pushes the proxy for 'table' in 'im'. proxies are kept in a weak cache
+** per state, so the same frozen table always gives the same proxy
+*/
+static void pushproxy (lua_State* L, Image* im, uint64_t table)
+{
+	luaL_checkstack(L, 4, "cannot push frozen table");
+	const void* key = im->data + table;
+	if (luaL_getsubtable(L, LUA_REGISTRYINDEX, COYOTE_FROZEN_CACHE) == 0)
+	{
+		lua_createtable(L, 0, 1);
+		lua_pushliteral(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+	}
+	if (lua_rawgetp(L, -1, key) == LUA_TUSERDATA)
+	{
+		lua_remove(L, -2);
+		return;
+	}
+	lua_pop(L, 1);
+	auto p = static_cast<Proxy*>(lua_newuserdatauv(L, sizeof(Proxy), 0));
+	p->image = nullptr;
+	if (luaL_newmetatable(L, COYOTE_FROZEN_REG))
+	{
+		luaL_setfuncs(L, metamethods, 0);
+	}
+	lua_setmetatable(L, -2);
+	retain(im);
+	p->image = im;
+	p->table = table;
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, -3, key);
+	lua_remove(L, -2);
+}
+
+
+/*
+** frozen.freeze(t): a frozen copy of 't' and everything it reaches.
+** metatables aren't copied, and only nil, booleans, numbers, strings and
+** tables can be frozen
+*/
+static int f_freeze (lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 1);
+	auto im = Builder {L, {}, {}, {}, {}}.build(1);
+	pushproxy(L, im, im->header()->root);
+	release(im);
+	return 1;
+}
+
+static int f_isfrozen (lua_State* L)
+{
+	lua_pushboolean(L, luaL_testudata(L, 1, COYOTE_FROZEN_REG) != nullptr);
+	return 1;
+}
+
+/*
+** frozen.thaw(f): a regular, writable copy of frozen table 'f'
+*/
+static int f_thaw (lua_State* L)
+{
+	auto p = checkproxy(L, 1);
+	auto im = p->image;
+	lua_settop(L, 1);
+	// frozen table offset -> its copy; then the worklist of copies to fill
+	lua_newtable(L);
+	lua_newtable(L);
+	int copies = 2;
+	int work = 3;
+	lua_Integer nwork = 0;
+	auto copyof = [&](uint64_t table) {
+		if (lua_rawgetp(L, copies, im->data + table) == LUA_TNIL)
+		{
+			lua_pop(L, 1);
+			auto t = im->table(table);
+			lua_createtable(L, static_cast<int>(t->narray), static_cast<int>(t->nhash / 2));
+			lua_pushvalue(L, -1);
+			lua_rawsetp(L, copies, im->data + table);
+			lua_pushinteger(L, static_cast<lua_Integer>(table));
+			lua_rawseti(L, work, ++nwork);
+		}
+	};
+	auto push = [&](const Value& v) {
+		if (v.tag == Tag::Table)
+		{
+			copyof(static_cast<uint64_t>(v.payload));
+		}
+		else
+		{
+			pushvalue(L, im, v);
+		}
+	};
+	copyof(p->table);
+	for (lua_Integer i = 1; i <= nwork; i++)
+	{
+		luaL_checkstack(L, 4, "cannot thaw frozen table");
+		lua_rawgeti(L, work, i);
+		auto table = static_cast<uint64_t>(lua_tointeger(L, -1));
+		lua_pop(L, 1);
+		lua_rawgetp(L, copies, im->data + table);
+		int dest = lua_gettop(L);
+		auto t = im->table(table);
+		auto values = im->values(t->array);
+		for (uint32_t j = 0; j < t->narray; j++)
+		{
+			if (values[j].tag != Tag::Nil)
+			{
+				push(values[j]);
+				lua_rawseti(L, dest, j + 1);
+			}
+		}
+		auto slots = im->slots(t->hash);
+		for (uint32_t j = 0; j < t->nhash; j++)
+		{
+			if (slots[j].key.tag != Tag::Empty && slots[j].value.tag != Tag::Nil)
+			{
+				push(slots[j].key);
+				push(slots[j].value);
+				lua_rawset(L, dest);
+			}
+		}
+		lua_pop(L, 1);
+	}
+	lua_rawgetp(L, copies, im->data + p->table);
+	return 1;
+}
+
+/*
+** frozen.size(f): bytes in the image 'f' is part of
+*/
+static int f_size (lua_State* L)
+{
+	auto p = checkproxy(L, 1);
+	lua_pushinteger(L, static_cast<lua_Integer>(p->image->header()->size));
+	return 1;
+}
+
+
+}
+
+
+/*
+** the image behind the frozen table at 'idx', with a reference taken for
+** the caller, or NULL if it isn't one. 'out_table' gets which table in the
+** image it is; pass both to coyote_pushfrozen to push it into any state
+*/
+LUALIB_API void* coyote_tofrozen (lua_State* L, int idx, size_t* out_table)
+{
+	auto p = static_cast<CoyoteFrozen::Proxy*>(luaL_testudata(L, idx, COYOTE_FROZEN_REG));
+	if (p == nullptr || p->image == nullptr)
+	{
+		return nullptr;
+	}
+	CoyoteFrozen::retain(p->image);
+	if (out_table != nullptr)
+	{
+		*out_table = p->table;
+	}
+	return p->image;
+}
+
+/*
+** pushes table 'table' of 'image' (0 for its root); the state takes its
+** own reference
+*/
+LUALIB_API void coyote_pushfrozen (lua_State* L, void* image, size_t table)
+{
+	auto im = static_cast<CoyoteFrozen::Image*>(image);
+	CoyoteFrozen::pushproxy(L, im, table == 0 ? im->header()->root : table);
+}
+
+LUALIB_API void coyote_releasefrozen (void* image)
+{
+	CoyoteFrozen::release(static_cast<CoyoteFrozen::Image*>(image));
+}
+
+
+static constexpr luaL_Reg frozenfuncs[] = {
+	{"freeze", CoyoteFrozen::f_freeze},
+	{"isfrozen", CoyoteFrozen::f_isfrozen},
+	{"thaw", CoyoteFrozen::f_thaw},
+	{"size", CoyoteFrozen::f_size},
+	luaL_Reg::end(),
+};
+
+LUALIB_API int createfrozenlib (lua_State* L)
+{
+	luaL_newlib(L, frozenfuncs);
+	return 1;
+}
+
+
+#endif
@@ -0,0 +1,1036 @@
+#ifndef COYOTE_LANES_LIB
+#define COYOTE_LANES_LIB
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../lua.hpp"
+#include "../lauxlib.hpp"
+#include "../lualib.hpp"
+
+/*
+** lanes: Lua functions run in states of their own on a shared pool of
+** threads, talking over channels. nothing Lua-side is shared between
+** states; values are copied out of one into a Message and back into the
+** other. strings, bytecode and arrays that own their elements are copied,
+** while host memory behind array views, channels, frozen tables and C
+** functions are passed as they are
+*/
+namespace CoyoteLanes {
+
+struct Channel;
+
+enum class Tag : uint8_t
+{
+	Nil,
+	False,
+	True,
+	Integer,
+	Number,
+	String,         // a = offset, b = length
+	Table,          // a = pair count, pairs follow
+	Ref,            // a = which table, in the order they were sent
+	Function,       // a = offset, b = length of the bytecode
+	CFunction,      // a = the function
+	LightUserdata,  // a = the pointer
+	Channel,        // a = index in 'channels'
+	ArrayView,      // a = elements, b = count, kind = type
+	Array,          // a = offset, b = count, kind = type
+	Buffer,         // a = offset, b = length
+	Frozen,         // a = index in 'images', b = which table in it
+};
+
+struct Node
+{
+	Tag tag;
+	uint8_t kind;
+	int64_t a;
+	int64_t b;
+};
+
+
+static void retain (Channel* c);
+static void release (Channel* c);
+
+/*
+** values on their way between states, in pre-order like flat tables; holds
+** a reference to every channel and frozen image in it
+*/
+struct Message
+{
+	std::vector<Node> nodes;
+	std::string bytes;
+	std::vector<Channel*> channels;
+	std::vector<void*> images;
+	int count = 0;
+
+	Message () = default;
+	Message (const Message&) = delete;
+	auto operator = (const Message&) -> Message& = delete;
+
+	Message (Message&& o) noexcept
+		: nodes(std::move(o.nodes)), bytes(std::move(o.bytes)), channels(std::move(o.channels)), images(std::move(o.images)), count(o.count)
+	{
+		o.channels.clear();
+		o.images.clear();
+		o.count = 0;
+	}
+
+	auto operator = (Message&& o) noexcept -> Message&
+	{
+		if (this != &o)
+		{
+			clear();
+			nodes = std::move(o.nodes);
+			bytes = std::move(o.bytes);
+			channels = std::move(o.channels);
+			images = std::move(o.images);
+			count = o.count;
+			o.channels.clear();
+			o.images.clear();
+			o.count = 0;
+		}
+		return *this;
+	}
+
+	~Message ()
+	{
+		clear();
+	}
+
+	void clear ()
+	{
+		for (auto c : channels)
+		{
+			release(c);
+		}
+		for (auto im : images)
+		{
+			coyote_releasefrozen(im);
+		}
+		nodes.clear();
+		bytes.clear();
+		channels.clear();
+		images.clear();
+		count = 0;
+	}
+};
+
+
+struct Channel
+{
+	std::atomic<int> refs {1};
+	std::mutex m;
+	std::condition_variable notfull;
+	std::condition_variable notempty;
+	std::deque<Message> queue;
+	size_t capacity;
+	bool closed = false;
+
+	explicit Channel (size_t capacity) : capacity(capacity) {}
+};
+
+static void retain (Channel* c)
+{
+	c->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void release (Channel* c)
+{
+	if (c->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		delete c;
+	}
+}
+
+
+#define COYOTE_CHANNEL_REG "COYOTE_CHANNEL*"
+#define COYOTE_LANE_REG "COYOTE_LANE*"
+
+static constexpr int MAX_DEPTH = 200;
+
+static auto elementsize (int type) -> size_t
+{
+	return type == COYOTE_ARRAY_F64 ? sizeof(double) : sizeof(float);
+}
+
+static_assert(sizeof(float) == sizeof(int32_t));
+
+
+struct Encoder
+{
+	lua_State* L;
+	Message& m;
+	std::unordered_map<const void*, int64_t> tables;
+	int depth = 0;
+
+	auto put (Tag tag, int64_t a = 0, int64_t b = 0, uint8_t kind = 0) -> size_t
+	{
+		m.nodes.push_back(Node {tag, kind, a, b});
+		return m.nodes.size() - 1;
+	}
+
+	auto putbytes (const void* p, size_t len) -> int64_t
+	{
+		auto at = static_cast<int64_t>(m.bytes.size());
+		m.bytes.append(static_cast<const char*>(p), len);
+		return at;
+	}
+
+	static int writer (lua_State*, const void* p, size_t sz, void* ud)
+	{
+		static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+		return 0;
+	}
+
+	void function (int idx)
+	{
+		if (lua_iscfunction(L, idx))
+		{
+			if (lua_getupvalue(L, idx, 1) != nullptr)
+			{
+				luaL_error(L, "cannot send a C function with upvalues");
+			}
+			put(Tag::CFunction, reinterpret_cast<intptr_t>(lua_tocfunction(L, idx)));
+			return;
+		}
+		// only the globals can come along, as the first upvalue (whatever
+		// its name, which stripping loses), and the other side gets its own
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+		for (int i = 1; ; i++)
+		{
+			const char* name = lua_getupvalue(L, idx, i);
+			if (name == nullptr)
+			{
+				break;
+			}
+			bool globals = i == 1 && lua_rawequal(L, -1, -2);
+			lua_pop(L, 1);
+			if (!globals)
+			{
+				luaL_error(L, "cannot send a function with upvalue '%s'", name);
+			}
+		}
+		lua_pop(L, 1);
+		std::string code;
+		lua_pushvalue(L, idx);
+		lua_dump(L, writer, &code, 0);
+		lua_pop(L, 1);
+		put(Tag::Function, putbytes(code.data(), code.size()), static_cast<int64_t>(code.size()));
+	}
+
+	void userdata (int idx)
+	{
+		if (auto ref = static_cast<Channel**>(luaL_testudata(L, idx, COYOTE_CHANNEL_REG)))
+		{
+			retain(*ref);
+			m.channels.push_back(*ref);
+			put(Tag::Channel, static_cast<int64_t>(m.channels.size() - 1));
+			return;
+		}
+		size_t table;
+		if (void* image = coyote_tofrozen(L, idx, &table))
+		{
+			m.images.push_back(image);
+			put(Tag::Frozen, static_cast<int64_t>(m.images.size() - 1), static_cast<int64_t>(table));
+			return;
+		}
+		size_t count;
+		int type;
+		if (void* data = coyote_toarray(L, idx, &count, &type))
+		{
+			if (coyote_isarrayview(L, idx))
+			{
+				put(Tag::ArrayView, reinterpret_cast<intptr_t>(data), static_cast<int64_t>(count), static_cast<uint8_t>(type));
+			}
+			else
+			{
+				put(Tag::Array, putbytes(data, count * elementsize(type)), static_cast<int64_t>(count), static_cast<uint8_t>(type));
+			}
+			return;
+		}
+		size_t size;
+		if (void* data = coyote_tobuffer(L, idx, &size))
+		{
+			put(Tag::Buffer, putbytes(data, size), static_cast<int64_t>(size));
+			return;
+		}
+		luaL_error(L, "cannot send this userdata");
+	}
+
+	void table (int idx)
+	{
+		auto p = lua_topointer(L, idx);
+		auto found = tables.find(p);
+		if (found != tables.end())
+		{
+			put(Tag::Ref, found->second);
+			return;
+		}
+		if (depth >= MAX_DEPTH)
+		{
+			luaL_error(L, "table nested too deep to send");
+		}
+		luaL_checkstack(L, 3, "table nested too deep to send");
+		tables.emplace(p, static_cast<int64_t>(tables.size()));
+		depth++;
+		auto head = put(Tag::Table);
+		int64_t pairs = 0;
+		lua_pushnil(L);
+		while (lua_next(L, idx))
+		{
+			int top = lua_gettop(L);
+			value(top - 1);
+			value(top);
+			pairs++;
+			lua_pop(L, 1);
+		}
+		m.nodes[head].a = pairs;
+		depth--;
+	}
+
+	void value (int idx)
+	{
+		switch (lua_type(L, idx))
+		{
+			case LUA_TNIL: {
+				put(Tag::Nil);
+				break;
+			}
+			case LUA_TBOOLEAN: {
+				put(lua_toboolean(L, idx) ? Tag::True : Tag::False);
+				break;
+			}
+			case LUA_TNUMBER: {
+				if (lua_isinteger(L, idx))
+				{
+					put(Tag::Integer, lua_tointeger(L, idx));
+				}
+				else
+				{
+					lua_Number n = lua_tonumber(L, idx);
+					int64_t bits;
+					std::memcpy(&bits, &n, sizeof(bits));
+					put(Tag::Number, bits);
+				}
+				break;
+			}
+			case LUA_TSTRING: {
+				size_t len;
+				const char* s = lua_tolstring(L, idx, &len);
+				put(Tag::String, putbytes(s, len), static_cast<int64_t>(len));
+				break;
+			}
+			case LUA_TTABLE: {
+				table(idx);
+				break;
+			}
+			case LUA_TFUNCTION: {
+				function(idx);
+				break;
+			}
+			case LUA_TLIGHTUSERDATA: {
+				put(Tag::LightUserdata, reinterpret_cast<intptr_t>(lua_touserdata(L, idx)));
+				break;
+			}
+			case LUA_TUSERDATA: {
+				userdata(idx);
+				break;
+			}
+			default: {
+				luaL_error(L, "cannot send a %s", luaL_typename(L, idx));
+				break;
+			}
+		}
+	}
+
+	/*
+	** adds the values from 'first' to 'last' to the message
+	*/
+	void values (int first, int last)
+	{
+		for (int i = first; i <= last; i++)
+		{
+			value(i);
+			m.count++;
+		}
+	}
+};
+
+
+static void pushchannel (lua_State* L, Channel* c);
+
+struct Decoder
+{
+	lua_State* L;
+	const Message& m;
+	size_t at = 0;
+	int cache = 0;
+	lua_Integer ntables = 0;
+
+	auto bytes (int64_t offset) -> const char*
+	{
+		return m.bytes.data() + offset;
+	}
+
+	void value ()
+	{
+		luaL_checkstack(L, 3, "table nested too deep to receive");
+		const Node& n = m.nodes[at++];
+		switch (n.tag)
+		{
+			case Tag::Nil: {
+				lua_pushnil(L);
+				break;
+			}
+			case Tag::False:
+			case Tag::True: {
+				lua_pushboolean(L, n.tag == Tag::True);
+				break;
+			}
+			case Tag::Integer: {
+				lua_pushinteger(L, n.a);
+				break;
+			}
+			case Tag::Number: {
+				lua_Number v;
+				std::memcpy(&v, &n.a, sizeof(v));
+				lua_pushnumber(L, v);
+				break;
+			}
+			case Tag::String: {
+				lua_pushlstring(L, bytes(n.a), static_cast<size_t>(n.b));
+				break;
+			}
+			case Tag::Table: {
+				lua_createtable(L, 0, n.a > INT32_MAX ? 0 : static_cast<int>(n.a));
+				lua_pushvalue(L, -1);
+				lua_rawseti(L, cache, ++ntables);
+				int t = lua_gettop(L);
+				for (int64_t i = 0; i < n.a; i++)
+				{
+					value();
+					value();
+					lua_rawset(L, t);
+				}
+				break;
+			}
+			case Tag::Ref: {
+				lua_rawgeti(L, cache, n.a + 1);
+				break;
+			}
+			case Tag::Function: {
+				if (luaL_loadbufferx(L, bytes(n.a), static_cast<size_t>(n.b), "=lane", "b") != LUA_OK)
+				{
+					lua_error(L);
+				}
+				break;
+			}
+			case Tag::CFunction: {
+				lua_pushcfunction(L, reinterpret_cast<lua_CFunction>(static_cast<intptr_t>(n.a)));
+				break;
+			}
+			case Tag::LightUserdata: {
+				lua_pushlightuserdata(L, reinterpret_cast<void*>(static_cast<intptr_t>(n.a)));
+				break;
+			}
+			case Tag::Channel: {
+				pushchannel(L, m.channels[static_cast<size_t>(n.a)]);
+				break;
+			}
+			case Tag::ArrayView: {
+				coyote_pusharray(L, reinterpret_cast<void*>(static_cast<intptr_t>(n.a)), static_cast<size_t>(n.b), n.kind);
+				break;
+			}
+			case Tag::Array: {
+				void* data = coyote_pusharray(L, nullptr, static_cast<size_t>(n.b), n.kind);
+				std::memcpy(data, bytes(n.a), static_cast<size_t>(n.b) * elementsize(n.kind));
+				break;
+			}
+			case Tag::Buffer: {
+				void* data = coyote_newbuffer(L, static_cast<size_t>(n.b));
+				std::memcpy(data, bytes(n.a), static_cast<size_t>(n.b));
+				break;
+			}
+			case Tag::Frozen: {
+				coyote_pushfrozen(L, m.images[static_cast<size_t>(n.a)], static_cast<size_t>(n.b));
+				break;
+			}
+		}
+	}
+
+	/*
+	** pushes every value in the message, returning how many
+	*/
+	auto values () -> int
+	{
+		luaL_checkstack(L, m.count + 1, "too many values to receive");
+		lua_newtable(L);
+		cache = lua_gettop(L);
+		for (int i = 0; i < m.count; i++)
+		{
+			value();
+		}
+		lua_remove(L, cache);
+		return m.count;
+	}
+};
+
+
+struct Lane;
+
+/*
+** threads that run lanes, started as needed and kept for good. at most
+** 'limit' of them run lanes at once; lanes waiting on a channel or a join
+** don't count, so lanes waiting on each other can't starve the pool
+*/
+struct Pool
+{
+	std::mutex m;
+	std::condition_variable wake;
+	std::deque<Lane*> jobs;
+	int threads = 0;
+	int idle = 0;
+	int blocked = 0;
+	int limit;
+
+	Pool () : limit(static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))) {}
+
+	/*
+	** starts threads for queued jobs no idle one will take; 'm' held
+	*/
+	void grow ()
+	{
+		while (static_cast<size_t>(idle) < jobs.size() && threads - blocked < limit)
+		{
+			threads++;
+			idle++;
+			std::thread(&Pool::run, this).detach();
+		}
+	}
+
+	void submit (Lane* l)
+	{
+		{
+			std::lock_guard lock(m);
+			jobs.push_back(l);
+			grow();
+		}
+		wake.notify_one();
+	}
+
+	void block ()
+	{
+		std::lock_guard lock(m);
+		blocked++;
+		grow();
+	}
+
+	void unblock ()
+	{
+		std::lock_guard lock(m);
+		blocked--;
+	}
+
+	void run ();
+};
+
+static auto pool () -> Pool&
+{
+	// never destroyed: detached workers may still be blocked at exit
+	static Pool* p = new Pool();
+	return *p;
+}
+
+// set on pool threads, whose waits let another lane run meanwhile
+static thread_local bool onpool = false;
+
+
+/*
+** timeout argument in seconds; none or nil (negative here) waits for good
+*/
+static auto checktimeout (lua_State* L, int arg) -> lua_Number
+{
+	if (lua_isnoneornil(L, arg))
+	{
+		return -1;
+	}
+	lua_Number seconds = luaL_checknumber(L, arg);
+	return seconds > 0 ? seconds : 0;
+}
+
+template<typename Ready>
+static auto waitfor (lua_Number timeout, std::unique_lock<std::mutex>& lock, std::condition_variable& cv, Ready ready) -> bool
+{
+	if (ready())
+	{
+		return true;
+	}
+	if (onpool)
+	{
+		pool().block();
+	}
+	bool done = true;
+	if (timeout < 0)
+	{
+		cv.wait(lock, ready);
+	}
+	else
+	{
+		done = cv.wait_for(lock, std::chrono::duration<double>(timeout), ready);
+	}
+	if (onpool)
+	{
+		pool().unblock();
+	}
+	return done;
+}
+
+
+static auto checkchannel (lua_State* L, int idx) -> Channel*
+{
+	return *static_cast<Channel**>(luaL_checkudata(L, idx, COYOTE_CHANNEL_REG));
+}
+
+/*
+** ch:send(v [, timeout]) -> true | false, "timeout" | "closed"
+*/
+static int ch_send (lua_State* L)
+{
+	auto c = checkchannel(L, 1);
+	luaL_checkany(L, 2);
+	Message m;
+	Encoder {L, m, {}}.values(2, 2);
+	auto timeout = checktimeout(L, 3);
+	std::unique_lock lock(c->m);
+	bool ready = waitfor(timeout, lock, c->notfull, [c] { return c->closed || c->queue.size() < c->capacity; });
+	if (c->closed)
+	{
+		lua_pushboolean(L, 0);
+		lua_pushliteral(L, "closed");
+		return 2;
+	}
+	if (!ready)
+	{
+		lua_pushboolean(L, 0);
+		lua_pushliteral(L, "timeout");
+		return 2;
+	}
+	c->queue.push_back(std::move(m));
+	lock.unlock();
+	c->notempty.notify_one();
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+** ch:receive([timeout]) -> true, v | false, "timeout" | "closed"
+** a closed channel still hands out what was sent before it closed
+*/
+static int ch_receive (lua_State* L)
+{
+	auto c = checkchannel(L, 1);
+	auto timeout = checktimeout(L, 2);
+	std::unique_lock lock(c->m);
+	bool ready = waitfor(timeout, lock, c->notempty, [c] { return c->closed || !c->queue.empty(); });
+	if (c->queue.empty())
+	{
+		lua_pushboolean(L, 0);
+		if (ready)
+		{
+			lua_pushliteral(L, "closed");
+		}
+		else
+		{
+			lua_pushliteral(L, "timeout");
+		}
+		return 2;
+	}
+	Message m = std::move(c->queue.front());
+	c->queue.pop_front();
+	lock.unlock();
+	c->notfull.notify_one();
+	lua_pushboolean(L, 1);
+	return 1 + Decoder {L, m}.values();
+}
+
+static int ch_close (lua_State* L)
+{
+	auto c = checkchannel(L, 1);
+	{
+		std::lock_guard lock(c->m);
+		c->closed = true;
+	}
+	c->notfull.notify_all();
+	c->notempty.notify_all();
+	return 0;
+}
+
+static int ch_len (lua_State* L)
+{
+	auto c = checkchannel(L, 1);
+	std::lock_guard lock(c->m);
+	lua_pushinteger(L, static_cast<lua_Integer>(c->queue.size()));
+	return 1;
+}
+
+static int ch_eq (lua_State* L)
+{
+	lua_pushboolean(L, checkchannel(L, 1) == checkchannel(L, 2));
+	return 1;
+}
+
+static int ch_tostring (lua_State* L)
+{
+	lua_pushfstring(L, "channel: %p", static_cast<void*>(checkchannel(L, 1)));
+	return 1;
+}
+
+static int ch_gc (lua_State* L)
+{
+	auto ref = static_cast<Channel**>(luaL_checkudata(L, 1, COYOTE_CHANNEL_REG));
+	if (*ref != nullptr)
+	{
+		release(*ref);
+		*ref = nullptr;
+	}
+	return 0;
+}
+
+static int ch_clone (lua_State* L)
+{
+	auto ref = static_cast<Channel**>(luaL_checkudata(L, 1, COYOTE_CHANNEL_REG));
+	if (*ref != nullptr)
+	{
+		retain(*ref);
+	}
+	return 0;
+}
+
+static constexpr luaL_Reg channelmethods[] = {
+	{"send", ch_send},
+	{"receive", ch_receive},
+	{"close", ch_close},
+	luaL_Reg::end(),
+};
+
+static constexpr luaL_Reg channelmeta[] = {
+	{"__len", ch_len},
+	{"__eq", ch_eq},
+	{"__tostring", ch_tostring},
+	{"__gc", ch_gc},
+	{"__clone", ch_clone},
+	luaL_Reg::end(),
+};
+
+/*
+** pushes a new reference to 'c'
+*/
+static void pushchannel (lua_State* L, Channel* c)
+{
+	auto ref = static_cast<Channel**>(lua_newuserdatauv(L, sizeof(Channel*), 0));
+	*ref = nullptr;
+	if (luaL_newmetatable(L, COYOTE_CHANNEL_REG))
+	{
+		luaL_setfuncs(L, channelmeta, 0);
+		luaL_newlib(L, channelmethods);
+		lua_setfield(L, -2, "__index");
+	}
+	lua_setmetatable(L, -2);
+	retain(c);
+	*ref = c;
+}
+
+/*
+** lanes.channel([capacity]): a channel holding up to 'capacity' (64)
+** values at a time
+*/
+static int f_channel (lua_State* L)
+{
+	lua_Integer capacity = luaL_optinteger(L, 1, 64);
+	luaL_argcheck(L, capacity >= 1, 1, "capacity must be at least 1");
+	auto c = new Channel(static_cast<size_t>(capacity));
+	pushchannel(L, c);
+	release(c);
+	return 1;
+}
+
+
+struct Lane
+{
+	enum class State
+	{
+		Pending,
+		Running,
+		Done,
+		Failed,
+	};
+
+	std::atomic<int> refs {1};
+	std::mutex m;
+	std::condition_variable finished;
+	State state = State::Pending;
+	// the function (or source) and its arguments
+	Message job;
+	// what it returned, or its error
+	Message results;
+};
+
+static void release (Lane* l)
+{
+	if (l->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		delete l;
+	}
+}
+
+
+static int lanebody (lua_State* L)
+{
+	auto lane = static_cast<Lane*>(lua_touserdata(L, 1));
+	lua_settop(L, 0);
+	luaL_openlibs(L);
+	luaL_requiref(L, LUA_LANESNAME, createlaneslib, 1);
+	luaL_requiref(L, LUA_ARRAYNAME, createarraylib, 1);
+	luaL_requiref(L, LUA_BUFFERNAME, createbufferlib, 1);
+	luaL_requiref(L, LUA_FROZENNAME, createfrozenlib, 1);
+	luaL_requiref(L, LUA_PROFILENAME, createprofilelib, 1);
+	lua_settop(L, 0);
+	int n = Decoder {L, lane->job}.values();
+	if (lua_type(L, 1) == LUA_TSTRING)
+	{
+		size_t len;
+		const char* code = lua_tolstring(L, 1, &len);
+		if (luaL_loadbufferx(L, code, len, "=lane", "t") != LUA_OK)
+		{
+			return lua_error(L);
+		}
+		lua_replace(L, 1);
+	}
+	lua_call(L, n - 1, LUA_MULTRET);
+	Encoder {L, lane->results, {}}.values(1, lua_gettop(L));
+	return 0;
+}
+
+static void runlane (Lane* lane)
+{
+	{
+		std::lock_guard lock(lane->m);
+		lane->state = Lane::State::Running;
+	}
+	bool ok = false;
+	lua_State* L = luaL_newstate();
+	if (L == nullptr)
+	{
+		lane->results.clear();
+		lane->results.bytes = "not enough memory";
+	}
+	else
+	{
+		lua_pushcfunction(L, lanebody);
+		lua_pushlightuserdata(L, lane);
+		ok = lua_pcall(L, 1, 0, 0) == LUA_OK;
+		if (!ok)
+		{
+			lane->results.clear();
+			if (const char* msg = lua_tostring(L, -1))
+			{
+				lane->results.bytes = msg;
+			}
+			else
+			{
+				lane->results.bytes = "(error object is a ";
+				lane->results.bytes += luaL_typename(L, -1);
+				lane->results.bytes += " value)";
+			}
+		}
+		lua_close(L);
+	}
+	lane->job.clear();
+	{
+		std::lock_guard lock(lane->m);
+		lane->state = ok ? Lane::State::Done : Lane::State::Failed;
+	}
+	lane->finished.notify_all();
+	release(lane);
+}
+
+void Pool::run ()
+{
+	// new threads start out counted as idle, see grow
+	onpool = true;
+	std::unique_lock lock(m);
+	while (true)
+	{
+		wake.wait(lock, [this] { return !jobs.empty(); });
+		idle--;
+		Lane* l = jobs.front();
+		jobs.pop_front();
+		lock.unlock();
+		runlane(l);
+		lock.lock();
+		idle++;
+	}
+}
+
+
+static auto checklane (lua_State* L, int idx) -> Lane*
+{
+	return *static_cast<Lane**>(luaL_checkudata(L, idx, COYOTE_LANE_REG));
+}
+
+/*
+** h:join([timeout]) -> true, results... | false, error | nil, "timeout"
+*/
+static int lane_join (lua_State* L)
+{
+	auto lane = checklane(L, 1);
+	auto timeout = checktimeout(L, 2);
+	std::unique_lock lock(lane->m);
+	bool ready = waitfor(timeout, lock, lane->finished, [lane] {
+		return lane->state == Lane::State::Done || lane->state == Lane::State::Failed;
+	});
+	if (!ready)
+	{
+		lua_pushnil(L);
+		lua_pushliteral(L, "timeout");
+		return 2;
+	}
+	lock.unlock();
+	// nothing writes to 'results' once the lane is over
+	if (lane->state == Lane::State::Failed)
+	{
+		lua_pushboolean(L, 0);
+		lua_pushlstring(L, lane->results.bytes.data(), lane->results.bytes.size());
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	return 1 + Decoder {L, lane->results}.values();
+}
+
+static int lane_status (lua_State* L)
+{
+	static constexpr const char* names[] = {"pending", "running", "done", "failed"};
+	auto lane = checklane(L, 1);
+	std::lock_guard lock(lane->m);
+	lua_pushstring(L, names[static_cast<int>(lane->state)]);
+	return 1;
+}
+
+static int lane_tostring (lua_State* L)
+{
+	lua_pushfstring(L, "lane: %p", static_cast<void*>(checklane(L, 1)));
+	return 1;
+}
+
+static int lane_gc (lua_State* L)
+{
+	auto ref = static_cast<Lane**>(luaL_checkudata(L, 1, COYOTE_LANE_REG));
+	if (*ref != nullptr)
+	{
+		release(*ref);
+		*ref = nullptr;
+	}
+	return 0;
+}
+
+static int lane_clone (lua_State* L)
+{
+	auto ref = static_cast<Lane**>(luaL_checkudata(L, 1, COYOTE_LANE_REG));
+	if (*ref != nullptr)
+	{
+		(*ref)->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+	return 0;
+}
+
+static constexpr luaL_Reg lanemethods[] = {
+	{"join", lane_join},
+	{"status", lane_status},
+	luaL_Reg::end(),
+};
+
+static constexpr luaL_Reg lanemeta[] = {
+	{"__tostring", lane_tostring},
+	{"__gc", lane_gc},
+	{"__clone", lane_clone},
+	luaL_Reg::end(),
+};
+
+/*
+** lanes.spawn(f, ...): runs f(...) in a new state on the pool. 'f' is a
+** function with no upvalue but the globals as its first, or a string of
+** source code; it and the arguments are copied over before this returns
+*/
+static int f_spawn (lua_State* L)
+{
+	if (lua_type(L, 1) != LUA_TSTRING)
+	{
+		luaL_checktype(L, 1, LUA_TFUNCTION);
+	}
+	auto ref = static_cast<Lane**>(lua_newuserdatauv(L, sizeof(Lane*), 0));
+	*ref = nullptr;
+	if (luaL_newmetatable(L, COYOTE_LANE_REG))
+	{
+		luaL_setfuncs(L, lanemeta, 0);
+		luaL_newlib(L, lanemethods);
+		lua_setfield(L, -2, "__index");
+	}
+	lua_setmetatable(L, -2);
+	auto lane = new Lane();
+	*ref = lane;
+	Encoder {L, lane->job, {}}.values(1, lua_gettop(L) - 1);
+	// one reference for the handle, one for the worker
+	lane->refs.fetch_add(1, std::memory_order_relaxed);
+	pool().submit(lane);
+	return 1;
+}
+
+/*
+** lanes.workers([n]): how many threads lanes may run on at once, setting
+** it to 'n' first if given
+*/
+static int f_workers (lua_State* L)
+{
+	auto& p = pool();
+	std::lock_guard lock(p.m);
+	if (!lua_isnoneornil(L, 1))
+	{
+		lua_Integer n = luaL_checkinteger(L, 1);
+		luaL_argcheck(L, n >= 1 && n <= 4096, 1, "worker count out of range");
+		p.limit = static_cast<int>(n);
+		p.grow();
+	}
+	lua_pushinteger(L, p.limit);
+	return 1;
+}
+
+
+}
+
+
+static constexpr luaL_Reg lanesfuncs[] = {
+	{"spawn", CoyoteLanes::f_spawn},
+	{"channel", CoyoteLanes::f_channel},
+	{"workers", CoyoteLanes::f_workers},
+	luaL_Reg::end(),
+};
+
+LUALIB_API int createlaneslib (lua_State* L)
+{
+	luaL_newlib(L, lanesfuncs);
+	return 1;
+}
+
+
+#endif
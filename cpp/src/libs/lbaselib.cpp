@@ -614,5 +614,8 @@ LUAMOD_API int luaopen_base(lua_State *L)
 	/* set global _VERSION */
 	lua_pushliteral(L, LUA_VERSION);
 	lua_setfield(L, -2, "_VERSION");
+	/* let the VM run 'ipairs' and 'pairs' loops without calling these */
+	lua_setiterator(L, LUA_ITERIPAIRS, ipairsaux);
+	lua_setiterator(L, LUA_ITERNEXT, luaB_next);
 	return 1;
 }
@@ -246,6 +246,21 @@ static int f_gc(lua_State *L)
 }
 
 
+static int io_noclose(lua_State *L);
+
+/*
+** a cloned state gets the standard files as they are; any other file
+** stays with the template, so the copy is closed
+*/
+static int f_clone(lua_State *L)
+{
+	LStream *p = tolstream(L);
+	if (p->closef != &io_noclose)
+		p->closef = NULL;
+	return 0;
+}
+
+
 /*
 ** function to close regular files
 */
@@ -866,6 +881,7 @@ static const luaL_Reg metameth[] = {
 	{"__index", NULL}, /* placeholder */
 	{"__gc", f_gc},
 	{"__close", f_gc},
+	{"__clone", f_clone},
 	{"__tostring", f_tostring},
 	{NULL, NULL}
 };
@@ -340,6 +340,9 @@ static const luaL_Reg mathlib[] = {
 	/* placeholders */
 	{"random", NULL},
 	{"randomseed", NULL},
+	{"randomfill", NULL},
+	{"randomfill4", NULL},
+	{"newrandom", NULL},
 	{"pi", NULL},
 	{"huge", NULL},
 	{"maxinteger", NULL},
@@ -375,6 +375,46 @@ static int gctm(lua_State *L)
 }
 
 
+/*
+** __clone tag method for CLIBS table: a cloned state loads each library
+** again, taking its own reference to the handle it will unload. If one
+** fails to load, the list is cut short before it so the clone's __gc
+** unloads only what it took.
+*/
+static int clonetm(lua_State *L)
+{
+	lua_Integer i, n = luaL_len(L, 1);
+	lua_newtable(L); /* handle -> path */
+	lua_pushnil(L);
+	while (lua_next(L, 1))
+	{
+		if (lua_type(L, -2) == LUA_TSTRING)
+		{
+			lua_pushvalue(L, -2);
+			lua_rawset(L, 2);
+		}
+		else
+			lua_pop(L, 1);
+	}
+	for (i = 1; i <= n; i++)
+	{
+		lua_rawgeti(L, 1, i);
+		lua_rawget(L, 2);
+		if (lua_type(L, -1) != LUA_TSTRING || lsys_load(L, lua_tostring(L, -1), 0) == NULL)
+		{
+			for (; n >= i; n--)
+			{
+				lua_pushnil(L);
+				lua_rawseti(L, 1, n);
+			}
+			return luaL_error(L, "cannot reload C library for cloned state");
+		}
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+
 /* error codes for 'lookforfunc' */
 #define ERRLIB		1
 #define ERRFUNC		2
@@ -577,6 +617,40 @@ static int searcher_Lua(lua_State *L)
 }
 
 
+/*
+** 'package.prefetch(names)': compiles, all at once, the files that
+** 'searcher_Lua' would load for the modules in list 'names', so that
+** 'require' finds them compiled (see 'luaL_prefetch'). Modules not in
+** 'package.path' are skipped. Returns how many files compiled.
+*/
+static int ll_prefetch(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_Integer n = luaL_len(L, 1);
+	int count = 0;
+	lua_newtable(L); /* file names found */
+	for (lua_Integer i = 1; i <= n; i++)
+	{
+		lua_geti(L, 1, i);
+		const char *name = lua_tostring(L, -1);
+		luaL_argexpected(L, name != NULL, 1, "list of module names");
+		if (findfile(L, name, "path", LUA_LSUBSEP) != NULL)
+			lua_rawseti(L, 2, ++count);
+		lua_settop(L, 2);
+	}
+	auto files = static_cast<const char **>(
+		lua_newuserdatauv(L, count * sizeof(const char *), 0));
+	for (int i = 0; i < count; i++)
+	{
+		lua_rawgeti(L, 2, i + 1);
+		files[i] = lua_tostring(L, -1); /* kept by table at index 2 */
+		lua_pop(L, 1);
+	}
+	lua_pushinteger(L, luaL_prefetch(L, files, count, NULL));
+	return 1;
+}
+
+
 /*
 ** Try to find a load function for module 'modname' at file 'filename'.
 ** First, change '.' to '_' in 'modname'; then, if 'modname' has
@@ -786,6 +860,8 @@ static void createclibstable(lua_State *L)
 	lua_createtable(L, 0, 1); /* create metatable for CLIBS */
 	lua_pushcfunction(L, gctm);
 	lua_setfield(L, -2, "__gc"); /* set finalizer for CLIBS table */
+	lua_pushcfunction(L, clonetm);
+	lua_setfield(L, -2, "__clone");
 	lua_setmetatable(L, -2);
 }
 
@@ -795,6 +871,9 @@ LUAMOD_API int luaopen_package(lua_State *L)
 	createclibstable(L);
 	luaL_newlib(L, pk_funcs); /* create 'package' table */
 	createsearcherstable(L);
+	lua_pushvalue(L, -1); /* 'package' as upvalue, as for searchers */
+	lua_pushcclosure(L, ll_prefetch, 1);
+	lua_setfield(L, -2, "prefetch");
 	/* set paths */
 	setpath(L, "path", LUA_PATH_VAR, LUA_PATH_DEFAULT);
 	setpath(L, "cpath", LUA_CPATH_VAR, LUA_CPATH_DEFAULT);
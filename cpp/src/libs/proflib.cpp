@@ -0,0 +1,70 @@
+#ifndef COYOTE_PROFILE_LIB
+#define COYOTE_PROFILE_LIB
+
+#include "../lua.hpp"
+#include "../lauxlib.hpp"
+#include "../lualib.hpp"
+
+/*
+** profile: the sampling profiler of the state, which gathers call stacks
+** on a timer at little cost to the code it watches, and dumps them in the
+** collapsed format flame graph tools read
+*/
+namespace CoyoteProfile {
+
+static constexpr const char* modenames[] = {"f", "l", nullptr};
+
+/*
+** profile.start([interval [, mode]]): samples the running code every
+** 'interval' milliseconds (1 by default), dropping earlier samples.
+** mode "f" gives a frame per function, "l" one per line of it
+*/
+static int f_start (lua_State* L)
+{
+	lua_Number interval = luaL_optnumber(L, 1, 1);
+	int mode = luaL_checkoption(L, 2, "f", modenames);
+	luaL_argcheck(L, interval >= 0.001 && interval <= 1e6, 1, "interval out of range");
+	if (lua_profilestart(L, static_cast<int>(interval * 1000), mode) != LUA_OK)
+	{
+		return lua_error(L);
+	}
+	return 0;
+}
+
+/*
+** profile.stop(): stops sampling, keeping the samples for profile.dump
+*/
+static int f_stop (lua_State* L)
+{
+	lua_profilestop(L);
+	return 0;
+}
+
+/*
+** profile.dump([reset]): the samples so far, a "f1;f2;f3 count" line per
+** call stack, outermost first. 'reset' drops them afterwards
+*/
+static int f_dump (lua_State* L)
+{
+	lua_profiledump(L, lua_toboolean(L, 1));
+	return 1;
+}
+
+}
+
+
+static constexpr luaL_Reg profilefuncs[] = {
+	{"start", CoyoteProfile::f_start},
+	{"stop", CoyoteProfile::f_stop},
+	{"dump", CoyoteProfile::f_dump},
+	luaL_Reg::end(),
+};
+
+LUALIB_API int createprofilelib (lua_State* L)
+{
+	luaL_newlib(L, profilefuncs);
+	return 1;
+}
+
+
+#endif
@@ -4,10 +4,12 @@
 #include <cfloat>
 #include <ctime>
 #include <cstdint>
+#include <cstring>
 
 #include "../../lua.hpp"
 #include "lauxlib.hpp"
 #include "../../luatemplate.hpp"
+#include "../../lualib.hpp"
 
 /*
 ** {==================================================================
@@ -69,6 +71,30 @@ static Rand64 nextrand(Rand64 *state)
 }
 
 
+/*
+** Step 'W' independent generators together. Their states are stored
+** word-major ('state[i * W + lane]') so each step is the same operation
+** on 'W' neighbouring values, which compilers can turn into vector code.
+** With 'W' of 1 this is 'nextrand'.
+*/
+template<int W>
+static inline void nextrandn(Rand64 *state, Rand64 *res)
+{
+	for (int lane = 0; lane < W; lane++)
+	{
+		Rand64 state0 = state[0 * W + lane];
+		Rand64 state1 = state[1 * W + lane];
+		Rand64 state2 = state[2 * W + lane] ^ state0;
+		Rand64 state3 = state[3 * W + lane] ^ state1;
+		res[lane] = rotl(state1 * 5, 7) * 9;
+		state[0 * W + lane] = state0 ^ state3;
+		state[1 * W + lane] = state1 ^ state2;
+		state[2 * W + lane] = state2 ^ (state1 << 17);
+		state[3 * W + lane] = rotl(state3, 45);
+	}
+}
+
+
 /*
 ** Convert bits from a random integer into a float in the
 ** interval [0,1), getting the higher FIG bits from the
@@ -106,14 +132,106 @@ static lua_Number I2d(Rand64 x)
 
 
 /*
-** A state uses four 'Rand64' values.
+** A state uses four 'Rand64' values, plus the states of the four
+** lanes used by 'randomfill4' (laid out as for 'nextrandn').
 */
 typedef struct
 {
 	Rand64 s[4];
+	Rand64 lanes[4][4];
 } RanState;
 
 
+/*
+** Jump polynomials of 'xoshiro256**'. Jumping is the same as calling
+** 'nextrand' 2^128 times ('jumppoly') or 2^192 times ('longjumppoly'),
+** so states split off by jumping give sequences that never overlap.
+*/
+static const Rand64 jumppoly[4] = {
+	0x180ec6d33cfd0abau, 0xd5a61266f0c9392cu,
+	0xa9582618e03fc9aau, 0x39abdc4529b1661cu
+};
+
+static const Rand64 longjumppoly[4] = {
+	0x76e15d3efefdcbbfu, 0xc5004e441c522fb3u,
+	0x77710069854ee241u, 0x39109bb02acbe635u
+};
+
+/*
+** Polynomials for 2^127 and 2^125 calls, placing the lanes inside the
+** second half of the stretch a 'jump' skips (see 'seedlanes').
+*/
+static const Rand64 halfjumppoly[4] = {
+	0xeacbd852b93bd815u, 0x4dd8801baa92fddau,
+	0xa50845f0f4301985u, 0xd46cb8565abad18eu
+};
+
+static const Rand64 lanejumppoly[4] = {
+	0xaeb33557c76543feu, 0x1b18a0517cea386au,
+	0x56e93ecb5b361995u, 0xaa72e405fb26c80au
+};
+
+
+static void jumpstate(Rand64 *state, const Rand64 *poly)
+{
+	Rand64 res[4] = {0, 0, 0, 0};
+	for (int i = 0; i < 4; i++)
+	{
+		for (int b = 0; b < 64; b++)
+		{
+			if (poly[i] & ((Rand64) 1 << b))
+			{
+				for (int k = 0; k < 4; k++)
+					res[k] ^= state[k];
+			}
+			nextrand(state);
+		}
+	}
+	for (int k = 0; k < 4; k++)
+		state[k] = res[k];
+}
+
+
+/*
+** Seed the lanes by jumping a copy of the main generator, so they follow
+** 'randomseed' without moving the sequence 'random' gives. The lanes
+** take 2^125 values each from the second half of the 2^128 values up to
+** the state a 'jump' (or a 'longjump') would give: they overlap neither
+** each other, nor the first 2^127 values of this generator, nor those
+** of any generator split off from it by jumping.
+*/
+static void seedlanes(RanState *state)
+{
+	Rand64 copy[4] = {state->s[0], state->s[1], state->s[2], state->s[3]};
+	jumpstate(copy, halfjumppoly);
+	for (int lane = 0; lane < 4; lane++)
+	{
+		if (lane > 0)
+			jumpstate(copy, lanejumppoly);
+		for (int i = 0; i < 4; i++)
+			state->lanes[i][lane] = copy[i];
+	}
+}
+
+
+/*
+** Compute the smallest Mersenne number (2^b - 1) not smaller than 'n'.
+*/
+static lua_Unsigned projlimit(lua_Unsigned n)
+{
+	lua_Unsigned lim = n;
+	lim |= (lim >> 1);
+	lim |= (lim >> 2);
+	lim |= (lim >> 4);
+	lim |= (lim >> 8);
+	lim |= (lim >> 16);
+#if (LUA_MAXUNSIGNED >> 31) >= 3
+	lim |= (lim >> 32); /* integer type has more than 32 bits */
+#endif
+	return lim;
+}
+
+
 /*
 ** Project the random integer 'ran' into the interval [0, n].
 ** Because 'ran' has 2^B possible values, the projection can only be
@@ -129,16 +247,7 @@ static lua_Unsigned project(lua_Unsigned ran, lua_Unsigned n,
 {
 	if ((n & (n + 1)) == 0) /* is 'n + 1' a power of 2? */
 		return ran & n; /* no bias */
-	lua_Unsigned lim = n;
-	/* compute the smallest (2^b - 1) not smaller than 'n' */
-	lim |= (lim >> 1);
-	lim |= (lim >> 2);
-	lim |= (lim >> 4);
-	lim |= (lim >> 8);
-	lim |= (lim >> 16);
-#if (LUA_MAXUNSIGNED >> 31) >= 3
-	lim |= (lim >> 32); /* integer type has more than 32 bits */
-#endif
+	lua_Unsigned lim = projlimit(n);
 	lua_assert((lim & (lim + 1)) == 0 /* 'lim + 1' is a power of 2, */
 		&& lim >= n /* not smaller than 'n', */
 		&& (lim >> 1) < n); /* and it is the smallest one */
@@ -148,13 +257,16 @@ static lua_Unsigned project(lua_Unsigned ran, lua_Unsigned n,
 }
 
 
-static int math_random(lua_State *L)
+/*
+** Generate a value as 'math.random' does, from 'state', with the
+** arguments starting at index 'arg'.
+*/
+static int genrandom(lua_State *L, RanState *state, int arg)
 {
 	lua_Integer low, up;
 	lua_Unsigned p;
-	auto *state = static_cast<RanState *>(lua_touserdata(L, lua_upvalueindex(1)));
 	Rand64 rv = nextrand(state->s); /* next pseudo-random value */
-	switch (lua_gettop(L))
+	switch (lua_gettop(L) - arg + 1)
 	{
 		/* check number of arguments */
 		case 0: {
@@ -165,7 +277,7 @@ static int math_random(lua_State *L)
 		case 1: {
 			/* only upper limit */
 			low = 1;
-			up = luaL_checkinteger(L, 1);
+			up = luaL_checkinteger(L, arg);
 			if (up == 0)
 			{
 				/* single 0 as argument? */
@@ -176,14 +288,14 @@ static int math_random(lua_State *L)
 		}
 		case 2: {
 			/* lower and upper limits */
-			low = luaL_checkinteger(L, 1);
-			up = luaL_checkinteger(L, 2);
+			low = luaL_checkinteger(L, arg);
+			up = luaL_checkinteger(L, arg + 1);
 			break;
 		}
 		default: return luaL_error(L, "wrong number of arguments");
 	}
 	/* random integer in the interval [low, up] */
-	luaL_argcheck(L, low <= up, 1, "interval is empty");
+	luaL_argcheck(L, low <= up, arg, "interval is empty");
 	/* project random integer into the interval [0, up - low] */
 	p = project(I2UInt(rv), (lua_Unsigned) up - (lua_Unsigned) low, state);
 	lua_pushinteger(L, p + (lua_Unsigned) low);
@@ -191,6 +303,190 @@ static int math_random(lua_State *L)
 }
 
 
+static int math_random(lua_State *L)
+{
+	auto *state = static_cast<RanState *>(lua_touserdata(L, lua_upvalueindex(1)));
+	return genrandom(L, state, 1);
+}
+
+
+/*
+** What 'randomfill' should produce: floats in [0,1) when 'isfloat',
+** otherwise integers in [low, low + range], projected as in 'project'
+** with 'lim' = projlimit(range).
+*/
+typedef struct
+{
+	int isfloat;
+	lua_Unsigned low;
+	lua_Unsigned range;
+	lua_Unsigned lim;
+} FillSpec;
+
+
+/*
+** Produce the next value from 'ran', or return 0 if 'ran' is out of the
+** interval and has to be dropped (the next raw value is tried instead,
+** same as 'project' does).
+*/
+static int fillvalue(const FillSpec *f, Rand64 ran, Rand64 *res)
+{
+	if (f->isfloat)
+	{
+		lua_Number v = I2d(ran);
+		memcpy(res, &v, sizeof(v));
+		return 1;
+	}
+	lua_Unsigned p = I2UInt(ran) & f->lim;
+	if (p > f->range)
+		return 0;
+	*res = Int2I(p + f->low);
+	return 1;
+}
+
+
+/*
+** Fill 'n' 8-byte values of 'buf', drawing raw values in blocks of 'W'
+** from the generators in 'state' (laid out as for 'nextrandn').
+*/
+template<int W>
+static void fillbuffer(Rand64 *state, const FillSpec *f, char *buf,
+							  lua_Integer n)
+{
+	/* step a local copy, as writes to the buffer could alias the state */
+	Rand64 local[4 * W];
+	memcpy(local, state, sizeof(local));
+	Rand64 block[W];
+	lua_Integer i = 0;
+	if (f->isfloat || f->lim == f->range)
+	{
+		/* nothing gets dropped, so whole blocks go straight in */
+		for (; n - i >= W; i += W)
+		{
+			Rand64 v[W] {}; /* every entry gets set, but compilers cannot tell */
+			nextrandn<W>(local, block);
+			for (int k = 0; k < W; k++)
+				fillvalue(f, block[k], &v[k]);
+			memcpy(buf + i * sizeof(Rand64), v, sizeof(v));
+		}
+	}
+	while (i < n)
+	{
+		nextrandn<W>(local, block);
+		for (int k = 0; k < W && i < n; k++)
+		{
+			Rand64 v;
+			if (fillvalue(f, block[k], &v))
+				memcpy(buf + i++ * sizeof(Rand64), &v, sizeof(v));
+		}
+	}
+	memcpy(state, local, sizeof(local));
+}
+
+
+/*
+** Fill a table or buffer with 'n' random values in one go, with the
+** arguments starting at index 'arg'. Arguments after the count work
+** like 'random': none gives floats in [0,1), 'm'
+** gives integers in [1, m] (or full integers when 'm' is 0) and 'l, m'
+** gives integers in [l, m]. Tables get the values at 1..n; buffers get
+** them as 8-byte native 'lua_Number's or 'lua_Integer's from their start.
+*/
+template<int W>
+static int fillrandom(lua_State *L, Rand64 *state, int arg)
+{
+	lua_Integer n = luaL_checkinteger(L, arg + 1);
+	luaL_argcheck(L, n >= 0, arg + 1, "count is negative");
+	size_t size;
+	auto *buf = static_cast<char *>(coyote_tobuffer(L, arg, &size));
+	if (buf == NULL)
+		luaL_checktype(L, arg, LUA_TTABLE);
+	else
+		luaL_argcheck(L, (lua_Unsigned) n <= size / sizeof(Rand64), arg + 1,
+						  "buffer too small");
+	FillSpec f = {0, 1, 0, 0};
+	switch (lua_gettop(L) - arg + 1)
+	{
+		case 2: {
+			f.isfloat = 1;
+			break;
+		}
+		case 3: {
+			lua_Integer up = luaL_checkinteger(L, arg + 2);
+			if (up == 0)
+			{
+				/* full random integers */
+				f.low = 0;
+				f.range = ~(lua_Unsigned) 0;
+			}
+			else
+			{
+				luaL_argcheck(L, 1 <= up, arg + 2, "interval is empty");
+				f.range = (lua_Unsigned) up - 1;
+			}
+			break;
+		}
+		case 4: {
+			lua_Integer low = luaL_checkinteger(L, arg + 2);
+			lua_Integer up = luaL_checkinteger(L, arg + 3);
+			luaL_argcheck(L, low <= up, arg + 2, "interval is empty");
+			f.low = (lua_Unsigned) low;
+			f.range = (lua_Unsigned) up - (lua_Unsigned) low;
+			break;
+		}
+		default: return luaL_error(L, "wrong number of arguments");
+	}
+	f.lim = projlimit(f.range);
+	if (buf != NULL)
+		fillbuffer<W>(state, &f, buf, n);
+	else
+	{
+		Rand64 block[W];
+		lua_Integer i = 0;
+		while (i < n)
+		{
+			nextrandn<W>(state, block);
+			for (int k = 0; k < W && i < n; k++)
+			{
+				Rand64 v;
+				if (!fillvalue(&f, block[k], &v))
+					continue;
+				if (f.isfloat)
+				{
+					lua_Number d;
+					memcpy(&d, &v, sizeof(d));
+					lua_pushnumber(L, d);
+				}
+				else
+					lua_pushinteger(L, (lua_Integer) I2UInt(v));
+				lua_rawseti(L, arg, ++i);
+			}
+		}
+	}
+	lua_settop(L, arg);
+	return 1;
+}
+
+
+static int math_randomfill(lua_State *L)
+{
+	auto *state = static_cast<RanState *>(lua_touserdata(L, lua_upvalueindex(1)));
+	return fillrandom<1>(L, state->s, 1);
+}
+
+
+/*
+** Same as 'randomfill', but the values come from four lanes stepped
+** together, four at a time. Its sequence is separate from the one
+** 'random' and 'randomfill' give.
+*/
+static int math_randomfill4(lua_State *L)
+{
+	auto *state = static_cast<RanState *>(lua_touserdata(L, lua_upvalueindex(1)));
+	return fillrandom<4>(L, &state->lanes[0][0], 1);
+}
+
+
 static void setseed(lua_State *L, Rand64 *state,
 							lua_Unsigned n1, lua_Unsigned n2)
 {
@@ -215,29 +511,221 @@ static void randseed(lua_State *L, RanState *state)
 	lua_Unsigned seed1 = (lua_Unsigned) time(NULL);
 	lua_Unsigned seed2 = (lua_Unsigned) (size_t) L;
 	setseed(L, state->s, seed1, seed2);
+	seedlanes(state);
 }
 
 
-static int math_randomseed(lua_State *L)
+/*
+** Reseed 'state' as 'math.randomseed' does, with the arguments starting
+** at index 'arg'.
+*/
+static int seedrandom(lua_State *L, RanState *state, int arg)
 {
-	RanState *state = (RanState *) lua_touserdata(L, lua_upvalueindex(1));
-	if (lua_isnone(L, 1))
+	if (lua_isnone(L, arg))
 	{
 		randseed(L, state);
 	}
 	else
+	{
+		lua_Integer n1 = luaL_checkinteger(L, arg);
+		lua_Integer n2 = luaL_optinteger(L, arg + 1, 0);
+		setseed(L, state->s, n1, n2);
+		seedlanes(state);
+	}
+	return 2; /* return seeds */
+}
+
+
+static int math_randomseed(lua_State *L)
+{
+	RanState *state = (RanState *) lua_touserdata(L, lua_upvalueindex(1));
+	return seedrandom(L, state, 1);
+}
+
+
+/*
+** {==================================================================
+** Generator objects: each one has its own state, so separate workers
+** or coroutines can each get their own reproducible sequence.
+** ===================================================================
+*/
+
+#define COYOTE_RANDOM_REG "RANDOM*"
+
+#define checkrandom(L)	((RanState *) luaL_checkudata(L, 1, COYOTE_RANDOM_REG))
+
+
+static RanState *newrandom(lua_State *L)
+{
+	auto *state = lua_newuserdatauvt<RanState>(L, 0);
+	luaL_setmetatable(L, COYOTE_RANDOM_REG);
+	return state;
+}
+
+
+/*
+** Seed 'state' from two values of the library generator, which is
+** the first upvalue. Objects made without a seed then still follow
+** 'math.randomseed' and don't collide with each other.
+*/
+static void splitseed(lua_State *L, RanState *state)
+{
+	auto *lib = static_cast<RanState *>(lua_touserdata(L, lua_upvalueindex(1)));
+	lua_Unsigned n1 = I2UInt(nextrand(lib->s));
+	lua_Unsigned n2 = I2UInt(nextrand(lib->s));
+	setseed(L, state->s, n1, n2);
+	lua_pop(L, 2); /* remove pushed seeds */
+	seedlanes(state);
+}
+
+
+/*
+** math.newrandom([n1 [, n2]]): a generator seeded as 'math.randomseed'
+** would be, or split off the library generator when no seed is given.
+*/
+static int math_newrandom(lua_State *L)
+{
+	if (lua_isnone(L, 1))
+		splitseed(L, newrandom(L));
+	else
 	{
 		lua_Integer n1 = luaL_checkinteger(L, 1);
 		lua_Integer n2 = luaL_optinteger(L, 2, 0);
+		RanState *state = newrandom(L);
 		setseed(L, state->s, n1, n2);
+		lua_pop(L, 2); /* remove pushed seeds */
+		seedlanes(state);
 	}
-	return 2; /* return seeds */
+	return 1;
 }
 
 
+static int rand_random(lua_State *L)
+{
+	return genrandom(L, checkrandom(L), 2);
+}
+
+
+static int rand_seed(lua_State *L)
+{
+	return seedrandom(L, checkrandom(L), 2);
+}
+
+
+static int rand_fill(lua_State *L)
+{
+	return fillrandom<1>(L, checkrandom(L)->s, 2);
+}
+
+
+static int rand_fill4(lua_State *L)
+{
+	return fillrandom<4>(L, &checkrandom(L)->lanes[0][0], 2);
+}
+
+
+/*
+** Most jumps one call makes. Each costs 256 steps of the generator, so
+** this keeps a call to a fraction of a second; one 'longjump' goes as
+** far as 2^64 'jump's.
+*/
+#define MAXJUMPS	(1 << 16)
+
+
+/*
+** Jump the generator 'n' (default 1, at most MAXJUMPS) times ahead,
+** returning it.
+*/
+static int dojump(lua_State *L, const Rand64 *poly)
+{
+	RanState *state = checkrandom(L);
+	lua_Integer n = luaL_optinteger(L, 2, 1);
+	luaL_argcheck(L, n >= 0, 2, "jump count is negative");
+	luaL_argcheck(L, n <= MAXJUMPS, 2, "jump count too large");
+	while (n-- > 0)
+		jumpstate(state->s, poly);
+	seedlanes(state);
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+static int rand_jump(lua_State *L)
+{
+	return dojump(L, jumppoly);
+}
+
+
+static int rand_longjump(lua_State *L)
+{
+	return dojump(L, longjumppoly);
+}
+
+
+static int rand_clone(lua_State *L)
+{
+	RanState *state = checkrandom(L);
+	*newrandom(L) = *state;
+	return 1;
+}
+
+
+static int rand_tostring(lua_State *L)
+{
+	lua_pushfstring(L, "random (%p)", checkrandom(L));
+	return 1;
+}
+
+
+/*
+** methods for generator objects
+*/
+static const luaL_Reg randmeth[] = {
+	{"random", rand_random},
+	{"seed", rand_seed},
+	{"fill", rand_fill},
+	{"fill4", rand_fill4},
+	{"jump", rand_jump},
+	{"longjump", rand_longjump},
+	{"clone", rand_clone},
+	luaL_Reg::end(),
+};
+
+
+/*
+** metamethods for generator objects
+*/
+static const luaL_Reg randmetameth[] = {
+	{"__index", NULL}, /* placeholder */
+	{"__tostring", rand_tostring},
+	luaL_Reg::end(),
+};
+
+
+/*
+** Create the metatable of generator objects. Its methods get the
+** library state, on top of the stack, as their upvalue.
+*/
+static void createrandmeta(lua_State *L)
+{
+	luaL_newmetatable(L, COYOTE_RANDOM_REG);
+	luaL_setfuncs(L, randmetameth, 0);
+	luaL_newlibtable(L, randmeth);
+	lua_pushvalue(L, -3); /* library state */
+	luaL_setfuncs(L, randmeth, 1);
+	lua_setfield(L, -2, "__index"); /* metatable.__index = method table */
+	lua_pop(L, 1); /* pop metatable */
+}
+
+/* }================================================================== */
+
+
 static const luaL_Reg randfuncs[] = {
 	{"random", math_random},
 	{"randomseed", math_randomseed},
+	{"randomfill", math_randomfill},
+	{"randomfill4", math_randomfill4},
+	{"newrandom", math_newrandom},
 	luaL_Reg::end(),
 };
 
@@ -250,6 +738,7 @@ static void setrandfunc(lua_State *L)
 	auto *state = lua_newuserdatauvt<RanState>(L, 0);
 	randseed(L, state); /* initialize with a "random" seed */
 	lua_pop(L, 2); /* remove pushed seeds */
+	createrandmeta(L);
 	luaL_setfuncs(L, randfuncs, 1);
 }
 
@@ -10,9 +10,15 @@
 #include "lprefix.hpp"
 
 
+#include <bit>
 #include <locale.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LUAI_LEXSSE2
+#endif
+
 #include "lua.hpp"
 
 #include "lctype.hpp"
@@ -62,6 +68,82 @@ static void save(LexState *ls, int c)
 }
 
 
+/*
+** {======================================================
+** Block scanning: while 'current' is not EOZ, it is the last character
+** taken from the ZIO buffer, so it and the rest of that buffer are a
+** contiguous block. Runs of characters inside it are scanned and saved
+** at once; scans stop at the end of the block, for the usual
+** one-character path to go on from the next one.
+** =======================================================
+*/
+
+/* 'current' and the characters after it still in the ZIO buffer */
+static const char *curblock(LexState *ls, size_t *n)
+{
+	lua_assert(ls->current != EOZ && ls->z->p[-1] == cast_char(ls->current));
+	*n = ls->z->n + 1;
+	return ls->z->p - 1;
+}
+
+
+/* move 'k' (> 0) characters forward in the current block */
+static void advance(LexState *ls, size_t k)
+{
+	ls->z->p += k - 1;
+	ls->z->n -= k - 1;
+	ls->next();
+}
+
+
+static void saveblock(LexState *ls, const char *s, size_t n)
+{
+	Mbuffer *b = ls->buff;
+	if (n > b->sizebuffer() - b->bufflen())
+	{
+		size_t newsize = b->sizebuffer();
+		do
+		{
+			if (newsize >= MAX_SIZE / 2)
+				lexerror(ls, "lexical element too long", 0);
+			newsize *= 2;
+		} while (n > newsize - b->bufflen());
+		b->resizebuffer(ls->L, newsize);
+	}
+	memcpy(b->buffer + b->n, s, n);
+	b->n += n;
+}
+
+
+/* length of the prefix of 's' (with 'n' chars) without 'a', 'b', 'c' or 'd' */
+static size_t spanwithout(const char *s, size_t n, char a, char b, char c, char d)
+{
+	size_t i = 0;
+#if defined(LUAI_LEXSSE2)
+	const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+	const __m128i vc = _mm_set1_epi8(c), vd = _mm_set1_epi8(d);
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)),
+										 _mm_or_si128(_mm_cmpeq_epi8(x, vc), _mm_cmpeq_epi8(x, vd)));
+		unsigned mask = cast_uint(_mm_movemask_epi8(m));
+		if (mask != 0)
+			return i + std::countr_zero(mask);
+	}
+#endif
+	for (; i < n; i++)
+	{
+		char x = s[i];
+		if (x == a || x == b || x == c || x == d)
+			break;
+	}
+	return i;
+}
+
+/* }====================================================== */
+
+
 void luaX_init(lua_State *L)
 {
 	/* create env name */
@@ -226,6 +308,69 @@ static int check_next2(LexState *ls, const char *set)
 }
 
 
+/*
+** Fast path for decimal numerals wholly in the current block, scanned
+** as 'read_numeral' would do. The numeral is saved at once, as error
+** messages quote it; small integers are then converted right away, and
+** others by 'luaO_str2num'. Returns 0, having consumed nothing, for
+** 'read_numeral' to handle the numeral itself.
+*/
+static int read_decimal(LexState *ls, SemInfo *seminfo)
+{
+	size_t n;
+	const char *s = curblock(ls, &n);
+	size_t i = 1;
+	bool digits = true; /* only decimal digits so far? */
+	if (s[0] == '0' && n > 1 && (s[1] == 'x' || s[1] == 'X'))
+		return 0; /* hexadecimal */
+	for (;;)
+	{
+		if (i >= n)
+			return 0; /* may go on in the next block */
+		char c = s[i];
+		if (c == 'e' || c == 'E')
+		{
+			digits = false;
+			if (++i < n && (s[i] == '+' || s[i] == '-'))
+				i++;
+		}
+		else if (lisdigit(cast_uchar(c)))
+			i++;
+		else if (lisxdigit(cast_uchar(c)) || c == '.')
+		{
+			digits = false;
+			i++;
+		}
+		else if (lislalpha(cast_uchar(c)))
+			return 0; /* touching a letter: an error, the usual way */
+		else
+			break;
+	}
+	saveblock(ls, s, i);
+	if (digits && i <= 18) /* cannot overflow? */
+	{
+		lua_Integer v = 0;
+		for (size_t j = 0; j < i; j++)
+			v = v * 10 + (s[j] - '0');
+		advance(ls, i);
+		seminfo->i = v;
+		return TK_INT;
+	}
+	TValue obj;
+	save(ls, '\0');
+	advance(ls, i);
+	if (luaO_str2num(ls->buff->getbuffer(), &obj) == 0) /* format error? */
+		lexerror(ls, "malformed number", TK_FLT);
+	if (ttisinteger(&obj))
+	{
+		seminfo->i = ivalue(&obj);
+		return TK_INT;
+	}
+	seminfo->r = fltvalue(&obj);
+	return TK_FLT;
+}
+
+
 /* LUA_NUMBER */
 /*
 ** This function is quite liberal in what it accepts, as 'luaO_str2num'
@@ -245,6 +390,12 @@ static int read_numeral(LexState *ls, SemInfo *seminfo)
 	const char *expo = "Ee";
 	int first = ls->current;
 	lua_assert(lisdigit(ls->current));
+	if (ls->buff->bufflen() == 0) /* no initial dot? */
+	{
+		int token = read_decimal(ls, seminfo);
+		if (token != 0)
+			return token;
+	}
 	save_and_next(ls);
 	if (first == '0' && check_next2(ls, "xX")) /* hexadecimal? */
 		expo = "Pp";
@@ -499,8 +650,15 @@ static void read_string(LexState *ls, int del, SemInfo *seminfo)
 			no_save:
 				break;
 			}
-			default:
-				save_and_next(ls);
+			default: {
+				/* save the run of plain characters at once */
+				size_t n;
+				const char *str = curblock(ls, &n);
+				size_t i = spanwithout(str, n, cast_char(del), '\\', '\n', '\r');
+				lua_assert(i > 0);
+				saveblock(ls, str, i);
+				advance(ls, i);
+			}
 		}
 	}
 	save_and_next(ls); /* skip delimiter */
@@ -526,8 +684,13 @@ static int llex(LexState *ls, SemInfo *seminfo)
 			case '\f':
 			case '\t':
 			case '\v': {
-				/* spaces */
-				ls->next();
+				/* spaces; skip a run of blanks at once */
+				size_t n;
+				const char *str = curblock(ls, &n);
+				size_t i = 1;
+				while (i < n && (str[i] == ' ' || str[i] == '\t'))
+					i++;
+				advance(ls, i);
 				break;
 			}
 			case '-': {
@@ -550,7 +713,12 @@ static int llex(LexState *ls, SemInfo *seminfo)
 				}
 				/* else short comment */
 				while (!ls->currIsNewline() && ls->current != EOZ)
-					ls->next(); /* skip until end of line (or end of file) */
+				{
+					/* skip until end of line (or end of file) */
+					size_t n;
+					const char *str = curblock(ls, &n);
+					advance(ls, spanwithout(str, n, '\n', '\r', '\n', '\r'));
+				}
 				break;
 			}
 			case '[': {
@@ -639,7 +807,14 @@ static int llex(LexState *ls, SemInfo *seminfo)
 					TString *ts;
 					do
 					{
-						save_and_next(ls);
+						/* save the run of name characters at once */
+						size_t n;
+						const char *str = curblock(ls, &n);
+						size_t i = 1;
+						while (i < n && lislalnum(cast_uchar(str[i])))
+							i++;
+						saveblock(ls, str, i);
+						advance(ls, i);
 					} while (lislalnum(ls->current));
 					ts = luaX_newstring(ls, ls->buff->getbuffer(),
 												ls->buff->bufflen());
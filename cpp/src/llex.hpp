@@ -109,6 +109,9 @@ struct LexState
 	struct Dyndata *dyd; /* dynamic structures used by the parser */
 	TString *source; /* current source name */
 	TString *envn; /* environment variable name */
+	int ndecl; /* number of local declarations seen so far */
+	lu_byte optlevel; /* optimization level (see 'luaY_parser') */
+	lu_byte survey; /* first pass, only recording assignments? */
 
 	auto next () -> void
 	{
@@ -305,6 +305,15 @@ typedef l_uint32 Instruction;
 #endif
 
 
+/*
+** Maximum number of dead threads a state keeps for 'lua_newthread' to
+** reuse instead of allocating new ones (see 'lua_setthreadcache').
+*/
+#if !defined(LUAI_THREADCACHE)
+#define LUAI_THREADCACHE	64
+#endif
+
+
 /*
 ** macros that are executed whenever program enters the Lua core
 ** ('lua_lock') and leaves the core ('lua_unlock')
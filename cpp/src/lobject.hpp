@@ -599,6 +599,9 @@ typedef struct Proto
 	AbsLineInfo *abslineinfo; /* idem */
 	LocVar *locvars; /* information about local variables (debug information) */
 	TString *source; /* used for debug information */
+	struct ChunkImage *image; /* 'code' and line info point into it, if not NULL */
+	int lazy; /* 1 + its index in 'image' while its body is not loaded, else 0 */
+	int lazydebug; /* idem, while its variable names are not loaded */
 	GCObject *gclist;
 } Proto;
 
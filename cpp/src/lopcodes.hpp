@@ -400,10 +400,13 @@ typedef enum {
 
 	/*	Ax	extra (larger) argument for previous opcode	*/
 	OP_EXTRAARG,
+
+	/*	A Bx	OP_FORLOOP with a step of 1 (see note)		*/
+	OP_FORLOOP1,
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_FORLOOP1) + 1)
 
 
 
@@ -458,6 +461,10 @@ typedef enum {
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) OP_FORLOOP1 closes a numerical loop whose step is the constant 1.
+  It is numbered after OP_EXTRAARG so that older binary chunks keep
+  their opcodes.
+
 ===========================================================================*/
 
 
@@ -94,6 +94,7 @@ static const char *const opnames[] = {
 	"VARARG",
 	"VARARGPREP",
 	"EXTRAARG",
+	"FORLOOP1",
 	NULL
 };
 
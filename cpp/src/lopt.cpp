@@ -0,0 +1,588 @@
+/*
+** $Id: lopt.c $
+** Optimizer for the bytecode of finished functions
+** See Copyright Notice in lua.h
+*/
+
+#define lopt_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "lua.hpp"
+
+#include "ldebug.hpp"
+#include "lmem.hpp"
+#include "lobject.hpp"
+#include "lopcodes.hpp"
+#include "lopt.hpp"
+#include "lparser.hpp"
+#include "lstate.hpp"
+
+
+/*
+** The code generator works in a single pass and never sees a function
+** as a whole. This pass runs over a finished function and the ones
+** nested in it. It
+** - hoists reads of read-only upvalues (locals of enclosing functions
+**   declared '<const>' or '<close>') out of loops, into a new register,
+**   leaving field reads through them as GETFIELDs on that register;
+** - removes MOVEs and LOADNILs that store what the register already
+**   holds, tracking copies and nils along each basic block;
+** and then lays out again the code, its jumps, its line information and
+** the ranges of its local variables.
+**
+** Functions whose code lives in an image are left alone.
+*/
+
+
+/* an instruction being optimized */
+struct OptInstr
+{
+	Instruction i;
+	int line; /* source line */
+	int dest; /* index of jump destination (see 'jumpdest'), or -1 */
+	bool dead; /* to be removed */
+};
+
+typedef std::vector<OptInstr> OptCode;
+
+
+/*
+** Destination of a jump instruction at 'pc', as the code generator
+** patches it: for OP_FORPREP that is its OP_FORLOOP, the loop being
+** skipped from the instruction after it. -1 for other instructions.
+*/
+static int jumpdest(Instruction i, int pc)
+{
+	switch (GET_OPCODE(i))
+	{
+		case OP_JMP:
+			return pc + 1 + GETARG_sJ(i);
+		case OP_FORPREP:
+		case OP_TFORPREP:
+			return pc + 1 + GETARG_Bx(i);
+		case OP_FORLOOP:
+		case OP_FORLOOP1:
+		case OP_TFORLOOP:
+			return pc + 1 - GETARG_Bx(i);
+		default:
+			return -1;
+	}
+}
+
+
+/* where control goes when instruction 'oi' jumps */
+static int landing(const OptInstr &oi)
+{
+	if (oi.dest >= 0 && GET_OPCODE(oi.i) == OP_FORPREP)
+		return oi.dest + 1;
+	return oi.dest;
+}
+
+
+/*
+** Encode destination 'dest' in the jump instruction 'i' at 'pc'.
+** Returns false if it does not fit.
+*/
+static bool setjumpdest(Instruction *i, int pc, int dest)
+{
+	int offset = dest - (pc + 1);
+	switch (GET_OPCODE(*i))
+	{
+		case OP_JMP:
+			if (!(-OFFSET_sJ <= offset && offset <= MAXARG_sJ - OFFSET_sJ))
+				return false;
+			SETARG_sJ(*i, offset);
+			return true;
+		case OP_FORLOOP:
+		case OP_FORLOOP1:
+		case OP_TFORLOOP:
+			offset = -offset;
+			/* FALLTHROUGH */
+		case OP_FORPREP:
+		case OP_TFORPREP:
+			if (offset < 0 || offset > MAXARG_Bx)
+				return false;
+			SETARG_Bx(*i, offset);
+			return true;
+		default:
+			return true;
+	}
+}
+
+
+static void decode(const Proto *f, OptCode &code)
+{
+	int line = f->linedefined;
+	int nabs = 0;
+	code.resize(f->sizecode);
+	for (int pc = 0; pc < f->sizecode; pc++)
+	{
+		OptInstr &oi = code[pc];
+		oi.i = f->code[pc];
+		if (f->sizelineinfo > 0)
+		{
+			if (f->lineinfo[pc] != ABSLINEINFO)
+				line += f->lineinfo[pc];
+			else
+			{
+				while (f->abslineinfo[nabs].pc < pc)
+					nabs++;
+				lua_assert(f->abslineinfo[nabs].pc == pc);
+				line = f->abslineinfo[nabs].line;
+			}
+		}
+		oi.line = line;
+		oi.dest = jumpdest(oi.i, pc);
+		oi.dead = false;
+	}
+}
+
+
+/*
+** {======================================================================
+** Hoisting of read-only upvalues
+** =======================================================================
+*/
+
+/*
+** Instructions that may let something run with 'L->top' below the end
+** of the frame (calls, collections), which could overwrite a register
+** above those the compiler allocated.
+*/
+static bool lowerstop(OpCode op)
+{
+	switch (op)
+	{
+		case OP_CALL:
+		case OP_TAILCALL:
+		case OP_TFORPREP:
+		case OP_TFORCALL:
+		case OP_VARARG:
+		case OP_CONCAT:
+		case OP_CLOSURE:
+		case OP_NEWTABLE:
+		case OP_SETLIST:
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+/*
+** Whether the loop in 'code[h..e]' (a back edge at 'e' jumps to 'h')
+** can get a preheader: it must be entered only through 'h', the
+** instruction before 'h' must not depend on what follows it, and
+** nothing inside may write above the compiler's registers.
+*/
+static bool hoistable(const OptCode &code, int h, int e)
+{
+	int n = static_cast<int>(code.size());
+	if (h > 0)
+	{
+		Instruction prev = code[h - 1].i;
+		OpCode op = GET_OPCODE(prev);
+		if (testTMode(op) || op == OP_LFALSESKIP || isOT(prev))
+			return false;
+	}
+	for (int s = h; s <= e; s++)
+		if (lowerstop(GET_OPCODE(code[s].i)))
+			return false;
+	for (int s = 0; s < n; s++)
+	{
+		int d = landing(code[s]);
+		if ((s < h || s > e) && h < d && d <= e)
+			return false; /* another entry */
+	}
+	return true;
+}
+
+
+/*
+** Replace, inside each outermost loop that allows it, the reads of
+** read-only upvalues (and of their fields) by reads from new registers
+** loaded once before the loop. Back edges keep going to the loop's
+** first instruction; other jumps there go to the new loads. Returns the
+** new number of registers.
+*/
+static int hoist(const Proto *f, OptCode &code, std::vector<int> &vars,
+					  int nregs)
+{
+	struct Load
+	{
+		int header; /* loop that needs it */
+		Instruction i;
+	};
+	int n = static_cast<int>(code.size());
+	std::vector<int> loopend(n, -1);
+	std::vector<int> loopof(n, -1); /* loop containing each instruction */
+	std::vector<int> reg(f->sizeupvalues);
+	std::vector<Load> loads;
+	for (int s = 0; s < n; s++)
+	{
+		OpCode op = GET_OPCODE(code[s].i);
+		int d = code[s].dest;
+		if ((op == OP_JMP || op == OP_FORLOOP || op == OP_FORLOOP1 ||
+			  op == OP_TFORLOOP) &&
+			 0 <= d && d <= s)
+			loopend[d] = std::max(loopend[d], s);
+	}
+	int last = -1; /* end of last loop done */
+	for (int h = 0; h < n; h++)
+	{
+		int e = loopend[h];
+		if (e < 0 || h <= last || !hoistable(code, h, e))
+			continue;
+		last = e; /* loops nested in this one are done too */
+		std::fill(reg.begin(), reg.end(), -1);
+		for (int s = h; s <= e; s++)
+		{
+			Instruction *i = &code[s].i;
+			OpCode op = GET_OPCODE(*i);
+			loopof[s] = h;
+			if ((op == OP_GETUPVAL || op == OP_GETTABUP) &&
+				 f->upvalues[GETARG_B(*i)].kind != VDKREG)
+			{
+				int u = GETARG_B(*i);
+				if (reg[u] < 0)
+				{
+					if (nregs + 1 >= MAXARG_A)
+						continue; /* no registers left */
+					reg[u] = nregs++;
+					loads.push_back({h, CREATE_ABCk(OP_GETUPVAL, reg[u], u, 0, 0)});
+				}
+				if (op == OP_GETUPVAL)
+					*i = CREATE_ABCk(OP_MOVE, GETARG_A(*i), reg[u], 0, 0);
+				else /* same field, from the register */
+					*i = CREATE_ABCk(OP_GETFIELD, GETARG_A(*i), reg[u], GETARG_C(*i), 0);
+			}
+		}
+	}
+	if (loads.empty())
+		return nregs;
+	OptCode out;
+	std::vector<int> pos(n + 1), entry(n + 1);
+	size_t next = 0;
+	out.reserve(n + loads.size());
+	for (int s = 0; s < n; s++)
+	{
+		entry[s] = static_cast<int>(out.size());
+		for (; next < loads.size() && loads[next].header == s; next++)
+			out.push_back({loads[next].i, code[s].line, -1, false});
+		pos[s] = static_cast<int>(out.size());
+		out.push_back(code[s]);
+	}
+	pos[n] = entry[n] = static_cast<int>(out.size());
+	for (int s = 0; s < n; s++)
+	{
+		int d = code[s].dest;
+		if (d >= 0)
+			out[pos[s]].dest = (loopof[s] == d) ? pos[d] : entry[d];
+	}
+	for (int &v : vars)
+		v = pos[v];
+	code.swap(out);
+	return nregs;
+}
+
+/* }====================================================================== */
+
+
+/*
+** {======================================================================
+** Redundant stores
+** =======================================================================
+*/
+
+/*
+** What is known about the registers at a point of a basic block.
+** Registers captured by closures can change behind the code's back,
+** so nothing is known about them.
+*/
+struct RegState
+{
+	std::vector<int> copyof; /* a register with the same value, or -1 */
+	std::vector<char> isnil;
+	std::vector<char> captured;
+
+	auto reset () -> void
+	{
+		std::fill(copyof.begin(), copyof.end(), -1);
+		std::fill(isnil.begin(), isnil.end(), 0);
+	}
+
+	auto kill (int r) -> void
+	{
+		copyof[r] = -1;
+		isnil[r] = 0;
+		for (int &c : copyof)
+			if (c == r)
+				c = -1;
+	}
+
+	/* registers from 'r' up, as a call leaves them */
+	auto killfrom (int r) -> void
+	{
+		for (size_t x = 0; x < copyof.size(); x++)
+		{
+			if (static_cast<int>(x) >= r)
+			{
+				copyof[x] = -1;
+				isnil[x] = 0;
+			}
+			else if (copyof[x] >= r)
+				copyof[x] = -1;
+		}
+	}
+
+	auto same (int a, int b) const -> bool
+	{
+		return !captured[a] && !captured[b] &&
+				 (a == b || copyof[a] == b || copyof[b] == a ||
+				  (isnil[a] && isnil[b]));
+	}
+
+	/* 'a' was just set to the value of 'b' */
+	auto copy (int a, int b) -> void
+	{
+		if (!captured[a] && !captured[b])
+		{
+			copyof[a] = b;
+			isnil[a] = isnil[b];
+		}
+	}
+
+	auto setnil (int r) -> void
+	{
+		if (!captured[r])
+			isnil[r] = 1;
+	}
+};
+
+
+/* instructions that may change every register from their A up */
+static bool writesfromA(OpCode op)
+{
+	switch (op)
+	{
+		case OP_CALL:
+		case OP_TAILCALL:
+		case OP_TFORCALL:
+		case OP_VARARG:
+		case OP_CONCAT:
+		case OP_SELF:
+		case OP_FORPREP:
+		case OP_FORLOOP:
+		case OP_FORLOOP1:
+		case OP_TFORPREP:
+		case OP_TFORLOOP:
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+static void dropstores(const Proto *f, OptCode &code, int nregs)
+{
+	int n = static_cast<int>(code.size());
+	std::vector<char> leader(n + 1, 0);
+	RegState rs;
+	rs.copyof.resize(nregs);
+	rs.isnil.resize(nregs);
+	rs.captured.assign(nregs, 0);
+	leader[0] = 1;
+	for (int s = 0; s < n; s++)
+	{
+		Instruction i = code[s].i;
+		OpCode op = GET_OPCODE(i);
+		int d = landing(code[s]);
+		if (d >= 0)
+			leader[d] = leader[s + 1] = 1;
+		else if (op == OP_RETURN || op == OP_RETURN0 || op == OP_RETURN1 ||
+					op == OP_TAILCALL)
+			leader[s + 1] = 1;
+		else if (testTMode(op) || op == OP_LFALSESKIP)
+			leader[std::min(s + 2, n)] = 1;
+		else if (op == OP_CLOSURE)
+		{
+			const Proto *p = f->p[GETARG_Bx(i)];
+			for (int u = 0; u < p->sizeupvalues; u++)
+				if (p->upvalues[u].instack)
+					rs.captured[p->upvalues[u].idx] = 1;
+		}
+	}
+	for (int s = 0; s < n; s++)
+	{
+		Instruction i = code[s].i;
+		OpCode op = GET_OPCODE(i);
+		int a = GETARG_A(i);
+		if (leader[s])
+			rs.reset();
+		if (op == OP_MOVE)
+		{
+			int b = GETARG_B(i);
+			if (rs.same(a, b))
+				code[s].dead = true;
+			else
+			{
+				rs.kill(a);
+				rs.copy(a, b);
+			}
+		}
+		else if (op == OP_LOADNIL)
+		{
+			int last = a + GETARG_B(i);
+			bool known = true;
+			for (int r = a; r <= last && known; r++)
+				known = !rs.captured[r] && rs.isnil[r];
+			if (known)
+				code[s].dead = true;
+			else
+			{
+				for (int r = a; r <= last; r++)
+				{
+					rs.kill(r);
+					rs.setnil(r);
+				}
+			}
+		}
+		else if (writesfromA(op))
+			rs.killfrom(a);
+		else if (testAMode(op))
+			rs.kill(a);
+	}
+}
+
+/* }====================================================================== */
+
+
+/*
+** Lay out 'code' in 'f', dropping dead instructions. Nothing changes
+** if some jump does not fit its instruction anymore.
+*/
+static void emit(lua_State *L, Proto *f, const OptCode &code,
+					  const std::vector<int> &vars, int nregs)
+{
+	int n = static_cast<int>(code.size());
+	std::vector<int> newpc(n + 1);
+	std::vector<Instruction> out;
+	std::vector<ls_byte> lines;
+	std::vector<AbsLineInfo> abslines;
+	int size = 0;
+	for (int s = 0; s < n; s++)
+	{
+		newpc[s] = size;
+		if (!code[s].dead)
+			size++;
+	}
+	newpc[n] = size;
+	out.reserve(size);
+	for (int s = 0; s < n; s++)
+	{
+		Instruction i = code[s].i;
+		if (code[s].dead)
+			continue;
+		if (code[s].dest >= 0 && !setjumpdest(&i, newpc[s], newpc[code[s].dest]))
+			return; /* keep the original code */
+		out.push_back(i);
+	}
+	if (f->sizelineinfo > 0)
+	{
+		int previousline = f->linedefined;
+		int iwthabs = 0;
+		for (int s = 0; s < n; s++)
+		{
+			if (code[s].dead)
+				continue;
+			int line = code[s].line;
+			int linedif = line - previousline;
+			if (std::abs(linedif) >= LIMLINEDIFF || iwthabs++ >= MAXIWTHABS)
+			{
+				abslines.push_back({newpc[s], line});
+				linedif = ABSLINEINFO;
+				iwthabs = 1;
+			}
+			lines.push_back(cast(ls_byte, linedif));
+			previousline = line;
+		}
+	}
+	Instruction *newcode = luaM::newvector<Instruction>(L, size);
+	ls_byte *newlines = NULL;
+	AbsLineInfo *newabs = NULL;
+	int nabs = static_cast<int>(abslines.size());
+	try
+	{
+		if (f->sizelineinfo > 0)
+		{
+			newlines = luaM::newvector<ls_byte>(L, size);
+			newabs = luaM::newvector<AbsLineInfo>(L, nabs);
+		}
+	}
+	catch (...)
+	{
+		luaM::freearray(L, newlines, (newlines != NULL) ? size : 0);
+		luaM::freearray(L, newcode, size);
+		throw;
+	}
+	std::copy(out.begin(), out.end(), newcode);
+	luaM::freearray(L, f->code, f->sizecode);
+	f->code = newcode;
+	f->sizecode = size;
+	if (f->sizelineinfo > 0)
+	{
+		std::copy(lines.begin(), lines.end(), newlines);
+		std::copy(abslines.begin(), abslines.end(), newabs);
+		luaM::freearray(L, f->lineinfo, f->sizelineinfo);
+		luaM::freearray(L, f->abslineinfo, f->sizeabslineinfo);
+		f->lineinfo = newlines;
+		f->sizelineinfo = size;
+		f->abslineinfo = newabs;
+		f->sizeabslineinfo = nabs;
+	}
+	for (int v = 0; v < f->sizelocvars; v++)
+	{
+		f->locvars[v].startpc = newpc[vars[2 * v]];
+		f->locvars[v].endpc = newpc[vars[2 * v + 1]];
+	}
+	f->maxstacksize = cast_byte(nregs);
+}
+
+
+static void optimizefunc(lua_State *L, Proto *f)
+{
+	OptCode code;
+	std::vector<int> vars; /* ranges of locals, as indices in 'code' */
+	int nregs = f->maxstacksize;
+	if (f->sizelineinfo > 0 && f->sizelineinfo != f->sizecode)
+		return; /* not as the code generator leaves it */
+	decode(f, code);
+	for (int v = 0; v < f->sizelocvars; v++)
+	{
+		vars.push_back(std::clamp(f->locvars[v].startpc, 0, f->sizecode));
+		vars.push_back(std::clamp(f->locvars[v].endpc, 0, f->sizecode));
+	}
+	nregs = hoist(f, code, vars, nregs);
+	dropstores(f, code, nregs);
+	emit(L, f, code, vars, nregs);
+}
+
+
+void luaK_optimize(lua_State *L, Proto *f)
+{
+	if (f->image != NULL)
+		return; /* code is not ours to change */
+	optimizefunc(L, f);
+	for (int i = 0; i < f->sizep; i++)
+	{
+		if (f->p[i] != NULL)
+			luaK_optimize(L, f->p[i]);
+	}
+}
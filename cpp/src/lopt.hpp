@@ -0,0 +1,16 @@
+/*
+** $Id: lopt.h $
+** Optimizer for the bytecode of finished functions
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lopt_h
+#define lopt_h
+
+#include "lobject.hpp"
+
+
+LUAI_FUNC void luaK_optimize(lua_State *L, Proto *f);
+
+
+#endif
@@ -229,6 +229,21 @@ static int new_localvar(LexState *ls, TString *name)
 	Vardesc *var = &dyd->actvar.arr[dyd->actvar.n++];
 	var->vd.kind = VDKREG; /* default */
 	var->vd.name = name;
+	var->vd.decl = ls->ndecl++;
+	if (ls->survey)
+	{
+		/* first pass: no assignment to this variable seen yet */
+		dyd->assigned.arr = luaM::growvector(
+			L,
+			dyd->assigned.arr,
+			dyd->assigned.n,
+			&dyd->assigned.size,
+			MAX_INT,
+			"local variables"
+		);
+		dyd->assigned.arr[dyd->assigned.n++] = 0;
+	}
+	lua_assert(var->vd.decl < dyd->assigned.n || ls->optlevel < 2);
 	return dyd->actvar.n - 1 - fs->firstlocal;
 }
 
@@ -304,6 +319,51 @@ static void init_var(FuncState *fs, expdesc *e, int vidx)
 }
 
 
+/*
+** Return the regular variable of function 'fs' stored in register
+** 'ridx', if there is one.
+*/
+static Vardesc *regvardesc(FuncState *fs, int ridx)
+{
+	int i;
+	for (i = fs->nactvar - 1; i >= 0; i--)
+	{
+		Vardesc *vd = getlocalvardesc(fs, i);
+		if (vd->vd.kind != RDKCTC && vd->vd.ridx == ridx)
+			return vd;
+	}
+	return NULL;
+}
+
+
+/*
+** During the survey pass of the optimizer, record that the variable
+** described by 'e' is assigned. An upvalue is followed back to the
+** local variable it refers to in an enclosing function.
+*/
+static void markassigned(LexState *ls, expdesc *e)
+{
+	FuncState *fs = ls->fs;
+	Vardesc *var = NULL;
+	if (e->k == VLOCAL)
+		var = getlocalvardesc(fs, e->u.var.vidx);
+	else if (e->k == VUPVAL)
+	{
+		Upvaldesc *up = &fs->f->upvalues[e->u.info];
+		while (!up->instack)
+		{
+			/* upvalue of an upvalue */
+			fs = fs->prev;
+			up = &fs->f->upvalues[up->idx];
+		}
+		if (fs->prev != NULL) /* not the main '_ENV'? */
+			var = regvardesc(fs->prev, up->idx);
+	}
+	if (var != NULL)
+		ls->dyd->assigned.arr[var->vd.decl] = 1;
+}
+
+
 /*
 ** Raises an error if variable described by 'e' is read only
 */
@@ -338,6 +398,8 @@ static void check_readonly(LexState *ls, expdesc *e)
 														"attempt to assign to const variable '%s'", getstr(varname));
 		luaK_semerror(ls, msg); /* error */
 	}
+	if (ls->survey)
+		markassigned(ls, e);
 }
 
 
@@ -1728,19 +1790,26 @@ static void fixforjump(FuncState *fs, int pc, int dest, int back)
 }
 
 
+/* kinds of 'for' loops */
+#define FORNUM		0  /* numerical */
+#define FORGEN		1  /* generic */
+#define FORNUM1		2  /* numerical with a constant step of 1 */
+
+
 /*
 ** Generate code for a 'for' loop.
 */
-static void forbody(LexState *ls, int base, int line, int nvars, int isgen)
+static void forbody(LexState *ls, int base, int line, int nvars, int kind)
 {
 	/* forbody -> DO block */
-	static const OpCode forprep[2] = {OP_FORPREP, OP_TFORPREP};
-	static const OpCode forloop[2] = {OP_FORLOOP, OP_TFORLOOP};
+	static const OpCode forprep[3] = {OP_FORPREP, OP_TFORPREP, OP_FORPREP};
+	static const OpCode forloop[3] = {OP_FORLOOP, OP_TFORLOOP, OP_FORLOOP1};
 	BlockCnt bl;
 	FuncState *fs = ls->fs;
+	int isgen = (kind == FORGEN);
 	int prep, endfor;
 	checknext(ls, TK_DO);
-	prep = luaK_codeABx(fs, forprep[isgen], base, 0);
+	prep = luaK_codeABx(fs, forprep[kind], base, 0);
 	enterblock(fs, &bl, 0); /* scope for declared variables */
 	adjustlocalvars(ls, nvars);
 	luaK_reserveregs(fs, nvars);
@@ -1753,7 +1822,7 @@ static void forbody(LexState *ls, int base, int line, int nvars, int isgen)
 		luaK_codeABC(fs, OP_TFORCALL, base, 0, nvars);
 		luaK_fixline(fs, line);
 	}
-	endfor = luaK_codeABx(fs, forloop[isgen], base, 0);
+	endfor = luaK_codeABx(fs, forloop[kind], base, 0);
 	fixforjump(fs, endfor, prep + 1, 1);
 	luaK_fixline(fs, line);
 }
@@ -1764,6 +1833,7 @@ static void fornum(LexState *ls, TString *varname, int line)
 	/* fornum -> NAME = exp,exp[,exp] forbody */
 	FuncState *fs = ls->fs;
 	int base = fs->freereg;
+	int kind = FORNUM1; /* until a step other than 1 is given */
 	new_localvarliteral(ls, "(for state)");
 	new_localvarliteral(ls, "(for state)");
 	new_localvarliteral(ls, "(for state)");
@@ -1773,7 +1843,14 @@ static void fornum(LexState *ls, TString *varname, int line)
 	checknext(ls, ',');
 	exp1(ls); /* limit */
 	if (testnext(ls, ','))
-		exp1(ls); /* optional step */
+	{
+		/* optional step */
+		expdesc e;
+		expr(ls, &e);
+		if (!(e.k == VKINT && e.u.ival == 1))
+			kind = FORNUM;
+		luaK_exp2nextreg(fs, &e);
+	}
 	else
 	{
 		/* default step = 1 */
@@ -1781,7 +1858,7 @@ static void fornum(LexState *ls, TString *varname, int line)
 		luaK_reserveregs(fs, 1);
 	}
 	adjustlocalvars(ls, 3); /* control variables */
-	forbody(ls, base, line, 1, 0);
+	forbody(ls, base, line, 1, kind);
 }
 
 
@@ -1811,7 +1888,7 @@ static void forlist(LexState *ls, TString *indexname)
 	adjustlocalvars(ls, 4); /* control variables */
 	marktobeclosed(fs); /* last control var. must be closed */
 	luaK_checkstack(fs, 3); /* extra space to call generator */
-	forbody(ls, base, line, nvars - 4, 1);
+	forbody(ls, base, line, nvars - 4, FORGEN);
 }
 
 
@@ -1838,13 +1915,104 @@ static void forstat(LexState *ls, int line)
 }
 
 
-static void test_then_block(LexState *ls, int *escapelist)
+/*
+** {======================================================================
+** Unreachable code (optimization level 1 and above)
+** =======================================================================
+*/
+
+/* code-generation state of a function at a given point */
+typedef struct CodeMark
+{
+	int pc;
+	int previousline;
+	int nabslineinfo;
+	int np;
+	int ngoto;
+	short ndebugvars;
+	lu_byte iwthabs;
+} CodeMark;
+
+
+static void markcode(FuncState *fs, CodeMark *m)
+{
+	m->pc = fs->pc;
+	m->previousline = fs->previousline;
+	m->nabslineinfo = fs->nabslineinfo;
+	m->np = fs->np;
+	m->ngoto = fs->ls->dyd->gt.n;
+	m->ndebugvars = fs->ndebugvars;
+	m->iwthabs = fs->iwthabs;
+}
+
+
+/*
+** Discard everything generated since mark 'm'. The discarded code was
+** parsed as a sequence of complete blocks, so its labels and locals
+** are already gone. Gotos still pending from there ('break' included)
+** stay in the list, so that they are checked as usual, but without a
+** jump to patch. Constants and upvalues created there are kept, as
+** other code may already share them.
+*/
+static void dropcode(FuncState *fs, const CodeMark *m)
+{
+	Labellist *gl = &fs->ls->dyd->gt;
+	int i;
+	lua_assert(fs->pc >= m->pc);
+	for (i = m->ngoto; i < gl->n; i++)
+		gl->arr[i].pc = NO_JUMP;
+	fs->pc = m->pc;
+	fs->previousline = m->previousline;
+	fs->nabslineinfo = m->nabslineinfo;
+	fs->np = m->np;
+	fs->ndebugvars = m->ndebugvars;
+	fs->iwthabs = m->iwthabs;
+	fs->lasttarget = fs->pc; /* do not merge with code before the gap */
+}
+
+
+/*
+** Return the truth value of condition 'v' when it is known at compile
+** time (1 for true, 0 for false), or -1 otherwise. Always -1 when not
+** optimizing.
+*/
+static int condvalue(FuncState *fs, expdesc *v)
+{
+	if (fs->ls->optlevel == 0 || v->t != NO_JUMP || v->f != NO_JUMP)
+		return -1;
+	if (v->k == VCONST)
+		luaK_dischargevars(fs, v); /* get its value */
+	switch (v->k)
+	{
+		case VNIL:
+		case VFALSE:
+			return 0;
+		case VTRUE:
+		case VK:
+		case VKFLT:
+		case VKINT:
+		case VKSTR:
+			return 1;
+		default:
+			return -1;
+	}
+}
+
+/* }====================================================================== */
+
+
+/*
+** Returns true if the condition is known to be true, so that any
+** following 'elseif'/'else' parts are unreachable.
+*/
+static int test_then_block(LexState *ls, int *escapelist)
 {
 	/* test_then_block -> [IF | ELSEIF] cond THEN block */
 	BlockCnt bl;
 	FuncState *fs = ls->fs;
 	expdesc v;
 	int jf; /* instruction to skip 'then' code (if condition is false) */
+	int cond = -1; /* truth value of the condition, if known */
 	luaX_next(ls); /* skip IF or ELSEIF */
 	expr(ls, &v); /* read condition */
 	checknext(ls, TK_THEN);
@@ -1863,11 +2031,22 @@ static void test_then_block(LexState *ls, int *escapelist)
 		{
 			/* jump is the entire block? */
 			leaveblock(fs);
-			return; /* and that is it */
+			return 0; /* and that is it */
 		}
 		else /* must skip over 'then' part if condition is false */
 			jf = luaK_jump(fs);
 	}
+	else if ((cond = condvalue(fs, &v)) == 0)
+	{
+		/* 'then' part is unreachable */
+		CodeMark m;
+		markcode(fs, &m);
+		enterblock(fs, &bl, 0);
+		statlist(ls);
+		leaveblock(fs);
+		dropcode(fs, &m);
+		return 0;
+	}
 	else
 	{
 		/* regular case (not a break) */
@@ -1877,10 +2056,11 @@ static void test_then_block(LexState *ls, int *escapelist)
 	}
 	statlist(ls); /* 'then' part */
 	leaveblock(fs);
-	if (ls->t.token == TK_ELSE ||
-		ls->t.token == TK_ELSEIF) /* followed by 'else'/'elseif'? */
+	if (cond != 1 && (ls->t.token == TK_ELSE ||
+		ls->t.token == TK_ELSEIF)) /* followed by 'else'/'elseif'? */
 		luaK_concat(fs, escapelist, luaK_jump(fs)); /* must jump over it */
 	luaK_patchtohere(fs, jf);
+	return (cond == 1);
 }
 
 
@@ -1889,10 +2069,23 @@ static void ifstat(LexState *ls, int line)
 	/* ifstat -> IF cond THEN block {ELSEIF cond THEN block} [ELSE block] END */
 	FuncState *fs = ls->fs;
 	int escapelist = NO_JUMP; /* exit list for finished parts */
-	test_then_block(ls, &escapelist); /* IF cond THEN block */
-	while (ls->t.token == TK_ELSEIF)
-		test_then_block(ls, &escapelist); /* ELSEIF cond THEN block */
-	if (testnext(ls, TK_ELSE))
+	int taken = test_then_block(ls, &escapelist); /* IF cond THEN block */
+	while (!taken && ls->t.token == TK_ELSEIF)
+		taken = test_then_block(ls, &escapelist); /* ELSEIF cond THEN block */
+	if (taken)
+	{
+		/* remaining parts are unreachable */
+		int oldescape = escapelist;
+		CodeMark m;
+		markcode(fs, &m);
+		while (ls->t.token == TK_ELSEIF)
+			test_then_block(ls, &escapelist);
+		if (testnext(ls, TK_ELSE))
+			block(ls);
+		dropcode(fs, &m);
+		escapelist = oldescape; /* forget jumps from dropped code */
+	}
+	else if (testnext(ls, TK_ELSE))
 		block(ls); /* 'else' part */
 	check_match(ls, TK_END, TK_IF, line);
 	luaK_patchtohere(fs, escapelist); /* patch escape list to 'if' end */
@@ -1942,6 +2135,19 @@ static void checktoclose(FuncState *fs, int level)
 }
 
 
+/*
+** Check whether regular variable 'var' is never assigned after its
+** declaration, so that it can be treated as if it were '<const>'. Only
+** known after the survey pass of optimization level 2.
+*/
+static int neverassigned(LexState *ls, Vardesc *var)
+{
+	return (ls->optlevel >= 2 && !ls->survey &&
+			  var->vd.kind == VDKREG &&
+			  !ls->dyd->assigned.arr[var->vd.decl]);
+}
+
+
 static void localstat(LexState *ls)
 {
 	/* stat -> LOCAL NAME ATTRIB { ',' NAME ATTRIB } ['=' explist] */
@@ -1975,7 +2181,8 @@ static void localstat(LexState *ls)
 	}
 	var = getlocalvardesc(fs, vidx); /* get last variable */
 	if (nvars == nexps && /* no adjustments? */
-		var->vd.kind == RDKCONST && /* last variable is const? */
+		(var->vd.kind == RDKCONST || /* last variable is const? */
+		 neverassigned(ls, var)) &&
 		luaK_exp2const(fs, &e, &var->k))
 	{
 		/* compile-time constant? */
@@ -2198,29 +2405,116 @@ static void mainfunc(LexState *ls, FuncState *fs)
 }
 
 
-LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
-							Dyndata *dyd, const char *name, int firstchar)
+static LClosure *parsechunk(lua_State *L, LexState *ls, ZIO *z,
+									 const char *name, int firstchar)
 {
-	LexState lexstate;
+	Dyndata *dyd = ls->dyd;
 	FuncState funcstate;
 	LClosure *cl = luaF::newLclosure(L, 1); /* create main closure */
 	setclLvalue2s(L, L->top.p, cl); /* anchor it (to avoid being collected) */
 	luaD::inctop(L);
-	lexstate.h = luaH_newt(L); /* create table for scanner */
-	sethvalue2s(L, L->top.p, lexstate.h); /* anchor it */
+	ls->h = luaH_newt(L); /* create table for scanner */
+	sethvalue2s(L, L->top.p, ls->h); /* anchor it */
 	luaD::inctop(L);
 	funcstate.f = cl->p = luaF::newproto(L);
 	luaC_objbarrier(L, cl, cl->p);
 	funcstate.f->source = luaS::news(L, name); /* create and anchor TString */
 	luaC_objbarrier(L, funcstate.f, funcstate.f->source);
-	lexstate.buff = buff;
-	lexstate.dyd = dyd;
+	ls->ndecl = 0;
 	dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
-	luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
-	mainfunc(&lexstate, &funcstate);
-	lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
+	luaX_setinput(L, ls, z, funcstate.f->source, firstchar);
+	mainfunc(ls, &funcstate);
+	lua_assert(!funcstate.prev && funcstate.nups == 1 && !ls->fs);
 	/* all scopes should be correctly finished */
 	lua_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
 	L->top.p--; /* remove scanner's table */
 	return cl; /* closure is on the stack, too */
 }
+
+
+/*
+** Read the rest of stream 'z' into a string, so that it can be parsed
+** twice.
+*/
+static TString *readsource(lua_State *L, ZIO *z, Mbuffer *buff,
+									int c)
+{
+	size_t n = 0;
+	while (c != EOZ)
+	{
+		size_t need = n + 1 + z->n;
+		if (need > buff->sizebuffer())
+			buff->resizebuffer(L, need + need / 2);
+		buff->getbuffer()[n++] = cast_char(c);
+		memcpy(buff->getbuffer() + n, z->p, z->n);
+		n += z->n;
+		z->p += z->n;
+		z->n = 0;
+		c = z->fill();
+	}
+	return luaS::newlstr(L, buff->getbuffer(), n);
+}
+
+
+typedef struct SourceS
+{
+	const char *s;
+	size_t size;
+} SourceS;
+
+
+static const char *getsource(lua_State *L, void *ud, size_t *size)
+{
+	SourceS *ss = static_cast<SourceS *>(ud);
+	UNUSED(L);
+	if (ss->size == 0)
+		return NULL;
+	*size = ss->size;
+	ss->size = 0;
+	return ss->s;
+}
+
+
+/*
+** 'optlevel' 1 removes unreachable 'if' parts and threads jumps to
+** returns; 2 also propagates locals that are never assigned as
+** compile-time constants. Level 2 needs to know which locals are
+** assigned before compiling any of them, so it parses the chunk twice:
+** a survey pass records assignments and its result is thrown away.
+*/
+LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
+							Dyndata *dyd, const char *name, int firstchar,
+							int optlevel)
+{
+	LexState lexstate;
+	LClosure *cl;
+	lexstate.buff = buff;
+	lexstate.dyd = dyd;
+	lexstate.optlevel = cast_byte(optlevel < 2 ? optlevel : 2);
+	lexstate.survey = 0;
+	if (lexstate.optlevel < 2)
+		return parsechunk(L, &lexstate, z, name, firstchar);
+	else
+	{
+		ZIO sz;
+		SourceS ss;
+		TString *src = readsource(L, z, buff, firstchar);
+		setsvalue2s(L, L->top.p, src); /* anchor it */
+		luaD::inctop(L);
+		ss.s = getstr(src);
+		ss.size = tsslen(src);
+		sz.init(L, getsource, &ss);
+		lexstate.survey = 1;
+		dyd->assigned.n = 0;
+		parsechunk(L, &lexstate, &sz, name, sz.zgetc());
+		L->top.p--; /* drop survey result */
+		ss.s = getstr(src);
+		ss.size = tsslen(src);
+		sz.init(L, getsource, &ss);
+		lexstate.survey = 0;
+		cl = parsechunk(L, &lexstate, &sz, name, sz.zgetc());
+		setobjs2s(L, L->top.p - 2, L->top.p - 1); /* closure replaces source */
+		L->top.p--;
+		return cl;
+	}
+}
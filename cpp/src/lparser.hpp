@@ -111,6 +111,7 @@ typedef union Vardesc
 		lu_byte kind;
 		lu_byte ridx; /* register holding the variable */
 		short pidx; /* index of the variable in the Proto's 'locvars' array */
+		int decl; /* declaration number (index in 'dyd->assigned') */
 		TString *name; /* variable name */
 	} vd;
 
@@ -151,6 +152,14 @@ typedef struct Dyndata
 
 	Labellist gt; /* list of pending gotos */
 	Labellist label; /* list of active labels */
+
+	struct
+	{
+		/* for each local declaration, whether it is ever assigned */
+		lu_byte *arr;
+		int n;
+		int size;
+	} assigned;
 } Dyndata;
 
 
@@ -185,7 +194,8 @@ typedef struct FuncState
 LUAI_FUNC int luaY_nvarstack(FuncState *fs);
 
 LUAI_FUNC LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
-											Dyndata *dyd, const char *name, int firstchar);
+											Dyndata *dyd, const char *name, int firstchar,
+											int optlevel);
 
 
 #endif
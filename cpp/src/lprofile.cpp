@@ -0,0 +1,533 @@
+/*
+** $Id: lprofile.c $
+** Sampling profiler
+** See Copyright Notice in lua.h
+*/
+
+#define lprofile_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include "lua.hpp"
+
+#include "ldebug.hpp"
+#include "lobject.hpp"
+#include "lstate.hpp"
+
+
+/*
+** A timer thread per profiler interrupts the thread that started it
+** every 'interval' microseconds (with a signal, or by suspending it on
+** Windows) only to set the traps of the thread running Lua code there.
+** The sample itself is taken by that thread at its next trap check (see
+** 'luaG_traceexec'), where walking its CallInfo list is safe, and goes
+** straight into a call tree; there is no buffer in between to drain.
+**
+** The state must keep running on the thread that started the profiler,
+** and be stopped or closed there too.
+*/
+
+
+/* signal used to interrupt sampled threads */
+#if !defined(LUAI_PROFSIGNAL)
+#define LUAI_PROFSIGNAL		SIGPROF
+#endif
+
+/* maximum number of threads sampled at once */
+#if !defined(LUAI_MAXPROFILERS)
+#define LUAI_MAXPROFILERS	64
+#endif
+
+
+namespace {
+
+/*
+** A frame of the call tree: a function, or a line in one. 'source' and
+** the line range tell apart a Proto allocated where a dead one was.
+*/
+struct Frame
+{
+	const void *f;
+	int line;
+	const TString *source;
+	int linedefined;
+	int lastlinedefined;
+	std::string name;
+};
+
+struct FrameKey
+{
+	const void *f;
+	int line;
+
+	bool operator== (const FrameKey &o) const
+	{
+		return f == o.f && line == o.line;
+	}
+};
+
+struct FrameHash
+{
+	size_t operator() (const FrameKey &k) const
+	{
+		auto h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(k.f));
+		h ^= static_cast<uint64_t>(static_cast<uint32_t>(k.line)) << 32;
+		return static_cast<size_t>(h * 0x9E3779B97F4A7C15ull >> 16);
+	}
+};
+
+#if !defined(_WIN32)
+/*
+** Threads being sampled, for the signal handler to find its state
+** without locks. A slot is filled 'g' first and emptied 'thread' first,
+** under 'slotlock'.
+*/
+struct Slot
+{
+	std::atomic<const void *> thread{nullptr};
+	std::atomic<global_State *> g{nullptr};
+};
+
+Slot slots[LUAI_MAXPROFILERS];
+std::mutex slotlock;
+struct sigaction oldaction;
+
+/* only its address is used, to tell threads apart */
+thread_local char threadkey;
+#endif
+
+}
+
+
+struct Profiler
+{
+	/* call tree; node 0 is the root. 'count' has the samples ending there */
+	struct Node
+	{
+		uint32_t parent;
+		uint32_t frame;
+		uint64_t count;
+	};
+
+	global_State *g;
+	int mode = LUA_PROFILEFUNC;
+	bool sampling = false;
+	std::chrono::microseconds interval{1000};
+	std::vector<Node> nodes;
+	std::unordered_map<uint64_t, uint32_t> children;
+	std::vector<Frame> frames;
+	std::unordered_map<FrameKey, uint32_t, FrameHash> frameids;
+	std::vector<uint32_t> path; /* frames of the sample being taken */
+
+	/* timer */
+	std::thread timer;
+	std::mutex m;
+	std::condition_variable wake;
+	bool stopping = false;
+#if defined(_WIN32)
+	HANDLE target = NULL;
+#else
+	pthread_t target;
+	Slot *slot = nullptr;
+#endif
+
+	explicit Profiler (global_State *g) : g(g)
+	{
+		reset();
+	}
+
+	void reset ()
+	{
+		nodes.assign(1, Node{0, 0, 0});
+		children.clear();
+	}
+
+	auto start () -> const char *;
+	void stop ();
+	void run ();
+	void interrupt ();
+	void sample (lua_State *L);
+	auto frameof (lua_State *L, CallInfo *ci) -> uint32_t;
+	auto child (uint32_t parent, uint32_t frame) -> uint32_t;
+};
+
+
+#if !defined(_WIN32)
+
+static void onsignal (int sig, siginfo_t *info, void *context)
+{
+	int olderrno = errno;
+	const void *self = &threadkey;
+	for (Slot &s : slots)
+	{
+		if (s.thread.load() == self)
+		{
+			global_State *g = s.g.load();
+			if (g != NULL && s.thread.load() == self) /* still ours? */
+				luaG_requestsample(g);
+			errno = olderrno;
+			return;
+		}
+	}
+	errno = olderrno;
+	/* not for a profiler: pass it on, unless it would kill the process */
+	if (oldaction.sa_flags & SA_SIGINFO)
+	{
+		if (oldaction.sa_sigaction != NULL)
+			oldaction.sa_sigaction(sig, info, context);
+	}
+	else if (oldaction.sa_handler != SIG_DFL && oldaction.sa_handler != SIG_IGN)
+		oldaction.sa_handler(sig);
+}
+
+
+static void installhandler ()
+{
+	static std::once_flag once;
+	std::call_once(once, []
+	{
+		struct sigaction sa;
+		sa.sa_sigaction = onsignal;
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigaction(LUAI_PROFSIGNAL, &sa, &oldaction);
+	});
+}
+
+#endif
+
+
+auto Profiler::start () -> const char *
+{
+#if defined(_WIN32)
+	target = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE,
+							  GetCurrentThreadId());
+	if (target == NULL)
+		return "cannot open the current thread for sampling";
+#else
+	installhandler();
+	target = pthread_self();
+	{
+		std::lock_guard lock(slotlock);
+		for (Slot &s : slots)
+		{
+			if (s.thread.load() == &threadkey)
+				return "another state is being profiled on this thread";
+			if (slot == nullptr && s.thread.load() == nullptr)
+				slot = &s;
+		}
+		if (slot == nullptr)
+			return "too many threads being profiled";
+		slot->g.store(g);
+		slot->thread.store(&threadkey);
+	}
+#endif
+	stopping = false;
+	sampling = true;
+	try
+	{
+		timer = std::thread(&Profiler::run, this);
+	}
+	catch (const std::system_error &)
+	{
+		stop();
+		return "cannot start the profiler thread";
+	}
+	return NULL;
+}
+
+
+void Profiler::stop ()
+{
+	if (!sampling)
+		return;
+	sampling = false;
+	if (timer.joinable())
+	{
+		{
+			std::lock_guard lock(m);
+			stopping = true;
+		}
+		wake.notify_one();
+		timer.join();
+	}
+#if defined(_WIN32)
+	CloseHandle(target);
+	target = NULL;
+#else
+	{
+		std::lock_guard lock(slotlock);
+		slot->thread.store(nullptr);
+		slot->g.store(nullptr);
+	}
+	slot = nullptr;
+#endif
+	g->samplepending = 0;
+}
+
+
+void Profiler::run ()
+{
+	std::unique_lock lock(m);
+	while (!wake.wait_for(lock, interval, [this] { return stopping; }))
+		interrupt();
+}
+
+
+void Profiler::interrupt ()
+{
+#if defined(_WIN32)
+	if (SuspendThread(target) != static_cast<DWORD>(-1))
+	{
+		CONTEXT context;
+		context.ContextFlags = CONTEXT_CONTROL;
+		/* the thread is only sure to be stopped once this returns */
+		if (GetThreadContext(target, &context))
+			luaG_requestsample(g);
+		ResumeThread(target);
+	}
+#else
+	pthread_kill(target, LUAI_PROFSIGNAL);
+#endif
+}
+
+
+/*
+** Frame for the function running in 'ci'; named the first time it is
+** seen, from how it was called then.
+*/
+auto Profiler::frameof (lua_State *L, CallInfo *ci) -> uint32_t
+{
+	const TValue *func = s2v(ci->func.p);
+	const Proto *p = NULL;
+	const void *f = NULL;
+	int line = -1;
+	switch (ttypetag(func))
+	{
+		case LUA_VLCL:
+		{
+			p = clLvalue(func)->p;
+			f = p;
+			if (mode == LUA_PROFILELINE)
+			{
+				int pc = pcRel(ci->u.l.savedpc, p);
+				line = luaG_getfuncline(p, pc < 0 ? 0 : pc);
+			}
+			break;
+		}
+		case LUA_VLCF:
+			f = reinterpret_cast<const void *>(fvalue(func));
+			break;
+		case LUA_VCCL:
+			f = reinterpret_cast<const void *>(clCvalue(func)->f);
+			break;
+		default:
+			break;
+	}
+	auto [it, fresh] = frameids.try_emplace(FrameKey{f, line},
+														 static_cast<uint32_t>(frames.size()));
+	if (!fresh)
+	{
+		const Frame &fr = frames[it->second];
+		if (p == NULL || (fr.source == p->source &&
+								fr.linedefined == p->linedefined &&
+								fr.lastlinedefined == p->lastlinedefined))
+			return it->second;
+		it->second = static_cast<uint32_t>(frames.size()); /* a new function */
+	}
+	lua_Debug ar;
+	ar.i_ci = ci;
+	lua_getinfo(L, "Sn", &ar);
+	std::string name;
+	if (p == NULL)
+	{
+		name = "[C] ";
+		if (ar.name != NULL)
+			name += ar.name;
+		else
+		{
+			char buff[32];
+			std::snprintf(buff, sizeof(buff), "%p", f);
+			name += buff;
+		}
+	}
+	else
+	{
+		int shown = (line >= 0) ? line : ar.linedefined;
+		if (*ar.what == 'm')
+			name = "main chunk";
+		else
+			name = (ar.name != NULL) ? ar.name : "?";
+		name += " (";
+		name += ar.short_src;
+		if (shown > 0)
+		{
+			name += ':';
+			name += std::to_string(shown);
+		}
+		name += ')';
+	}
+	for (char &c : name) /* ';' separates frames in a dump */
+		if (c == ';' || c == '\n')
+			c = ',';
+	frames.push_back(Frame{f, line, p ? p->source : NULL,
+								  p ? p->linedefined : 0, p ? p->lastlinedefined : 0,
+								  std::move(name)});
+	return it->second;
+}
+
+
+auto Profiler::child (uint32_t parent, uint32_t frame) -> uint32_t
+{
+	uint64_t key = (static_cast<uint64_t>(parent) << 32) | frame;
+	auto [it, fresh] = children.try_emplace(key, static_cast<uint32_t>(nodes.size()));
+	if (fresh)
+		nodes.push_back(Node{parent, frame, 0});
+	return it->second;
+}
+
+
+void Profiler::sample (lua_State *L)
+{
+	path.clear();
+	for (CallInfo *ci = L->ci; ci != &L->base_ci; ci = ci->previous)
+		path.push_back(frameof(L, ci));
+	uint32_t node = 0;
+	for (size_t i = path.size(); i-- > 0;)
+		node = child(node, path[i]);
+	nodes[node].count++;
+}
+
+
+/*
+** Called by 'luaG_traceexec' when a sample was asked for, with 'L' the
+** running thread and its current instruction saved.
+*/
+void luaG_takesample(lua_State *L)
+{
+	global_State *g = G(L);
+	Profiler *p = g->profiler;
+	g->samplepending = 0;
+	if (p != NULL && p->sampling)
+	{
+		try
+		{
+			p->sample(L);
+		}
+		catch (const std::bad_alloc &)
+		{
+			/* no memory for this sample; skip it */
+		}
+	}
+}
+
+
+void luaG_freeprofiler(lua_State *L)
+{
+	global_State *g = G(L);
+	if (g->profiler != NULL)
+	{
+		g->profiler->stop();
+		delete g->profiler;
+		g->profiler = NULL;
+	}
+}
+
+
+/*
+** Starts sampling the calling thread every 'interval' microseconds,
+** dropping what an earlier run gathered. Returns LUA_OK, or an error
+** code with a message pushed.
+*/
+LUA_API int lua_profilestart(lua_State *L, int interval, int mode)
+{
+	global_State *g = G(L);
+	const char *msg;
+	lua_profilestop(L);
+	try
+	{
+		if (g->profiler == NULL)
+			g->profiler = new Profiler(g);
+		Profiler *p = g->profiler;
+		p->reset();
+		p->mode = (mode == LUA_PROFILELINE) ? LUA_PROFILELINE : LUA_PROFILEFUNC;
+		p->interval = std::chrono::microseconds(interval > 0 ? interval : 1);
+		msg = p->start();
+	}
+	catch (const std::bad_alloc &)
+	{
+		msg = "not enough memory";
+	}
+	if (msg == NULL)
+		return LUA_OK;
+	lua_pushstring(L, msg);
+	return LUA_ERRRUN;
+}
+
+
+/*
+** Stops sampling; what was gathered stays for 'lua_profiledump'.
+*/
+LUA_API void lua_profilestop(lua_State *L)
+{
+	Profiler *p = G(L)->profiler;
+	if (p != NULL)
+		p->stop();
+}
+
+
+/*
+** Pushes the samples gathered as collapsed stacks, one "f1;f2;f3 count"
+** line per distinct stack, outermost frame first, as flame graph tools
+** read them. With 'reset', the samples are dropped afterwards.
+*/
+LUA_API const char *lua_profiledump(lua_State *L, int reset)
+{
+	Profiler *p = G(L)->profiler;
+	std::string out;
+	if (p != NULL)
+	{
+		std::vector<uint32_t> stack;
+		for (uint32_t n = 1; n < p->nodes.size(); n++)
+		{
+			if (p->nodes[n].count == 0)
+				continue;
+			stack.clear();
+			for (uint32_t i = n; i != 0; i = p->nodes[i].parent)
+				stack.push_back(p->nodes[i].frame);
+			for (size_t i = stack.size(); i-- > 0;)
+			{
+				out += p->frames[stack[i]].name;
+				out += (i > 0) ? ';' : ' ';
+			}
+			out += std::to_string(p->nodes[n].count);
+			out += '\n';
+		}
+		if (reset)
+			p->reset();
+	}
+	return lua_pushlstring(L, out.data(), out.size());
+}
@@ -186,17 +186,17 @@ LUAI_FUNC void luaE_incCstack(lua_State *L)
 }
 
 
-static void stack_init(lua_State *L1, lua_State *L)
+/*
+** erase the whole stack of 'L1' and set up its first ci
+*/
+static void stack_reset(lua_State *L1)
 {
 	int i;
 	CallInfo *ci;
-	/* initialize stack array */
-	L1->stack.p = luaM::newvector<StackValue>(L, BASIC_STACK_SIZE + EXTRA_STACK);
 	L1->tbclist.p = L1->stack.p;
-	for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
-		setnilvalue(s2v(L1->stack.p + i)); /* erase new stack */
+	for (i = 0; i < L1->stacksize() + EXTRA_STACK; i++)
+		setnilvalue(s2v(L1->stack.p + i)); /* erase stack */
 	L1->top.p = L1->stack.p;
-	L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
 	/* initialize first ci */
 	ci = &L1->base_ci;
 	ci->next = ci->previous = NULL;
@@ -211,6 +211,15 @@ static void stack_init(lua_State *L1, lua_State *L)
 }
 
 
+static void stack_init(lua_State *L1, lua_State *L)
+{
+	/* initialize stack array */
+	L1->stack.p = luaM::newvector<StackValue>(L, BASIC_STACK_SIZE + EXTRA_STACK);
+	L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
+	stack_reset(L1);
+}
+
+
 static void freestack(lua_State *L)
 {
 	if (L->stack.p == NULL)
@@ -257,15 +266,10 @@ static void f_luaopen(lua_State *L, void *ud)
 
 
 /*
-** preinitialize a thread with consistent values without allocating
-** any memory (to avoid errors)
+** reset the per-thread state that doesn't involve its stack
 */
-static void preinit_thread(lua_State *L, global_State *g)
+static void clear_thread(lua_State *L)
 {
-	G(L) = g;
-	L->stack.p = NULL;
-	L->ci = NULL;
-	L->nci = 0;
 	L->twups = L; /* thread has no upvalues */
 	L->nCcalls = 0;
 	L->errorJmp = NULL;
@@ -281,9 +285,41 @@ static void preinit_thread(lua_State *L, global_State *g)
 }
 
 
+/*
+** preinitialize a thread with consistent values without allocating
+** any memory (to avoid errors)
+*/
+static void preinit_thread(lua_State *L, global_State *g)
+{
+	G(L) = g;
+	L->stack.p = NULL;
+	L->ci = NULL;
+	L->nci = 0;
+	clear_thread(L);
+}
+
+
+/*
+** free threads kept in the cache beyond its first 'keep'
+*/
+static void trimthreadcache(lua_State *L, int keep)
+{
+	global_State *g = G(L);
+	while (g->nthreadcache > keep)
+	{
+		lua_State *L1 = gco2th(g->threadcache);
+		g->threadcache = L1->next;
+		g->nthreadcache--;
+		freestack(L1);
+		luaM::free(L, fromstate(L1));
+	}
+}
+
+
 static void close_state(lua_State *L)
 {
 	global_State *g = G(L);
+	luaG_freeprofiler(L); /* stop sampling before anything goes away */
 	if (!completestate(g)) /* closing a partially built state? */
 		luaC_freeallobjects(L); /* just collect its objects */
 	else
@@ -294,6 +330,7 @@ static void close_state(lua_State *L)
 		luaC_freeallobjects(L); /* collect all objects */
 		luai_userstateclose(L);
 	}
+	trimthreadcache(L, 0);
 	luaM::freearray(L, G(L)->strt.hash, G(L)->strt.size);
 	freestack(L);
 	lua_assert(gettotalbytes(g) == sizeof(LG));
@@ -306,13 +343,27 @@ LUA_API lua_State *lua_newthread(lua_State *L)
 	global_State *g = G(L);
 	lua_lock(L);
 	luaC_checkGC(L);
-	/* create new thread */
-	GCObject *o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
-	lua_State *L1 = gco2th(o);
+	lua_State *L1;
+	if (g->threadcache != NULL)
+	{
+		/* reuse a dead thread, already reset, as a new object */
+		L1 = gco2th(g->threadcache);
+		g->threadcache = L1->next;
+		g->nthreadcache--;
+		L1->marked = luaC_white(g);
+		L1->next = g->allgc;
+		g->allgc = obj2gco(L1);
+	}
+	else
+	{
+		/* create new thread */
+		GCObject *o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
+		L1 = gco2th(o);
+		preinit_thread(L1, g);
+	}
 	/* anchor it on L stack */
 	setthvalue2s(L, L->top.p, L1);
 	api_incr_top(L);
-	preinit_thread(L1, g);
 	L1->hookmask = L->hookmask;
 	L1->basehookcount = L->basehookcount;
 	L1->hook = L->hook;
@@ -324,23 +375,72 @@ LUA_API lua_State *lua_newthread(lua_State *L)
 		LUA_EXTRASPACE
 	);
 	luai_userstatethread(L, L1);
-	stack_init(L1, L); /* init stack */
+	if (L1->stack.p == NULL)
+		stack_init(L1, L); /* init stack */
 	lua_unlock(L);
 	return L1;
 }
 
 
+/*
+** Dead threads go to the thread cache while it has room, with their
+** stacks cut down to 'threadcachestack' and everything reset, so that
+** 'lua_newthread' only has to link one back in. Threads that can't be
+** cut down (or anything while the state closes) are freed.
+*/
+static int cachethread(lua_State *L, lua_State *L1)
+{
+	global_State *g = G(L);
+	if (g->nthreadcache >= g->maxthreadcache || (g->gcstp & GCSTPCLS) ||
+		L1->stack.p == NULL)
+		return 0;
+	L1->ci = &L1->base_ci;
+	freeCI(L1);
+	L1->top.p = L1->tbclist.p = L1->base_ci.func.p = L1->stack.p;
+	if (L1->stacksize() != g->threadcachestack &&
+		!luaD::reallocstack(L1, g->threadcachestack, 0))
+		return 0;
+	stack_reset(L1);
+	clear_thread(L1);
+	L1->next = g->threadcache;
+	g->threadcache = obj2gco(L1);
+	g->nthreadcache++;
+	return 1;
+}
+
+
 void luaE_freethread(lua_State *L, lua_State *L1)
 {
 	LX *l = fromstate(L1);
 	luaF::closeupval(L1, L1->stack.p); /* close all upvalues */
 	lua_assert(L1->openupval == NULL);
 	luai_userstatefree(L, L1);
+	if (cachethread(L, L1))
+		return;
 	freestack(L1);
 	luaM::free(L, l);
 }
 
 
+/*
+** Sets how many dead threads are kept for reuse (0 turns the cache off)
+** and the stack size they are kept with.
+*/
+LUA_API void lua_setthreadcache(lua_State *L, int count, int stacksize)
+{
+	global_State *g = G(L);
+	lua_lock(L);
+	g->maxthreadcache = (count < 0) ? 0 : count;
+	if (stacksize < BASIC_STACK_SIZE)
+		stacksize = BASIC_STACK_SIZE;
+	else if (stacksize > LUAI_MAXSTACK)
+		stacksize = LUAI_MAXSTACK;
+	g->threadcachestack = stacksize;
+	trimthreadcache(L, g->maxthreadcache);
+	lua_unlock(L);
+}
+
+
 int luaE_resetthread(lua_State *L, int status)
 {
 	CallInfo *ci = L->ci = &L->base_ci; /* unwind CallInfo list */
@@ -410,6 +510,13 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud)
 	g->gray = g->grayagain = NULL;
 	g->weak = g->ephemeron = g->allweak = NULL;
 	g->twups = NULL;
+	g->threadcache = NULL;
+	g->nthreadcache = 0;
+	g->maxthreadcache = LUAI_THREADCACHE;
+	g->threadcachestack = BASIC_STACK_SIZE;
+	g->running = L;
+	g->profiler = NULL;
+	g->samplepending = 0;
 	g->totalbytes = sizeof(LG);
 	g->GCdebt = 0;
 	g->lastatomic = 0;
@@ -420,6 +527,7 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud)
 	setgcparam(g->genmajormul, LUAI_GENMAJORMUL);
 	g->genminormul = LUAI_GENMINORMUL;
 	for (i = 0; i < LUA_NUMTAGS; i++) g->mt[i] = nullptr;
+	for (i = 0; i < LUA_NUMITERATORS; i++) g->iterators[i] = nullptr;
 	if (luaD::rawrunprotected(L, f_luaopen, nullptr) != LUA_OK)
 	{
 		/* memory allocation error: free partial state */
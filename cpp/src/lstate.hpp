@@ -308,6 +308,13 @@ typedef struct global_State
 	GCObject *finobjold1; /* list of old1 objects with finalizers */
 	GCObject *finobjrold; /* list of really old objects with finalizers */
 	struct lua_State *twups; /* list of threads with open upvalues */
+	GCObject *threadcache; /* dead threads kept for reuse, linked by 'next' */
+	int nthreadcache; /* number of threads in 'threadcache' */
+	int maxthreadcache; /* limit for 'nthreadcache' */
+	int threadcachestack; /* stack size threads are cut to when cached */
+	struct lua_State *volatile running; /* thread running Lua code now */
+	struct Profiler *profiler; /* sampling profiler, if ever started */
+	volatile l_signalT samplepending; /* profiler sample due at next trap */
 	lua_CFunction panic; /* to be called in unprotected errors */
 	struct lua_State *mainthread;
 	TString *memerrmsg; /* message for memory-allocation errors */
@@ -316,6 +323,7 @@ typedef struct global_State
 	TString *strcache[STRCACHE_N][STRCACHE_M]; /* cache for strings in API */
 	lua_WarnFunction warnf; /* warning function */
 	void *ud_warn; /* auxiliary data to 'warnf' */
+	lua_CFunction iterators[LUA_NUMITERATORS]; /* see 'lua_setiterator' */
 } global_State;
 
 
@@ -390,6 +398,28 @@ struct lua_State
 
 #define G(L)	(L->l_G)
 
+
+/*
+** Marks 'L' as the thread running Lua code while in scope, for the
+** sampling profiler to know which thread to stop. Restores the previous
+** one on the way out, errors and yields included.
+*/
+struct RunningThread
+{
+	global_State *g;
+	lua_State *prev;
+
+	explicit RunningThread (lua_State *L) : g(G(L)), prev(g->running)
+	{
+		g->running = L;
+	}
+
+	~RunningThread ()
+	{
+		g->running = prev;
+	}
+};
+
 /*
 ** 'g->nilvalue' being a nil value flags that the state was completely
 ** build.
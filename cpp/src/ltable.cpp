@@ -357,17 +357,27 @@ static unsigned int findindex(lua_State *L, Table *t, TValue *key,
 		return i; /* yes; that's the index */
 	const TValue *n = getgeneric(t, key, 1);
 	if (l_unlikely(isabstkey(n)))
-		luaG_runerror(L, "invalid key to 'next'"); /* key not found */
+	{
+		/* key not found; raised without a position, as from the C function
+		   'next', also when a loop runs 'next' in place (see OP_TFORCALL) */
+		luaC_checkGC(L); /* error message uses memory */
+		luaO_pushfstring(L, "invalid key to 'next'");
+		luaG_errormsg(L);
+	}
 	i = cast_int(nodefromval(n) - gnode(t, 0)); /* key index in hash table */
 	/* hash elements are numbered after array ones */
 	return (i + 1) + asize;
 }
 
 
-int luaH_next(lua_State *L, Table *t, StkId key)
+/*
+** Puts in 'key' and 'key + 1' the first entry at traversal index 'i'
+** or after it. Returns the index of the entry that follows it, or 0
+** if there are no more elements.
+*/
+static unsigned int nextentry(lua_State *L, Table *t, StkId key,
+										unsigned int i, unsigned int asize)
 {
-	unsigned int asize = luaH_realasize(t);
-	unsigned int i = findindex(L, t, s2v(key), asize); /* find original key */
 	for (; i < asize; i++)
 	{
 		/* try first array part */
@@ -376,7 +386,7 @@ int luaH_next(lua_State *L, Table *t, StkId key)
 			/* a non-empty entry? */
 			setivalue(s2v(key), i + 1);
 			setobj2s(L, key + 1, &t->array[i]);
-			return 1;
+			return i + 1;
 		}
 	}
 	for (i -= asize; cast_int(i) < sizenode(t); i++)
@@ -388,13 +398,45 @@ int luaH_next(lua_State *L, Table *t, StkId key)
 			Node *n = gnode(t, i);
 			getnodekey(L, s2v(key), n);
 			setobj2s(L, key + 1, gval(n));
-			return 1;
+			return (i + 1) + asize;
 		}
 	}
 	return 0; /* no more elements */
 }
 
 
+int luaH_next(lua_State *L, Table *t, StkId key)
+{
+	unsigned int asize = luaH_realasize(t);
+	unsigned int i = findindex(L, t, s2v(key), asize); /* find original key */
+	return nextentry(L, t, key, i, asize) != 0;
+}
+
+
+/*
+** Same as 'luaH_next', with '*pos' keeping the traversal index of 'key'
+** between calls so that it need not be searched for. A '*pos' that no
+** longer matches 'key' (e.g., after a rehash) is recomputed.
+*/
+int luaH_nextat(lua_State *L, Table *t, StkId key, unsigned int *pos)
+{
+	unsigned int asize = luaH_realasize(t);
+	unsigned int i = *pos;
+	int valid;
+	if (i == 0)
+		valid = ttisnil(s2v(key));
+	else if (i <= asize)
+		valid = ttisinteger(s2v(key)) && l_castS2U(ivalue(s2v(key))) == i;
+	else
+		valid = (i - asize <= cast_uint(sizenode(t)) &&
+					equalkey(s2v(key), gnode(t, i - asize - 1), 0));
+	if (!valid)
+		i = findindex(L, t, s2v(key), asize);
+	*pos = nextentry(L, t, key, i, asize);
+	return *pos != 0;
+}
+
+
 static void freehash(lua_State *L, Table *t)
 {
 	if (!t->isdummy())
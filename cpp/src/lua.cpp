@@ -742,6 +742,8 @@ static int pmain(lua_State *L)
 }
 
 
+/* with LUAC_MAIN defined, the program is the compiler (see luac.cpp) */
+#if !defined(LUAC_MAIN)
 int main(int argc, char **argv)
 {
 	int status, result;
@@ -761,6 +763,7 @@ int main(int argc, char **argv)
 	lua_close(L);
 	return (result && status == LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+#endif
 
 void *lua_getextraspace(lua_State *L)
 {
@@ -117,6 +117,12 @@ using lua_KFunction = auto (*)(lua_State *L, int status, lua_KContext ctx) -> in
 using lua_Reader = auto (*)(lua_State *L, void *ud, size_t *sz) -> const char*;
 using lua_Writer = auto (*)(lua_State *L, const void *p, size_t sz, void *ud) -> int;
 
+/*
+** Type for functions that give back the memory of a loaded chunk image,
+** once no function uses it (possibly from another thread)
+*/
+using lua_ImageRelease = auto (*)(void *ud, const void *data, size_t sz) -> void;
+
 /*
 ** Type for memory-allocation functions
 */
@@ -152,6 +158,8 @@ LUA_APIA lua_newstate(lua_Alloc f, void *ud) -> lua_State*;
 LUA_APIA lua_close(lua_State *L) -> void;
 LUA_APIA lua_newthread(lua_State *L) -> lua_State*;
 LUA_APIA lua_closethread(lua_State *L, lua_State *from) -> int;
+LUA_APIA lua_clonestate(lua_State *from, char *msg, size_t size) -> lua_State*;
+LUA_APIA lua_setthreadcache(lua_State *L, int count, int stacksize) -> void;
 LUA_APIA lua_atpanic(lua_State *L, lua_CFunction panicf) -> lua_CFunction;
 LUA_APIA lua_version(lua_State *L) -> lua_Number;
 
@@ -303,7 +311,12 @@ LUA_API int lua_pcall(lua_State* L, int n, int r, int f);
 LUA_API int (lua_load)(lua_State *L, lua_Reader reader, void *dt,
 								const char *chunkname, const char *mode);
 
+LUA_API int (lua_loadimage)(lua_State *L, const void *data, size_t size,
+								const char *chunkname, const char *mode,
+								lua_ImageRelease release, void *ud);
+
 LUA_API int (lua_dump)(lua_State *L, lua_Writer writer, void *data, int strip);
+LUA_API int (lua_dumpimage)(lua_State *L, lua_Writer writer, void *data, int strip);
 
 
 /*
@@ -363,6 +376,18 @@ LUA_APIA lua_toclose(lua_State *L, int idx) -> void;
 LUA_APIA lua_closeslot(lua_State *L, int idx) -> void;
 
 
+/*
+** stock iterator functions the VM may run inline in generic 'for' loops
+*/
+
+constexpr auto LUA_ITERIPAIRS   = 0;
+constexpr auto LUA_ITERNEXT     = 1;
+
+constexpr auto LUA_NUMITERATORS = 2;
+
+LUA_APIA lua_setiterator(lua_State *L, int what, lua_CFunction f) -> void;
+
+
 /*
 ** {==============================================================
 ** some useful macros
@@ -447,6 +472,16 @@ LUA_APIA lua_gethookmask(lua_State *L) -> int;
 LUA_APIA lua_gethookcount(lua_State *L) -> int;
 LUA_APIA lua_setcstacklimit(lua_State *L, unsigned int limit) -> int;
 
+/*
+** Sampling profiler modes
+*/
+constexpr auto LUA_PROFILEFUNC = 0;  /* frames are functions */
+constexpr auto LUA_PROFILELINE = 1;  /* frames are functions at a line */
+
+LUA_APIA lua_profilestart(lua_State *L, int interval, int mode) -> int;
+LUA_APIA lua_profilestop(lua_State *L) -> void;
+LUA_APIA lua_profiledump(lua_State *L, int reset) -> const char*;
+
 struct lua_Debug
 {
 	int event;
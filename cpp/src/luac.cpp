@@ -22,6 +22,7 @@
 #include "lobject.hpp"
 #include "lopcodes.hpp"
 #include "lopnames.hpp"
+#include "lopt.hpp"
 #include "lstate.hpp"
 #include "dump/lundump.hpp"
 
@@ -35,6 +36,9 @@ static void PrintFunction(const Proto *f, int full);
 static int listing = 0; /* list bytecodes? */
 static int dumping = 1; /* dump bytecodes? */
 static int stripping = 0; /* strip debug information? */
+static int imaging = 0; /* dump as an image? */
+static int bundling = 0; /* dump as a bundle of modules? */
+static int optimizing = 0; /* optimize bytecodes? */
 static char Output[] = {OUTPUT}; /* default output file name */
 static const char *output = Output; /* actual output file name */
 static const char *progname = PROGNAME; /* actual program name */
@@ -61,7 +65,10 @@ static void usage(const char *message)
 	fprintf(stderr,
 				"usage: %s [options] [filenames]\n"
 				"Available options are:\n"
+				"  -b       output a bundle: an image that preloads each file as a module\n"
 				"  -l       list (use -l -l for full listing)\n"
+				"  -m       output an image, loaded in place when mapped\n"
+				"  -O       optimize (propagate constants, drop dead code, tidy bytecodes)\n"
 				"  -o name  output to file 'name' (default is \"%s\")\n"
 				"  -p       parse only\n"
 				"  -s       strip debug information\n"
@@ -93,6 +100,12 @@ static int doargs(int argc, char *argv[])
 			break;
 		else if (IS("-l")) /* list */
 			++listing;
+		else if (IS("-b")) /* bundle */
+			bundling = imaging = 1;
+		else if (IS("-m")) /* image */
+			imaging = 1;
+		else if (IS("-O")) /* optimize */
+			optimizing = 1;
 		else if (IS("-o")) /* output file */
 		{
 			output = argv[++i];
@@ -160,6 +173,72 @@ static const Proto *combine(lua_State *L, int n)
 	}
 }
 
+/*
+** Module name for a file: its path without a ".lua" suffix, with
+** directory separators turned into dots and a final ".init" dropped,
+** as 'require' would look for it
+*/
+static const char *modname(lua_State *L, const char *filename)
+{
+	luaL_Buffer b;
+	size_t l = strlen(filename);
+	if (strncmp(filename, "./", 2) == 0)
+	{
+		filename += 2;
+		l -= 2;
+	}
+	if (l > 4 && strcmp(filename + l - 4, ".lua") == 0)
+		l -= 4;
+	luaL_buffinit(L, &b);
+	for (size_t i = 0; i < l; i++)
+		luaL_addchar(&b, (filename[i] == '/' || filename[i] == '\\') ? '.' : filename[i]);
+	luaL_pushresult(&b);
+	const char *name = lua_tolstring(L, -1, &l);
+	if (l > 5 && strcmp(name + l - 5, ".init") == 0)
+	{
+		lua_pushlstring(L, name, l - 5);
+		lua_remove(L, -2);
+	}
+	return lua_tostring(L, -1);
+}
+
+/*
+** Bundle the 'n' functions on the top: a main function that sets
+** 'package.preload[name]' to each of them, the names left in 'names'
+*/
+static const Proto *bundle(lua_State *L, char **files, int n, const char **names)
+{
+	luaL_Buffer b;
+	Proto *f;
+	int i;
+	int first = lua_gettop(L) - n; /* first function, below 'names' */
+	for (i = 0; i < n; i++)
+		names[i] = modname(L, files[i] == NULL ? "stdin" : files[i]);
+	luaL_buffinit(L, &b);
+	luaL_addstring(&b, "local preload = package.preload\n");
+	for (i = 0; i < n; i++)
+	{
+		luaL_addstring(&b, "preload[\"");
+		for (const char *c = names[i]; *c; c++)
+		{
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\%03d", (unsigned char) *c);
+			luaL_addstring(&b, esc);
+		}
+		luaL_addstring(&b, "\"] = function() end\n");
+	}
+	luaL_pushresult(&b);
+	if (luaL_loadbuffer(L, lua_tostring(L, -1), lua_rawlen(L, -1), "=(" PROGNAME ")") != LUA_OK)
+		fatal(lua_tostring(L, -1));
+	f = toproto(L, -1);
+	for (i = 0; i < n; i++)
+	{
+		f->p[i] = getproto(s2v(L->ci->func.p + first + i));
+		if (f->p[i]->sizeupvalues > 0) f->p[i]->upvalues[0].instack = 0;
+	}
+	return f;
+}
+
 static int writer(lua_State *L, const void *p, size_t size, void *u)
 {
 	UNUSED(L);
@@ -177,9 +256,24 @@ static int pmain(lua_State *L)
 	for (i = 0; i < argc; i++)
 	{
 		const char *filename = IS("-") ? NULL : argv[i];
-		if (luaL_loadfile(L, filename) != LUA_OK) fatal(lua_tostring(L, -1));
+		if (luaL_loadfilex(L, filename, optimizing ? "bt2" : NULL) != LUA_OK)
+			fatal(lua_tostring(L, -1));
+		luaU::loadtree(L, toproto(L, -1)); /* load what an image left lazy */
+		if (optimizing)
+			luaK_optimize(L, toproto(L, -1));
+	}
+	const char **names = NULL;
+	if (bundling)
+	{
+		if (!lua_checkstack(L, argc + 8)) fatal("too many input files");
+		names = (const char **) lua_newuserdatauv(L, (argc + 1) * sizeof(const char *), 0);
+		names[argc] = NULL;
+		for (i = 0; i < argc; i++)
+			if (IS("-")) argv[i] = NULL;
+		f = bundle(L, argv, argc, names);
 	}
-	f = combine(L, argc);
+	else
+		f = combine(L, argc);
 	if (listing)
 		luaU_print(f, listing > 1);
 	if (dumping)
@@ -187,7 +281,10 @@ static int pmain(lua_State *L)
 		FILE *D = (output == NULL) ? stdout : fopen(output, "wb");
 		if (D == NULL) cannot("open");
 		lua_lock(L);
-		luaU::dump(L, f, writer, D, stripping);
+		if (imaging)
+			luaU::dumpimage(L, f, writer, D, stripping);
+		else
+			luaU::dump(L, f, writer, D, stripping);
 		lua_unlock(L);
 		if (ferror(D)) cannot("write");
 		if (fclose(D)) cannot("close");
@@ -195,21 +292,29 @@ static int pmain(lua_State *L)
 	return 0;
 }
 
-// int main(int argc, char* argv[])
-// {
-//  lua_State* L;
-//  int i=doargs(argc,argv);
-//  argc-=i; argv+=i;
-//  if (argc<=0) usage("no input files given");
-//  L=luaL_newstate();
-//  if (L==NULL) fatal("cannot create state: not enough memory");
-//  lua_pushcfunction(L,&pmain);
-//  lua_pushinteger(L,argc);
-//  lua_pushlightuserdata(L,argv);
-//  if (lua_pcall(L,2,0,0)!=LUA_OK) fatal(lua_tostring(L,-1));
-//  lua_close(L);
-//  return EXIT_SUCCESS;
-// }
+/*
+** The library has one 'main', the standalone interpreter's by default.
+** Define LUAC_MAIN for the whole build to make it the compiler's
+** instead; lua.cpp then leaves its own out.
+*/
+#if defined(LUAC_MAIN)
+int main(int argc, char *argv[])
+{
+	lua_State *L;
+	int i = doargs(argc, argv);
+	argc -= i;
+	argv += i;
+	if (argc <= 0) usage("no input files given");
+	L = luaL_newstate();
+	if (L == NULL) fatal("cannot create state: not enough memory");
+	lua_pushcfunction(L, &pmain);
+	lua_pushinteger(L, argc);
+	lua_pushlightuserdata(L, argv);
+	if (lua_pcall(L, 2, 0, 0) != LUA_OK) fatal(lua_tostring(L, -1));
+	lua_close(L);
+	return EXIT_SUCCESS;
+}
+#endif
 
 /*
 ** print bytecodes
@@ -695,6 +800,10 @@ static void PrintCode(const Proto *f)
 			case OP_EXTRAARG:
 				printf("%d", ax);
 				break;
+			case OP_FORLOOP1:
+				printf("%d %d", a, bx);
+				printf(COMMENT "to %d", pc - bx + 2);
+				break;
 #if 0
    default:
 	printf("%d %d %d",a,b,c);
@@ -696,12 +696,21 @@
 constexpr auto LUAI_MAXSTACK =		1000000;
 
 
+/*
+@@ LUACOYOTE_SCRATCHSPACE is the tail of the extra space that luacoyote
+** uses to hand results back to the host without an out-parameter (see
+** luacoyote_tolstring). It sits right below the lua_State, after the
+** part that lua_getextraspace gives to the user.
+*/
+constexpr auto LUACOYOTE_SCRATCHSPACE =	(sizeof(size_t));
+
+
 /*
 @@ LUA_EXTRASPACE defines the size of a raw memory area associated with
 ** a Lua state with very fast access.
 ** CHANGE it if you need a different size.
 */
-constexpr auto LUA_EXTRASPACE =		(sizeof(void *));
+constexpr auto LUA_EXTRASPACE =		(sizeof(void *) + LUACOYOTE_SCRATCHSPACE);
 
 
 /*
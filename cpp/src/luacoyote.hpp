@@ -1,7 +1,12 @@
 #ifndef lua_coyote_exts
 #define lua_coyote_exts
 
+#include <cstdint>
+#include <cstring>
+
 #include "lua.hpp"
+#include "lauxlib.hpp"
+#include "ldo.hpp"
 
 extern "C" {
 
@@ -53,6 +58,44 @@ void* luacoyote_getextraspace (lua_State* L)
 	return lua_getextraspace(L);
 }
 
+/*
+** String reads without a size_t* out-parameter. luacoyote_tolstring
+** leaves the length in the state's scratch word, which the host finds
+** at a fixed offset from the lua_State pointer (scratch_offset), so
+** reading a string needs no allocation on the host side.
+*/
+LC_MACRO_GETTER(scratch_offset, -static_cast<int>(LUACOYOTE_SCRATCHSPACE))
+
+static inline size_t* luacoyote_scratch (lua_State* L)
+{
+	return reinterpret_cast<size_t*>(reinterpret_cast<char*>(L) - LUACOYOTE_SCRATCHSPACE);
+}
+
+LUA_API
+const char* luacoyote_tolstring (lua_State* L, int i);
+const char* luacoyote_tolstring (lua_State* L, int i)
+{
+	return lua_tolstring(L, i, luacoyote_scratch(L));
+}
+
+/*
+** The same, returned by value for hosts that take structs in registers.
+*/
+struct LuaCoyoteString
+{
+	const char* pointer;
+	size_t size;
+};
+
+LUA_API
+LuaCoyoteString luacoyote_tostringview (lua_State* L, int i);
+LuaCoyoteString luacoyote_tostringview (lua_State* L, int i)
+{
+	LuaCoyoteString r;
+	r.pointer = lua_tolstring(L, i, &r.size);
+	return r;
+}
+
 LUA_API
 lua_Number luacoyote_tonumber (lua_State* L, int i);
 lua_Number luacoyote_tonumber (lua_State* L, int i)
@@ -186,6 +229,853 @@ void luacoyote_replace (lua_State* L, int index)
 	lua_replace(L, index);
 }
 
+
+/*
+** Command buffers: a host that pays a lot for every call into the library
+** (the JVM through FFM, for one) can encode a run of stack operations as
+** 64-bit words and have 'luacoyote_runcommands' do all of them in one call.
+** Each command is its opcode followed by its operands; names are pointers
+** to NUL-terminated strings, and strings pushed are a pointer and length,
+** both in caller memory. Indices work as they do for the regular API.
+*/
+enum LuaCoyoteCommand : int64_t
+{
+	LC_CMD_PUSHNIL,      /* */
+	LC_CMD_PUSHBOOLEAN,  /* value */
+	LC_CMD_PUSHINTEGER,  /* value */
+	LC_CMD_PUSHNUMBER,   /* value (bits of a lua_Number) */
+	LC_CMD_PUSHSTRING,   /* pointer, length */
+	LC_CMD_PUSHVALUE,    /* index */
+	LC_CMD_POP,          /* count */
+	LC_CMD_SETTOP,       /* index */
+	LC_CMD_NEWTABLE,     /* array size, hash size */
+	LC_CMD_GETFIELD,     /* table index, name */
+	LC_CMD_SETFIELD,     /* table index, name */
+	LC_CMD_GETI,         /* table index, key */
+	LC_CMD_SETI,         /* table index, key */
+	LC_CMD_GETGLOBAL,    /* name */
+	LC_CMD_SETGLOBAL,    /* name */
+	LC_CMD_CALL,         /* argument count, result count */
+	LC_CMD_READ,         /* index; writes the next result */
+	LC_CMD_COUNT,
+};
+
+/*
+** What a LC_CMD_READ writes. 'type' is the LUA_T* type of the value. Strings
+** give their bytes in 'value.pointer' and their length in 'size', which
+** stay valid as long as the string is on the stack. Numbers give 1 in
+** 'size' if they're integers, booleans are 0 or 1 in 'value.integer', and
+** anything else gives its lua_topointer.
+*/
+struct LuaCoyoteResult
+{
+	int64_t type;
+	int64_t size;
+	union
+	{
+		lua_Integer integer;
+		lua_Number number;
+		const void* pointer;
+	} value;
+};
+
+struct LuaCoyoteBatch
+{
+	const int64_t* words;
+	int64_t word_count;
+	LuaCoyoteResult* results;
+	int64_t result_count;
+	int64_t results_used;
+	int64_t commands_done;
+};
+
+static void luacoyote_readresult (lua_State* L, int index, LuaCoyoteResult* r)
+{
+	r->type = lua_type(L, index);
+	r->size = 0;
+	r->value.pointer = nullptr;
+	switch (r->type)
+	{
+		case LUA_TNUMBER: {
+			if (lua_isinteger(L, index))
+			{
+				r->size = 1;
+				r->value.integer = lua_tointeger(L, index);
+			}
+			else
+			{
+				r->value.number = lua_tonumber(L, index);
+			}
+			break;
+		}
+		case LUA_TBOOLEAN: {
+			r->value.integer = lua_toboolean(L, index);
+			break;
+		}
+		case LUA_TSTRING: {
+			size_t len;
+			r->value.pointer = lua_tolstring(L, index, &len);
+			r->size = static_cast<int64_t>(len);
+			break;
+		}
+		case LUA_TNIL:
+		case LUA_TNONE: {
+			break;
+		}
+		default: {
+			r->value.pointer = lua_topointer(L, index);
+			break;
+		}
+	}
+}
+
+/*
+** 'f' run by luaD::pcall the way a C function is run by a call: the core
+** lock is held for the bookkeeping but not for the body, whose lua_* calls
+** take it themselves. Errors leave through those calls, lock held.
+*/
+struct LuaCoyoteUnlocked
+{
+	void (*f)(lua_State* L, void* ud);
+	void* ud;
+};
+
+static void luacoyote_unlocked (lua_State* L, void* ud)
+{
+	auto u = static_cast<LuaCoyoteUnlocked*>(ud);
+	lua_unlock(L);
+	u->f(L, u->ud);
+	lua_lock(L);
+}
+
+static void luacoyote_runbatch (lua_State* L, void* ud)
+{
+	auto b = static_cast<LuaCoyoteBatch*>(ud);
+	auto w = b->words;
+	auto end = b->words + b->word_count;
+	/* operands of the current command, checked to be in the buffer */
+	auto arg = [&](int n) -> int64_t {
+		if (end - w <= n + 1)
+		{
+			luaL_error(L, "command %d is cut off", static_cast<int>(b->commands_done));
+		}
+		return w[n + 1];
+	};
+	auto argstr = [&](int n) {
+		return reinterpret_cast<const char*>(static_cast<intptr_t>(arg(n)));
+	};
+	auto argint = [&](int n) {
+		return static_cast<int>(arg(n));
+	};
+	while (w < end)
+	{
+		luaL_checkstack(L, 2, "too many values pushed by commands");
+		int used = 0;
+		switch (w[0])
+		{
+			case LC_CMD_PUSHNIL: {
+				lua_pushnil(L);
+				break;
+			}
+			case LC_CMD_PUSHBOOLEAN: {
+				lua_pushboolean(L, arg(0) != 0);
+				used = 1;
+				break;
+			}
+			case LC_CMD_PUSHINTEGER: {
+				lua_pushinteger(L, arg(0));
+				used = 1;
+				break;
+			}
+			case LC_CMD_PUSHNUMBER: {
+				int64_t bits = arg(0);
+				lua_Number n;
+				static_assert(sizeof(n) == sizeof(bits));
+				memcpy(&n, &bits, sizeof(n));
+				lua_pushnumber(L, n);
+				used = 1;
+				break;
+			}
+			case LC_CMD_PUSHSTRING: {
+				lua_pushlstring(L, argstr(0), static_cast<size_t>(arg(1)));
+				used = 2;
+				break;
+			}
+			case LC_CMD_PUSHVALUE: {
+				lua_pushvalue(L, argint(0));
+				used = 1;
+				break;
+			}
+			case LC_CMD_POP: {
+				lua_pop(L, argint(0));
+				used = 1;
+				break;
+			}
+			case LC_CMD_SETTOP: {
+				lua_settop(L, argint(0));
+				used = 1;
+				break;
+			}
+			case LC_CMD_NEWTABLE: {
+				lua_createtable(L, argint(0), argint(1));
+				used = 2;
+				break;
+			}
+			case LC_CMD_GETFIELD: {
+				lua_getfield(L, argint(0), argstr(1));
+				used = 2;
+				break;
+			}
+			case LC_CMD_SETFIELD: {
+				lua_setfield(L, argint(0), argstr(1));
+				used = 2;
+				break;
+			}
+			case LC_CMD_GETI: {
+				lua_geti(L, argint(0), arg(1));
+				used = 2;
+				break;
+			}
+			case LC_CMD_SETI: {
+				lua_seti(L, argint(0), arg(1));
+				used = 2;
+				break;
+			}
+			case LC_CMD_GETGLOBAL: {
+				lua_getglobal(L, argstr(0));
+				used = 1;
+				break;
+			}
+			case LC_CMD_SETGLOBAL: {
+				lua_setglobal(L, argstr(0));
+				used = 1;
+				break;
+			}
+			case LC_CMD_CALL: {
+				lua_call(L, argint(0), argint(1));
+				used = 2;
+				break;
+			}
+			case LC_CMD_READ: {
+				int index = argint(0);
+				if (b->results_used >= b->result_count)
+				{
+					luaL_error(L, "command %d has no room left for its result", static_cast<int>(b->commands_done));
+				}
+				luacoyote_readresult(L, index, &b->results[b->results_used++]);
+				used = 1;
+				break;
+			}
+			default: {
+				luaL_error(L, "command %d has an invalid opcode", static_cast<int>(b->commands_done));
+				break;
+			}
+		}
+		w += used + 1;
+		b->commands_done++;
+	}
+}
+
+/*
+** Runs 'word_count' words of commands in protected mode, writing what
+** LC_CMD_READ commands produce to 'results'. Returns a LUA_* status; on
+** errors the stack is put back as it was before the first command and
+** the error object pushed, same as lua_pcall. 'out_done' (if not null)
+** receives how many commands finished.
+*/
+LUA_API
+int luacoyote_runcommands (
+	lua_State* L,
+	const int64_t* words,
+	int64_t word_count,
+	LuaCoyoteResult* results,
+	int64_t result_count,
+	int64_t* out_done
+);
+int luacoyote_runcommands (
+	lua_State* L,
+	const int64_t* words,
+	int64_t word_count,
+	LuaCoyoteResult* results,
+	int64_t result_count,
+	int64_t* out_done
+)
+{
+	auto b = LuaCoyoteBatch {
+		.words = words,
+		.word_count = word_count,
+		.results = results,
+		.result_count = result_count,
+		.results_used = 0,
+		.commands_done = 0,
+	};
+	auto u = LuaCoyoteUnlocked {luacoyote_runbatch, &b};
+	lua_lock(L);
+	auto status = luaD::pcall(L, luacoyote_unlocked, &u, luaD::savestack(L, L->top.p), 0);
+	lua_unlock(L);
+	if (out_done != nullptr)
+	{
+		*out_done = b.commands_done;
+	}
+	return status;
+}
+
+
+/*
+** Flat tables: a whole table copied to or from caller memory in one call,
+** instead of a lua_next and a few lua_to* calls per entry.
+**
+** The layout is a run of slots, each a tag byte in 'tags' and a 64-bit
+** word in 'values', written in pre-order. A table is a LC_FLAT_TABLE slot
+** whose value holds its array count in the low 32 bits and its hash count
+** in the high 32 bits; it is followed by the array values (keys 1..n
+** implied) and then by the key/value pairs of everything else, each of
+** which may be a table in turn. Integers are stored as they are, floats as
+** the bits of a lua_Number, booleans as their own tags. A string's value is
+** the offset in 'strings' of an int64_t length, followed by its bytes and
+** a NUL, padded so the next length is 8-byte aligned.
+*/
+enum LuaCoyoteFlatTag : uint8_t
+{
+	LC_FLAT_NIL,
+	LC_FLAT_FALSE,
+	LC_FLAT_TRUE,
+	LC_FLAT_INTEGER,
+	LC_FLAT_NUMBER,
+	LC_FLAT_STRING,
+	LC_FLAT_TABLE,
+};
+
+/*
+** Exporting fills at most 'slot_count' slots and 'string_size' bytes and
+** sets the '_used' fields; importing reads the '_used' fields as its
+** extents.
+*/
+struct LuaCoyoteFlatTable
+{
+	uint8_t* tags;
+	int64_t* values;
+	int64_t slot_count;
+	char* strings;
+	int64_t string_size;
+	int64_t slots_used;
+	int64_t strings_used;
+};
+
+/* returned by luacoyote_exporttable when the buffers are too small */
+constexpr int LUACOYOTE_FLAT_SHORT = -1;
+
+struct LuaCoyoteFlatState
+{
+	LuaCoyoteFlatTable* flat;
+	int index;
+	int max_depth;
+	int64_t slot;
+	int64_t bytes;
+};
+
+static int64_t luacoyote_flatput (LuaCoyoteFlatState* f, LuaCoyoteFlatTag tag, int64_t value)
+{
+	auto at = f->slot++;
+	if (at < f->flat->slot_count)
+	{
+		f->flat->tags[at] = tag;
+		f->flat->values[at] = value;
+	}
+	return at;
+}
+
+static void luacoyote_flatwrite (lua_State* L, LuaCoyoteFlatState* f, int index, int depth);
+
+static void luacoyote_flatwritetable (lua_State* L, LuaCoyoteFlatState* f, int index, int depth)
+{
+	if (depth > f->max_depth)
+	{
+		luaL_error(L, "table nested deeper than %d levels", f->max_depth);
+	}
+	luaL_checkstack(L, 3, "table nested too deep");
+	auto head = luacoyote_flatput(f, LC_FLAT_TABLE, 0);
+	auto narr = lua_rawlen(L, index);
+	if (narr > UINT32_MAX)
+	{
+		luaL_error(L, "table too large to export");
+	}
+	for (lua_Unsigned i = 1; i <= narr; i++)
+	{
+		lua_rawgeti(L, index, static_cast<lua_Integer>(i));
+		luacoyote_flatwrite(L, f, lua_gettop(L), depth);
+		lua_pop(L, 1);
+	}
+	uint64_t nhash = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index))
+	{
+		if (lua_isinteger(L, -2))
+		{
+			auto k = static_cast<lua_Unsigned>(lua_tointeger(L, -2));
+			if (k - 1 < narr)
+			{
+				/* already written as part of the array */
+				lua_pop(L, 1);
+				continue;
+			}
+		}
+		int top = lua_gettop(L);
+		luacoyote_flatwrite(L, f, top - 1, depth);
+		luacoyote_flatwrite(L, f, top, depth);
+		nhash++;
+		lua_pop(L, 1);
+	}
+	if (nhash > UINT32_MAX)
+	{
+		luaL_error(L, "table too large to export");
+	}
+	if (head < f->flat->slot_count)
+	{
+		f->flat->values[head] = static_cast<int64_t>(narr | (nhash << 32));
+	}
+}
+
+static void luacoyote_flatwrite (lua_State* L, LuaCoyoteFlatState* f, int index, int depth)
+{
+	switch (lua_type(L, index))
+	{
+		case LUA_TNIL: {
+			luacoyote_flatput(f, LC_FLAT_NIL, 0);
+			break;
+		}
+		case LUA_TBOOLEAN: {
+			luacoyote_flatput(f, lua_toboolean(L, index) ? LC_FLAT_TRUE : LC_FLAT_FALSE, 0);
+			break;
+		}
+		case LUA_TNUMBER: {
+			if (lua_isinteger(L, index))
+			{
+				luacoyote_flatput(f, LC_FLAT_INTEGER, lua_tointeger(L, index));
+			}
+			else
+			{
+				lua_Number n = lua_tonumber(L, index);
+				int64_t bits;
+				static_assert(sizeof(n) == sizeof(bits));
+				memcpy(&bits, &n, sizeof(n));
+				luacoyote_flatput(f, LC_FLAT_NUMBER, bits);
+			}
+			break;
+		}
+		case LUA_TSTRING: {
+			size_t len;
+			const char* s = lua_tolstring(L, index, &len);
+			auto at = f->bytes;
+			auto need = static_cast<int64_t>((sizeof(int64_t) + len + 1 + 7) & ~size_t(7));
+			f->bytes += need;
+			if (f->bytes <= f->flat->string_size)
+			{
+				auto size = static_cast<int64_t>(len);
+				memcpy(f->flat->strings + at, &size, sizeof(size));
+				memcpy(f->flat->strings + at + sizeof(size), s, len);
+				memset(f->flat->strings + at + sizeof(size) + len, 0, need - sizeof(size) - len);
+			}
+			luacoyote_flatput(f, LC_FLAT_STRING, at);
+			break;
+		}
+		case LUA_TTABLE: {
+			luacoyote_flatwritetable(L, f, index, depth + 1);
+			break;
+		}
+		default: {
+			luaL_error(L, "cannot export a %s", luaL_typename(L, index));
+			break;
+		}
+	}
+}
+
+static void luacoyote_flatexport (lua_State* L, void* ud)
+{
+	auto f = static_cast<LuaCoyoteFlatState*>(ud);
+	if (!lua_istable(L, f->index))
+	{
+		luaL_error(L, "cannot export a %s as a table", luaL_typename(L, f->index));
+	}
+	luacoyote_flatwritetable(L, f, f->index, 1);
+}
+
+/*
+** Writes the table at 'index' and everything in it to 'flat'. Returns a
+** LUA_* status, with the error pushed as lua_pcall would, or
+** LUACOYOTE_FLAT_SHORT when the slots or string bytes ran out; either way
+** the '_used' fields then tell how much a complete copy needs, so the
+** caller can grow its buffers and try again.
+*/
+LUA_API
+int luacoyote_exporttable (lua_State* L, int index, LuaCoyoteFlatTable* flat, int max_depth);
+int luacoyote_exporttable (lua_State* L, int index, LuaCoyoteFlatTable* flat, int max_depth)
+{
+	auto f = LuaCoyoteFlatState {
+		.flat = flat,
+		.index = lua_absindex(L, index),
+		.max_depth = max_depth,
+		.slot = 0,
+		.bytes = 0,
+	};
+	auto u = LuaCoyoteUnlocked {luacoyote_flatexport, &f};
+	lua_lock(L);
+	auto status = luaD::pcall(L, luacoyote_unlocked, &u, luaD::savestack(L, L->top.p), 0);
+	lua_unlock(L);
+	flat->slots_used = f.slot;
+	flat->strings_used = f.bytes;
+	if (status == LUA_OK && (f.slot > flat->slot_count || f.bytes > flat->string_size))
+	{
+		return LUACOYOTE_FLAT_SHORT;
+	}
+	return status;
+}
+
+static void luacoyote_flatread (lua_State* L, LuaCoyoteFlatState* f, int depth)
+{
+	auto flat = f->flat;
+	if (f->slot >= flat->slots_used)
+	{
+		luaL_error(L, "flat table is cut off at slot %d", static_cast<int>(f->slot));
+	}
+	auto at = f->slot++;
+	auto value = flat->values[at];
+	switch (flat->tags[at])
+	{
+		case LC_FLAT_NIL: {
+			lua_pushnil(L);
+			break;
+		}
+		case LC_FLAT_FALSE:
+		case LC_FLAT_TRUE: {
+			lua_pushboolean(L, flat->tags[at] == LC_FLAT_TRUE);
+			break;
+		}
+		case LC_FLAT_INTEGER: {
+			lua_pushinteger(L, value);
+			break;
+		}
+		case LC_FLAT_NUMBER: {
+			lua_Number n;
+			memcpy(&n, &value, sizeof(n));
+			lua_pushnumber(L, n);
+			break;
+		}
+		case LC_FLAT_STRING: {
+			int64_t len;
+			if (value < 0 || flat->strings_used - value < static_cast<int64_t>(sizeof(len)))
+			{
+				luaL_error(L, "string at slot %d is out of bounds", static_cast<int>(at));
+			}
+			memcpy(&len, flat->strings + value, sizeof(len));
+			if (len < 0 || flat->strings_used - value - static_cast<int64_t>(sizeof(len)) < len)
+			{
+				luaL_error(L, "string at slot %d is out of bounds", static_cast<int>(at));
+			}
+			lua_pushlstring(L, flat->strings + value + sizeof(len), static_cast<size_t>(len));
+			break;
+		}
+		case LC_FLAT_TABLE: {
+			if (depth + 1 > f->max_depth)
+			{
+				luaL_error(L, "table nested deeper than %d levels", f->max_depth);
+			}
+			luaL_checkstack(L, 3, "table nested too deep");
+			auto narr = static_cast<uint32_t>(value);
+			auto nhash = static_cast<uint32_t>(static_cast<uint64_t>(value) >> 32);
+			lua_createtable(L, static_cast<int>(narr), static_cast<int>(nhash));
+			int t = lua_gettop(L);
+			for (uint32_t i = 1; i <= narr; i++)
+			{
+				luacoyote_flatread(L, f, depth + 1);
+				if (lua_isnil(L, -1))
+				{
+					lua_pop(L, 1);
+				}
+				else
+				{
+					lua_rawseti(L, t, i);
+				}
+			}
+			for (uint32_t i = 0; i < nhash; i++)
+			{
+				luacoyote_flatread(L, f, depth + 1);
+				luacoyote_flatread(L, f, depth + 1);
+				if (lua_isnil(L, -1))
+				{
+					lua_pop(L, 2);
+				}
+				else
+				{
+					lua_rawset(L, t);
+				}
+			}
+			break;
+		}
+		default: {
+			luaL_error(L, "slot %d has an invalid tag", static_cast<int>(at));
+			break;
+		}
+	}
+}
+
+static void luacoyote_flatimport (lua_State* L, void* ud)
+{
+	auto f = static_cast<LuaCoyoteFlatState*>(ud);
+	if (f->flat->slots_used < 1 || f->flat->tags[0] != LC_FLAT_TABLE)
+	{
+		luaL_error(L, "flat data does not start with a table");
+	}
+	luacoyote_flatread(L, f, 0);
+}
+
+/*
+** Builds the table laid out in 'flat' (see luacoyote_exporttable) and
+** pushes it. Returns a LUA_* status; the layout is checked against the
+** '_used' extents, and anything malformed is a regular error.
+*/
+LUA_API
+int luacoyote_importtable (lua_State* L, const LuaCoyoteFlatTable* flat, int max_depth);
+int luacoyote_importtable (lua_State* L, const LuaCoyoteFlatTable* flat, int max_depth)
+{
+	auto f = LuaCoyoteFlatState {
+		.flat = const_cast<LuaCoyoteFlatTable*>(flat),
+		.index = 0,
+		.max_depth = max_depth,
+		.slot = 0,
+		.bytes = 0,
+	};
+	auto u = LuaCoyoteUnlocked {luacoyote_flatimport, &f};
+	lua_lock(L);
+	auto status = luaD::pcall(L, luacoyote_unlocked, &u, luaD::savestack(L, L->top.p), 0);
+	lua_unlock(L);
+	return status;
+}
+
+
+/*
+** Typed functions: host functions that get their arguments already read
+** into an array of LuaCoyoteResult (laid out as for LC_CMD_READ) and hand
+** their results back the same way, so a call from Lua into the host needs
+** no calls back into the library in the common case.
+**
+** The signature is a string with one letter per argument: 'i' integer,
+** 'n' number, 's' string (pointer and length), 'b' boolean (anything, read
+** for truth) and 'u' userdata (full or light, as its address). A '?' after
+** a letter makes that argument optional; missing ones come through with
+** type LUA_TNIL. Arguments past the signature stay on the stack.
+**
+** The function returns how many result slots it filled. Slots of type
+** LUA_TNIL, LUA_TBOOLEAN, LUA_TNUMBER (integer when 'size' is 1), LUA_TSTRING
+** and LUA_TLIGHTUSERDATA are pushed as described; a slot of type LUA_TNONE
+** takes the next value the function pushed itself, in order, for anything
+** else. A negative return raises results[0] as an error, either a string
+** or (as LUA_TNONE, which it is until the function sets it) the first
+** value the function pushed.
+*/
+using LuaCoyoteTypedFunction = auto (lua_State* L, const LuaCoyoteResult* args, LuaCoyoteResult* results) -> int;
+
+constexpr int LUACOYOTE_TYPED_MAXARGS = 8;
+constexpr int LUACOYOTE_TYPED_MAXRESULTS = 8;
+
+enum LuaCoyoteArgType : char
+{
+	LC_ARG_INTEGER = 'i',
+	LC_ARG_NUMBER = 'n',
+	LC_ARG_STRING = 's',
+	LC_ARG_BOOLEAN = 'b',
+	LC_ARG_USERDATA = 'u',
+	LC_ARG_OPTIONAL = '?',
+};
+
+static void luacoyote_typedarg (lua_State* L, int arg, char code, bool optional, LuaCoyoteResult* r)
+{
+	r->size = 0;
+	r->value.pointer = nullptr;
+	if (optional && lua_isnoneornil(L, arg))
+	{
+		r->type = LUA_TNIL;
+		return;
+	}
+	switch (code)
+	{
+		case LC_ARG_INTEGER: {
+			r->type = LUA_TNUMBER;
+			r->size = 1;
+			r->value.integer = luaL_checkinteger(L, arg);
+			break;
+		}
+		case LC_ARG_NUMBER: {
+			r->type = LUA_TNUMBER;
+			r->value.number = luaL_checknumber(L, arg);
+			break;
+		}
+		case LC_ARG_STRING: {
+			size_t len;
+			r->type = LUA_TSTRING;
+			r->value.pointer = luaL_checklstring(L, arg, &len);
+			r->size = static_cast<int64_t>(len);
+			break;
+		}
+		case LC_ARG_BOOLEAN: {
+			r->type = LUA_TBOOLEAN;
+			r->value.integer = lua_toboolean(L, arg);
+			break;
+		}
+		case LC_ARG_USERDATA: {
+			if (!lua_isuserdata(L, arg))
+			{
+				luaL_typeerror(L, arg, "userdata");
+			}
+			r->type = lua_type(L, arg);
+			r->value.pointer = lua_touserdata(L, arg);
+			break;
+		}
+	}
+}
+
+static void luacoyote_typedpush (lua_State* L, int i, const LuaCoyoteResult* r)
+{
+	switch (r->type)
+	{
+		case LUA_TNIL: {
+			lua_pushnil(L);
+			break;
+		}
+		case LUA_TBOOLEAN: {
+			lua_pushboolean(L, r->value.integer != 0);
+			break;
+		}
+		case LUA_TNUMBER: {
+			if (r->size == 1)
+			{
+				lua_pushinteger(L, r->value.integer);
+			}
+			else
+			{
+				lua_pushnumber(L, r->value.number);
+			}
+			break;
+		}
+		case LUA_TSTRING: {
+			lua_pushlstring(L, static_cast<const char*>(r->value.pointer), static_cast<size_t>(r->size));
+			break;
+		}
+		case LUA_TLIGHTUSERDATA: {
+			lua_pushlightuserdata(L, const_cast<void*>(r->value.pointer));
+			break;
+		}
+		default: {
+			luaL_error(L, "result %d has an unsupported type", i + 1);
+			break;
+		}
+	}
+}
+
+/*
+** upvalue 1 is the host function, upvalue 2 the checked signature
+*/
+static int luacoyote_typedcall (lua_State* L)
+{
+	auto f = reinterpret_cast<LuaCoyoteTypedFunction*>(lua_touserdata(L, lua_upvalueindex(1)));
+	size_t siglen;
+	const char* sig = lua_tolstring(L, lua_upvalueindex(2), &siglen);
+	LuaCoyoteResult args[LUACOYOTE_TYPED_MAXARGS];
+	LuaCoyoteResult results[LUACOYOTE_TYPED_MAXRESULTS];
+	int n = 0;
+	for (size_t i = 0; i < siglen; i++)
+	{
+		bool optional = i + 1 < siglen && sig[i + 1] == LC_ARG_OPTIONAL;
+		luacoyote_typedarg(L, n + 1, sig[i], optional, &args[n]);
+		n++;
+		i += optional;
+	}
+	int base = lua_gettop(L);
+	results[0].type = LUA_TNONE; /* in case an error leaves it unset */
+	int nres = f(L, args, results);
+	if (nres < 0)
+	{
+		if (results[0].type == LUA_TSTRING)
+		{
+			lua_pushlstring(L, static_cast<const char*>(results[0].value.pointer), static_cast<size_t>(results[0].size));
+		}
+		else if (results[0].type == LUA_TNONE && lua_gettop(L) > base)
+		{
+			lua_pushvalue(L, base + 1);
+		}
+		else
+		{
+			lua_pushliteral(L, "error in typed function");
+		}
+		return lua_error(L);
+	}
+	if (nres > LUACOYOTE_TYPED_MAXRESULTS)
+	{
+		return luaL_error(L, "typed function returned %d results, more than %d", nres, LUACOYOTE_TYPED_MAXRESULTS);
+	}
+	luaL_checkstack(L, nres, "too many results");
+	/* values the function pushed itself, taken by LUA_TNONE slots */
+	int pushed = lua_gettop(L) - base;
+	int taken = 0;
+	for (int i = 0; i < nres; i++)
+	{
+		if (results[i].type == LUA_TNONE)
+		{
+			if (taken >= pushed)
+			{
+				return luaL_error(L, "result %d has no pushed value to take", i + 1);
+			}
+			lua_pushvalue(L, base + 1 + taken++);
+		}
+		else
+		{
+			luacoyote_typedpush(L, i, &results[i]);
+		}
+	}
+	return nres;
+}
+
+/*
+** Pushes 'f' as a Lua function taking arguments by 'signature'. Returns 1,
+** or 0 without pushing anything if the signature is malformed or longer
+** than LUACOYOTE_TYPED_MAXARGS.
+*/
+LUA_API
+int luacoyote_pushtyped (lua_State* L, LuaCoyoteTypedFunction* f, const char* signature);
+int luacoyote_pushtyped (lua_State* L, LuaCoyoteTypedFunction* f, const char* signature)
+{
+	int n = 0;
+	for (const char* c = signature; *c != '\0'; c++)
+	{
+		switch (*c)
+		{
+			case LC_ARG_INTEGER:
+			case LC_ARG_NUMBER:
+			case LC_ARG_STRING:
+			case LC_ARG_BOOLEAN:
+			case LC_ARG_USERDATA: {
+				n++;
+				if (c[1] == LC_ARG_OPTIONAL)
+				{
+					c++;
+				}
+				break;
+			}
+			default: {
+				return 0;
+			}
+		}
+	}
+	if (n > LUACOYOTE_TYPED_MAXARGS)
+	{
+		return 0;
+	}
+	lua_pushlightuserdata(L, reinterpret_cast<void*>(f));
+	lua_pushstring(L, signature);
+	lua_pushcclosure(L, luacoyote_typedcall, 2);
+	return 1;
+}
+
 }
 
-#endif
\ No newline at end of file
+#endif
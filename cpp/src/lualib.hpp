@@ -50,6 +50,30 @@ LUAMOD_API int (luaopen_package) (lua_State *L);
 
 #define LUA_BUFFERNAME	"buffer"
 LUALIB_API int createbufferlib (lua_State* L);
+LUALIB_API void* coyote_tobuffer (lua_State* L, int idx, size_t* out_size);
+LUALIB_API void* coyote_newbuffer (lua_State* L, size_t size);
+
+#define LUA_ARRAYNAME	"array"
+#define COYOTE_ARRAY_F32	0
+#define COYOTE_ARRAY_F64	1
+#define COYOTE_ARRAY_I32	2
+LUALIB_API int createarraylib (lua_State* L);
+LUALIB_API void* coyote_pusharray (lua_State* L, void* data, size_t count, int type);
+LUALIB_API void* coyote_toarray (lua_State* L, int idx, size_t* out_count, int* out_type);
+LUALIB_API int coyote_isarrayview (lua_State* L, int idx);
+LUALIB_API void coyote_detacharray (lua_State* L, int idx);
+
+#define LUA_LANESNAME	"lanes"
+LUALIB_API int createlaneslib (lua_State* L);
+
+#define LUA_FROZENNAME	"frozen"
+LUALIB_API int createfrozenlib (lua_State* L);
+LUALIB_API void* coyote_tofrozen (lua_State* L, int idx, size_t* out_table);
+LUALIB_API void coyote_pushfrozen (lua_State* L, void* image, size_t table);
+LUALIB_API void coyote_releasefrozen (void* image);
+
+#define LUA_PROFILENAME	"profile"
+LUALIB_API int createprofilelib (lua_State* L);
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
@@ -2064,6 +2064,27 @@ returning: /* trap already set */
 				updatetrap(ci); /* allows a signal to break the loop */
 				vmbreak;
 			}
+		vmcase(OP_FORLOOP1)
+			{
+				/* same as OP_FORLOOP, with a step known to be 1 */
+				StkId ra = RA(i);
+				if (l_likely(ttisinteger(s2v(ra + 2))))
+				{
+					lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
+					if (count > 0)
+					{
+						lua_Integer idx = intop(+, ivalue(s2v(ra)), 1);
+						chgivalue(s2v(ra + 1), count - 1);
+						chgivalue(s2v(ra), idx);
+						setivalue(s2v(ra + 3), idx);
+						pc -= GETARG_Bx(i);
+					}
+				}
+				else if (floatforloop(ra)) /* float initial value */
+					pc -= GETARG_Bx(i);
+				updatetrap(ci);
+				vmbreak;
+			}
 		vmcase(OP_FORPREP)
 			{
 				StkId ra = RA(i);
@@ -2092,6 +2113,47 @@ returning: /* trap already set */
 						to-be-closed variable. The call will use the stack after
 						these values (starting at 'ra + 4')
 					*/
+					if (ttislcf(s2v(ra)) && !L->hookmask)
+					{
+						/* run the stock iterators in place, without a call */
+						lua_CFunction f = fvalue(s2v(ra));
+						if (f == G(L)->iterators[LUA_ITERIPAIRS] &&
+							 ttisinteger(s2v(ra + 2)))
+						{
+							lua_Integer n = intop(+, ivalue(s2v(ra + 2)), 1);
+							const TValue *slot;
+							if (luaV_fastgeti(L, s2v(ra + 1), n, slot))
+							{
+								setivalue(s2v(ra + 4), n);
+								setobj2s(L, ra + 5, slot);
+								goto l_tforinline;
+							}
+							/* end of the array or '__index': do the call */
+						}
+						else if (f == G(L)->iterators[LUA_ITERNEXT] &&
+									ttistable(s2v(ra + 1)) &&
+									(ttisnil(s2v(ra + 3)) || ttisinteger(s2v(ra + 3))))
+						{
+							/* 'ra + 3' is not to be closed, so it keeps the
+								traversal position of the control variable */
+							unsigned int pos;
+							int more;
+							pos = ttisnil(s2v(ra + 3)) ? 0 : cast_uint(ivalue(s2v(ra + 3)));
+							setobjs2s(L, ra + 4, ra + 2);
+							halfProtect(more = luaH_nextat(L, hvalue(s2v(ra + 1)),
+																	 ra + 4, &pos));
+							if (!more)
+								setnilvalue(s2v(ra + 4)); /* end of the loop */
+							setivalue(s2v(ra + 3), pos);
+						l_tforinline:
+							updatetrap(ci); /* as after a call, for hooks and samples */
+							for (int k = 2; k < GETARG_C(i); k++)
+								setnilvalue(s2v(ra + 4 + k));
+							i = *(pc++); /* go to next instruction */
+							lua_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
+							goto l_tforloop;
+						}
+					}
 					/* push function, state, and control variable */
 					memcpy(ra + 4, ra, 3 * sizeof(*ra));
 					L->top.p = ra + 4 + 3;
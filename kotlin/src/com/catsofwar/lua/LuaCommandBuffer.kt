@@ -0,0 +1,180 @@
+package com.catsofwar.lua
+
+import com.catsofwar.lua.enums.LuaError
+import com.catsofwar.lua.enums.LuaType
+import java.lang.foreign.Arena
+import java.lang.foreign.MemorySegment
+import java.lang.foreign.ValueLayout.*
+
+/**
+* A run of stack operations done in a single call into the dll instead of one
+* call each (see `luacoyote_runcommands`). Building one doesn't touch any Lua
+* state, and the strings it's given stay in [arena], so it can be built once
+* and [run] as many times as needed.
+*
+* Values put aside with [read] can be looked at after a run with [typeAt],
+* [integerAt], [numberAt], [booleanAt] and [stringAt]. Strings point into Lua
+* memory, so read them before the values leave the stack.
+*/
+class LuaCommandBuffer(private val arena: Arena = Arena.ofAuto())
+{
+	private var words = LongArray(64)
+	private var wordCount = 0
+	private var nativeWords = MemorySegment.NULL
+	private var nativeDirty = true
+	private var results = MemorySegment.NULL
+	private val strings = HashMap<String, MemorySegment>()
+
+	/** how many values [read] puts aside each run */
+	var readCount = 0
+		private set
+
+	/** how many commands finished during the last run */
+	var commandsDone = 0L
+		private set
+
+	private fun op(vararg w: Long)
+	{
+		if (wordCount + w.size > words.size)
+		{
+			words = words.copyOf(maxOf(words.size * 2, wordCount + w.size))
+		}
+		w.copyInto(words, wordCount)
+		wordCount += w.size
+		nativeDirty = true
+	}
+
+	private fun cString(s: String): MemorySegment
+	{
+		return strings.getOrPut(s) { arena.allocateFrom(s) }
+	}
+
+	fun pushNil() = op(PUSHNIL)
+	fun pushBoolean(v: Boolean) = op(PUSHBOOLEAN, if (v) 1L else 0L)
+	fun pushInteger(v: Long) = op(PUSHINTEGER, v)
+	fun pushNumber(v: Double) = op(PUSHNUMBER, v.toRawBits())
+
+	fun pushString(s: String)
+	{
+		val c = cString(s)
+		// allocateFrom adds a terminator, which isn't part of the string
+		op(PUSHSTRING, c.address(), c.byteSize() - 1)
+	}
+
+	fun pushValue(index: Int) = op(PUSHVALUE, index.toLong())
+	fun pop(count: Int = 1) = op(POP, count.toLong())
+	fun setTop(index: Int) = op(SETTOP, index.toLong())
+	fun newTable(arraySize: Int = 0, hashSize: Int = 0) = op(NEWTABLE, arraySize.toLong(), hashSize.toLong())
+	fun getField(index: Int, name: String) = op(GETFIELD, index.toLong(), cString(name).address())
+	fun setField(index: Int, name: String) = op(SETFIELD, index.toLong(), cString(name).address())
+	fun getI(index: Int, key: Long) = op(GETI, index.toLong(), key)
+	fun setI(index: Int, key: Long) = op(SETI, index.toLong(), key)
+	fun getGlobal(name: String) = op(GETGLOBAL, cString(name).address())
+	fun setGlobal(name: String) = op(SETGLOBAL, cString(name).address())
+	fun call(argc: Int, retc: Int = -1) = op(CALL, argc.toLong(), retc.toLong())
+
+	/**
+	* Puts aside the value at [index] when run.
+	* @return the slot it'll be in
+	*/
+	fun read(index: Int): Int
+	{
+		op(READ, index.toLong())
+		return readCount++
+	}
+
+	fun clear()
+	{
+		wordCount = 0
+		readCount = 0
+		nativeDirty = true
+	}
+
+	fun run(lua: LuaCoyote): LuaError
+	{
+		if (nativeDirty)
+		{
+			nativeWords = arena.allocate(JAVA_LONG, maxOf(wordCount, 1).toLong())
+			MemorySegment.copy(words, 0, nativeWords, JAVA_LONG, 0L, wordCount)
+			nativeDirty = false
+		}
+		if (results.byteSize() < RESULT_SIZE * readCount)
+		{
+			results = arena.allocate(RESULT_SIZE * readCount, JAVA_LONG.byteAlignment())
+		}
+		confinedArena { f ->
+			val done = f.allocate(JAVA_LONG)
+			val status = LuaCoyote.dll.luacoyote_runcommands(
+				lua.state,
+				nativeWords,
+				wordCount.toLong(),
+				results,
+				readCount.toLong(),
+				done,
+			) as Int
+			commandsDone = done[JAVA_LONG, 0L]
+			return LuaError(status)
+		}
+	}
+
+	private fun slot(i: Int): Long
+	{
+		if (i !in 0..<readCount)
+			throw IndexOutOfBoundsException("No result slot $i")
+		return RESULT_SIZE * i
+	}
+
+	fun typeAt(i: Int) = LuaType(results[JAVA_LONG, slot(i)].toInt())
+
+	fun integerAt(i: Int): Long
+	{
+		val at = slot(i)
+		if (results[JAVA_LONG, at + 8L] == 0L)
+			return results[JAVA_DOUBLE, at + 16L].toLong()
+		return results[JAVA_LONG, at + 16L]
+	}
+
+	fun numberAt(i: Int): Double
+	{
+		val at = slot(i)
+		if (results[JAVA_LONG, at + 8L] != 0L)
+			return results[JAVA_LONG, at + 16L].toDouble()
+		return results[JAVA_DOUBLE, at + 16L]
+	}
+
+	fun booleanAt(i: Int) = results[JAVA_LONG, slot(i) + 16L] != 0L
+
+	fun stringAt(i: Int): String?
+	{
+		if (typeAt(i) != LuaType.STRING)
+			return null
+		val at = slot(i)
+		val size = results[JAVA_LONG, at + 8L]
+		return String(results[ADDRESS, at + 16L].reinterpret(size).toArray(JAVA_BYTE))
+	}
+
+	companion object
+	{
+		// must match LuaCoyoteCommand in luacoyote.hpp
+		private const val PUSHNIL = 0L
+		private const val PUSHBOOLEAN = 1L
+		private const val PUSHINTEGER = 2L
+		private const val PUSHNUMBER = 3L
+		private const val PUSHSTRING = 4L
+		private const val PUSHVALUE = 5L
+		private const val POP = 6L
+		private const val SETTOP = 7L
+		private const val NEWTABLE = 8L
+		private const val GETFIELD = 9L
+		private const val SETFIELD = 10L
+		private const val GETI = 11L
+		private const val SETI = 12L
+		private const val GETGLOBAL = 13L
+		private const val SETGLOBAL = 14L
+		private const val CALL = 15L
+		private const val READ = 16L
+
+		// sizeof(LuaCoyoteResult)
+		private const val RESULT_SIZE = 24L
+	}
+}
@@ -90,41 +90,44 @@ internal constructor(internal val state: MemorySegment) : AutoCloseable, Arena
 		}
 	}
 
+	/**
+	* `luacoyote_tolstring` leaves the length in the state's scratch word,
+	* so string reads don't need an arena for the out-parameter.
+	*/
+	private fun lastStringLength(): Long
+	{
+		return MemorySegment.ofAddress(state.address() + scratchOffset).reinterpret(JAVA_LONG.byteSize())[JAVA_LONG, 0L]
+	}
+
 	fun asStringMemorySegment(index: Int): MemorySegment
 	{
-		confinedArena { arena ->
-			val slen = arena.allocate(JAVA_INT)
-			val adr = dll.lua_tolstring(state, index, slen) as MemorySegment
-			if (adr == MemorySegment.NULL)
-			{
-				return MemorySegment.NULL
-			}
-			val sls = slen[JAVA_INT, 0L]
-			if (sls <= 0)
-			{
-				return MemorySegment.NULL
-			}
-			return adr.reinterpret(sls.toLong()).asReadOnly()
+		val adr = dll.luacoyote_tolstring(state, index) as MemorySegment
+		if (adr == MemorySegment.NULL)
+		{
+			return MemorySegment.NULL
+		}
+		val sls = lastStringLength()
+		if (sls <= 0)
+		{
+			return MemorySegment.NULL
 		}
+		return adr.reinterpret(sls).asReadOnly()
 	}
 
 	fun asString(index: Int): String?
 	{
-		confinedArena { arena ->
-			val slen = arena.allocate(JAVA_INT)
-			val adr = dll.lua_tolstring(state, index, slen) as MemorySegment
-			if (adr == MemorySegment.NULL)
-			{
-				return null
-			}
-			val sls = slen[JAVA_INT, 0L]
-			if (sls <= 0)
-			{
-				return ""
-			}
-
-			return String(adr.reinterpret(sls.toLong()).toArray(JAVA_BYTE))
+		val adr = dll.luacoyote_tolstring(state, index) as MemorySegment
+		if (adr == MemorySegment.NULL)
+		{
+			return null
+		}
+		val sls = lastStringLength()
+		if (sls <= 0)
+		{
+			return ""
 		}
+
+		return String(adr.reinterpret(sls).toArray(JAVA_BYTE))
 	}
 
 	fun asNumber(index: Int): Double
@@ -169,6 +172,11 @@ internal constructor(internal val state: MemorySegment) : AutoCloseable, Arena
 		OHFUCK(pCall(argc, resc))
 	}
 
+	fun runCommands(commands: LuaCommandBuffer): LuaError
+	{
+		return commands.run(this)
+	}
+
 	fun loadFile(path: Path): Int
 	{
 		return loadFile(path.absolutePathString())
@@ -186,6 +194,23 @@ internal constructor(internal val state: MemorySegment) : AutoCloseable, Arena
 		dll.lua_close(state)
 	}
 
+	/**
+	* A new state with its own copy of this one's globals, registry and
+	* loaded modules, much faster than running the same setup again. This
+	* state has to be idle; it isn't changed, so several threads may clone
+	* it at once.
+	*/
+	fun clone(): LuaCoyote
+	{
+		confinedArena { arena ->
+			val message = arena.allocate(256)
+			val copy = dll.lua_clonestate(state, message, 256L) as MemorySegment
+			if (copy == MemorySegment.NULL)
+				throw RuntimeException("Could not clone state: ${message.getString(0L)}")
+			return LuaCoyote(copy)
+		}
+	}
+
 
 	var top: Int
 		get()
@@ -467,6 +492,29 @@ internal constructor(internal val state: MemorySegment) : AutoCloseable, Arena
 		dll.lua_pushcclosure(state, handle, upvalueCount)
 	}
 
+	/**
+	* Pushes [f] with its arguments read for it by [signature]: one of
+	* `i`, `n`, `s`, `b` or `u` (integer, number, string, boolean, userdata)
+	* per argument, each optionally followed by `?`.
+	*/
+	fun pushTyped(signature: String, f: LuaTypedFunction)
+	{
+		checkStack(3)
+
+		val handle = linker.upcallStub(
+			LuaDll.typedHandle.bindTo(f),
+			LuaDll.typedDesc,
+			this
+		)
+
+		confinedArena { arena ->
+			if (dll.luacoyote_pushtyped(state, handle, arena.allocateFrom(signature)) as Int == 0)
+			{
+				throw IllegalArgumentException("Bad typed function signature \"$signature\"")
+			}
+		}
+	}
+
 	fun register(name: String, upvalueCount: Int, f: LuaCFunction)
 	{
 		checkStack(1)
@@ -868,6 +916,7 @@ internal constructor(internal val state: MemorySegment) : AutoCloseable, Arena
 		@JvmStatic
 		internal lateinit var dll: LuaDll
 		internal var registryIndex: Int = 0
+		internal var scratchOffset: Long = 0
 
 		private fun createState(): MemorySegment
 		{
@@ -881,6 +930,7 @@ internal constructor(internal val state: MemorySegment) : AutoCloseable, Arena
 				return
 			dll = LuaDll.createDllInst()
 			registryIndex = dll.luacoyote_get_registry_index() as Int
+			scratchOffset = (dll.luacoyote_get_scratch_offset() as Int).toLong()
 			initialized = true
 		}
 
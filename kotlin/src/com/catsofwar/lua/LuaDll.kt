@@ -81,6 +81,19 @@ internal class LuaDll private constructor()
 			invokeDesc.toMethodType()
 		)
 
+		internal val typedDesc = FunctionDescriptor.of(
+			JAVA_INT,
+			ADDRESS,
+			ADDRESS,
+			ADDRESS,
+		)
+
+		internal val typedHandle = MethodHandles.lookup().findVirtual(
+			LuaTypedFunction::class.java,
+			"invoke",
+			typedDesc.toMethodType()
+		)
+
 	}
 
 	//#region lua.h
@@ -92,6 +105,27 @@ internal class LuaDll private constructor()
 
 	val lua_newthread by method(LUA_STATE, LUA_STATE)
 
+	/**
+	* a new state with its own copy of everything in an idle template state,
+	* or NULL with the reason written to the message buffer
+	*/
+	val lua_clonestate by method(
+		LUA_STATE,
+		LUA_STATE.withName("From"),
+		ADDRESS.withName("char* message"),
+		JAVA_LONG.withName("size_t size"),
+	)
+
+	/**
+	* how many dead threads are kept for lua_newthread to reuse, and the
+	* stack size they're kept at
+	*/
+	val lua_setthreadcache by voidMethod(
+		LUA_STATE,
+		JAVA_INT.withName("count"),
+		JAVA_INT.withName("stacksize"),
+	)
+
 	//#endregion
 
 	//#region basic stack manipulation
@@ -446,6 +480,17 @@ internal class LuaDll private constructor()
 		ADDRESS.withName("const char* mode"),
 	)
 
+	val lua_loadimage by method(
+		JAVA_INT,
+		LUA_STATE,
+		ADDRESS.withName("const void* data"),
+		JAVA_LONG.withName("size_t size"),
+		ADDRESS.withName("const char* chunkName"),
+		ADDRESS.withName("const char* mode"),
+		ADDRESS.withName("lua_ImageRelease release"),
+		ADDRESS.withName("void* ud"),
+	)
+
 	val lua_dump by method(
 		JAVA_INT,
 		LUA_STATE,
@@ -454,6 +499,14 @@ internal class LuaDll private constructor()
 		JAVA_INT.withName("strip"),
 	)
 
+	val lua_dumpimage by method(
+		JAVA_INT,
+		LUA_STATE,
+		ADDRESS.withName("lua_LuaWriter writer"),
+		ADDRESS.withName("void* data"),
+		JAVA_INT.withName("strip"),
+	)
+
 	val luaL_loadfilex by method(
 		JAVA_INT,
 		LUA_STATE,
@@ -461,6 +514,23 @@ internal class LuaDll private constructor()
 		ADDRESS.withName("mode"),
 	)
 
+	val luaL_setchunkcache by voidMethod(
+		LUA_STATE,
+		ADDRESS.withName("const char* dir"),
+	)
+
+	/**
+	* compiles [n] text files on worker threads for their next
+	* luaL_loadfilex; returns how many compiled
+	*/
+	val luaL_prefetch by method(
+		JAVA_INT,
+		LUA_STATE,
+		ADDRESS.withName("const char** files"),
+		JAVA_INT.withName("n"),
+		ADDRESS.withName("mode"),
+	)
+
 	//#endregion
 
 	//#region warning related functions
@@ -492,6 +562,48 @@ internal class LuaDll private constructor()
 		ADDRESS.withName("const char*")
 	)
 
+	val LUA_ITERIPAIRS = 0
+	val LUA_ITERNEXT = 1
+
+	/**
+	* registers the stock iterator [what] so generic for loops over it
+	* can run without calling it
+	*/
+	val lua_setiterator by voidMethod(
+		LUA_STATE,
+		JAVA_INT.withName("what"),
+		ADDRESS.withName("lua_CFunction f"),
+	)
+
+
+	//#endregion
+
+	//#region sampling profiler
+
+	val LUA_PROFILEFUNC = 0
+	val LUA_PROFILELINE = 1
+
+	/**
+	* samples the calling thread every [interval] microseconds until
+	* stopped; LUA_OK, or an error with its message pushed
+	*/
+	val lua_profilestart by method(
+		JAVA_INT,
+		LUA_STATE,
+		JAVA_INT.withName("interval"),
+		JAVA_INT.withName("mode"),
+	)
+
+	val lua_profilestop by voidMethod(LUA_STATE)
+
+	/**
+	* pushes the samples as collapsed stacks for flame graph tools
+	*/
+	val lua_profiledump by method(
+		ADDRESS,
+		LUA_STATE,
+		JAVA_INT.withName("reset"),
+	)
 
 	//#endregion
 
@@ -563,6 +675,71 @@ internal class LuaDll private constructor()
 	*/
 	val luaL_openlibs by voidMethod(LUA_STATE)
 
+	val LUA_ARRAYNAME = "array"
+	val COYOTE_ARRAY_F32 = 0
+	val COYOTE_ARRAY_F64 = 1
+	val COYOTE_ARRAY_I32 = 2
+
+	val createarraylib by toOpenLib()
+
+	/**
+	* wraps host memory as a typed array; [data] has to outlive the array or
+	* be cut off with coyote_detacharray first. NULL makes Lua own the memory
+	*/
+	val coyote_pusharray by method(
+		ADDRESS,
+		LUA_STATE,
+		ADDRESS.withName("data"),
+		JAVA_LONG.withName("count"),
+		JAVA_INT.withName("type"),
+	)
+
+	val coyote_toarray by method(
+		ADDRESS,
+		LUA_STATE,
+		JAVA_INT.withName("index"),
+		ADDRESS.withName("size_t* out_count"),
+		ADDRESS.withName("int* out_type"),
+	)
+
+	val coyote_detacharray by voidMethod(
+		LUA_STATE,
+		JAVA_INT.withName("index"),
+	)
+
+	val LUA_LANESNAME = "lanes"
+
+	val createlaneslib by toOpenLib()
+
+	val LUA_FROZENNAME = "frozen"
+
+	val createfrozenlib by toOpenLib()
+
+	/**
+	* the image behind a frozen table, referenced for the caller, or NULL.
+	* push it into any state with coyote_pushfrozen, then release it
+	*/
+	val coyote_tofrozen by method(
+		ADDRESS,
+		LUA_STATE,
+		JAVA_INT.withName("index"),
+		ADDRESS.withName("size_t* out_table"),
+	)
+
+	val coyote_pushfrozen by voidMethod(
+		LUA_STATE,
+		ADDRESS.withName("image"),
+		JAVA_LONG.withName("table"),
+	)
+
+	val coyote_releasefrozen by voidMethod(
+		ADDRESS.withName("image"),
+	)
+
+	val LUA_PROFILENAME = "profile"
+
+	val createprofilelib by toOpenLib()
+
 
 	//#endregion
 
@@ -572,6 +749,7 @@ internal class LuaDll private constructor()
 	val luacoyote_get_ridx_mainthread by method(JAVA_INT)
 	val luacoyote_get_ridx_globals by method(JAVA_INT)
 	val luacoyote_get_ridx_last by method(JAVA_INT)
+	val luacoyote_get_scratch_offset by method(JAVA_INT)
 
 
 	val luacoyote_get_upval_index by method(
@@ -624,6 +802,44 @@ internal class LuaDll private constructor()
 	val luacoyote_isnone by chFunc()
 	val luacoyote_isnoneornil by chFunc()
 
+	val luacoyote_tolstring by method(
+		ADDRESS,
+		LUA_STATE,
+		JAVA_INT.withName("index"),
+	)
+
+	val luacoyote_runcommands by method(
+		JAVA_INT,
+		LUA_STATE,
+		ADDRESS.withName("const int64_t* words"),
+		JAVA_LONG.withName("word_count"),
+		ADDRESS.withName("LuaCoyoteResult* results"),
+		JAVA_LONG.withName("result_count"),
+		ADDRESS.withName("int64_t* out_done"),
+	)
+
+	val luacoyote_pushtyped by method(
+		JAVA_INT,
+		LUA_STATE,
+		ADDRESS.withName("LuaCoyoteTypedFunction* f"),
+		ADDRESS.withName("const char* signature"),
+	)
+
+	val luacoyote_exporttable by method(
+		JAVA_INT,
+		LUA_STATE,
+		JAVA_INT.withName("index"),
+		ADDRESS.withName("LuaCoyoteFlatTable* flat"),
+		JAVA_INT.withName("max_depth"),
+	)
+
+	val luacoyote_importtable by method(
+		JAVA_INT,
+		LUA_STATE,
+		ADDRESS.withName("const LuaCoyoteFlatTable* flat"),
+		JAVA_INT.withName("max_depth"),
+	)
+
 	val luaL_checknumber by method(
 		JAVA_DOUBLE,
 		LUA_STATE,
@@ -0,0 +1,171 @@
+package com.catsofwar.lua
+
+import com.catsofwar.lua.enums.LuaError
+import java.lang.foreign.Arena
+import java.lang.foreign.MemorySegment
+import java.lang.foreign.ValueLayout.*
+
+/**
+* A table copied out of (or into) a state in one call, laid out as
+* `luacoyote_exporttable` describes: a tag and a 64-bit value per slot, in
+* pre-order, with strings in a separate byte area.
+*
+* Read an export by walking slots from 0: a [TABLE] slot is followed by
+* [arrayCountAt] array values, then [hashCountAt] key/value pairs. Build one
+* for [importTo] the same way with [beginTable] and the `put` methods.
+*/
+class LuaFlatTable(private val arena: Arena = Arena.ofAuto())
+{
+	private val header = arena.allocate(HEADER_SIZE, JAVA_LONG.byteAlignment())
+	private var tags = MemorySegment.NULL
+	private var values = MemorySegment.NULL
+	private var strings = MemorySegment.NULL
+
+	/** slots in use */
+	var slotCount = 0L
+		private set
+
+	/** bytes of the string area in use */
+	var stringBytes = 0L
+		private set
+
+	private fun ensure(slots: Long, bytes: Long)
+	{
+		if (tags.byteSize() < slots)
+		{
+			val cap = maxOf(slots, tags.byteSize() * 2, 64L)
+			val t = arena.allocate(cap)
+			val v = arena.allocate(JAVA_LONG, cap)
+			MemorySegment.copy(tags, 0L, t, 0L, tags.byteSize())
+			MemorySegment.copy(values, 0L, v, 0L, values.byteSize())
+			tags = t
+			values = v
+		}
+		if (strings.byteSize() < bytes)
+		{
+			val cap = maxOf(bytes, strings.byteSize() * 2, 256L)
+			val s = arena.allocate(cap, JAVA_LONG.byteAlignment())
+			MemorySegment.copy(strings, 0L, s, 0L, strings.byteSize())
+			strings = s
+		}
+	}
+
+	private fun syncHeader(used: Boolean)
+	{
+		header[ADDRESS, 0L] = tags
+		header[ADDRESS, 8L] = values
+		header[JAVA_LONG, 16L] = tags.byteSize()
+		header[ADDRESS, 24L] = strings
+		header[JAVA_LONG, 32L] = strings.byteSize()
+		if (used)
+		{
+			header[JAVA_LONG, 40L] = slotCount
+			header[JAVA_LONG, 48L] = stringBytes
+		}
+	}
+
+	/**
+	* Copies the table at [index] of [lua], growing the buffers and trying
+	* again if it didn't fit.
+	*/
+	fun exportFrom(lua: LuaCoyote, index: Int, maxDepth: Int = DEFAULT_DEPTH): LuaError
+	{
+		val at = lua.toAbsoluteIndex(index)
+		while (true)
+		{
+			syncHeader(false)
+			val status = LuaCoyote.dll.luacoyote_exporttable(lua.state, at, header, maxDepth) as Int
+			slotCount = header[JAVA_LONG, 40L]
+			stringBytes = header[JAVA_LONG, 48L]
+			if (status != SHORT)
+			{
+				return LuaError(status)
+			}
+			ensure(slotCount, stringBytes)
+		}
+	}
+
+	/** Builds the table held here in [lua] and pushes it. */
+	fun importTo(lua: LuaCoyote, maxDepth: Int = DEFAULT_DEPTH): LuaError
+	{
+		syncHeader(true)
+		return LuaError(LuaCoyote.dll.luacoyote_importtable(lua.state, header, maxDepth) as Int)
+	}
+
+	fun tagAt(slot: Long) = tags[JAVA_BYTE, slot].toInt()
+
+	fun integerAt(slot: Long) = values[JAVA_LONG, slot * 8L]
+
+	fun numberAt(slot: Long) = Double.fromBits(values[JAVA_LONG, slot * 8L])
+
+	fun booleanAt(slot: Long) = tagAt(slot) == TRUE
+
+	fun stringAt(slot: Long): String
+	{
+		val offset = values[JAVA_LONG, slot * 8L]
+		val size = strings[JAVA_LONG, offset]
+		return String(strings.asSlice(offset + 8L, size).toArray(JAVA_BYTE))
+	}
+
+	fun arrayCountAt(slot: Long) = values[JAVA_LONG, slot * 8L] and 0xFFFFFFFFL
+
+	fun hashCountAt(slot: Long) = values[JAVA_LONG, slot * 8L] ushr 32
+
+	fun clear()
+	{
+		slotCount = 0
+		stringBytes = 0
+	}
+
+	private fun put(tag: Int, value: Long)
+	{
+		ensure(slotCount + 1, 0L)
+		tags[JAVA_BYTE, slotCount] = tag.toByte()
+		values[JAVA_LONG, slotCount * 8L] = value
+		slotCount++
+	}
+
+	/** Starts a table; its [arrayCount] values and [hashCount] pairs are put next. */
+	fun beginTable(arrayCount: Int, hashCount: Int = 0)
+	{
+		put(TABLE, (arrayCount.toLong() and 0xFFFFFFFFL) or (hashCount.toLong() shl 32))
+	}
+
+	fun putNil() = put(NIL, 0L)
+	fun putBoolean(v: Boolean) = put(if (v) TRUE else FALSE, 0L)
+	fun putInteger(v: Long) = put(INTEGER, v)
+	fun putNumber(v: Double) = put(NUMBER, v.toRawBits())
+
+	fun putString(s: String)
+	{
+		val bytes = s.toByteArray()
+		// length, bytes and a terminator, padded to keep lengths aligned
+		val need = (8L + bytes.size + 1L + 7L) and 7L.inv()
+		ensure(0L, stringBytes + need)
+		strings[JAVA_LONG, stringBytes] = bytes.size.toLong()
+		MemorySegment.copy(bytes, 0, strings, JAVA_BYTE, stringBytes + 8L, bytes.size)
+		strings.asSlice(stringBytes + 8L + bytes.size, need - 8L - bytes.size).fill(0)
+		put(STRING, stringBytes)
+		stringBytes += need
+	}
+
+	companion object
+	{
+		// must match LuaCoyoteFlatTag in luacoyote.hpp
+		const val NIL = 0
+		const val FALSE = 1
+		const val TRUE = 2
+		const val INTEGER = 3
+		const val NUMBER = 4
+		const val STRING = 5
+		const val TABLE = 6
+
+		const val DEFAULT_DEPTH = 32
+
+		// LUACOYOTE_FLAT_SHORT
+		private const val SHORT = -1
+
+		// sizeof(LuaCoyoteFlatTable)
+		private const val HEADER_SIZE = 56L
+	}
+}
@@ -0,0 +1,98 @@
+package com.catsofwar.lua
+
+import com.catsofwar.lua.enums.LuaType
+import java.lang.foreign.MemorySegment
+import java.lang.foreign.ValueLayout.*
+
+/**
+* A host function whose arguments come already read, by the signature it
+* was pushed with (see [LuaCoyote.pushTyped] and `luacoyote_pushtyped`), so
+* the common case doesn't call back into Lua to get at them.
+*
+* Results go into [results] the same way; return how many were set, or a
+* negative count to raise `results[0]` as an error.
+*/
+fun interface LuaTypedFunction
+{
+	// same trick as LuaCFunction, all three are addresses to the JVM
+	@Suppress("INAPPLICABLE_JVM_NAME")
+	@JvmName("invoke")
+	operator fun LuaCoyote.invoke (args: LuaTypedValues, results: LuaTypedValues): Int
+}
+
+/**
+* A block of `LuaCoyoteResult` slots. Strings and userdata read from
+* arguments are only good until the function returns.
+*/
+@JvmInline
+value class LuaTypedValues internal constructor(private val segment: MemorySegment)
+{
+	private val mem get() = segment.reinterpret(SLOT_SIZE * MAX_SLOTS)
+
+	private fun slot(i: Int): Long
+	{
+		if (i !in 0..<MAX_SLOTS)
+			throw IndexOutOfBoundsException("No typed value slot $i")
+		return SLOT_SIZE * i
+	}
+
+	fun typeAt(i: Int) = LuaType(mem[JAVA_LONG, slot(i)].toInt())
+
+	fun isNil(i: Int) = typeAt(i) == LuaType.NIL
+
+	fun integer(i: Int): Long
+	{
+		val at = slot(i)
+		if (mem[JAVA_LONG, at + 8L] == 1L)
+			return mem[JAVA_LONG, at + 16L]
+		return mem[JAVA_DOUBLE, at + 16L].toLong()
+	}
+
+	fun number(i: Int): Double
+	{
+		val at = slot(i)
+		if (mem[JAVA_LONG, at + 8L] == 1L)
+			return mem[JAVA_LONG, at + 16L].toDouble()
+		return mem[JAVA_DOUBLE, at + 16L]
+	}
+
+	fun boolean(i: Int) = mem[JAVA_LONG, slot(i) + 16L] != 0L
+
+	fun pointer(i: Int): MemorySegment = mem[ADDRESS, slot(i) + 16L]
+
+	fun string(i: Int): String?
+	{
+		if (typeAt(i) != LuaType.STRING)
+			return null
+		val at = slot(i)
+		val size = mem[JAVA_LONG, at + 8L]
+		return String(mem[ADDRESS, at + 16L].reinterpret(size).toArray(JAVA_BYTE))
+	}
+
+	private fun set(i: Int, type: LuaType, size: Long, value: Long)
+	{
+		val at = slot(i)
+		mem[JAVA_LONG, at] = type.id.toLong()
+		mem[JAVA_LONG, at + 8L] = size
+		mem[JAVA_LONG, at + 16L] = value
+	}
+
+	fun setNil(i: Int) = set(i, LuaType.NIL, 0L, 0L)
+	fun setBoolean(i: Int, v: Boolean) = set(i, LuaType.BOOLEAN, 0L, if (v) 1L else 0L)
+	fun setInteger(i: Int, v: Long) = set(i, LuaType.NUMBER, 1L, v)
+	fun setNumber(i: Int, v: Double) = set(i, LuaType.NUMBER, 0L, v.toRawBits())
+	fun setPointer(i: Int, v: MemorySegment) = set(i, LuaType.LIGHTUSERDATA, 0L, v.address())
+
+	/** a string in memory that outlives the call, like a constant */
+	fun setString(i: Int, v: MemorySegment) = set(i, LuaType.STRING, v.byteSize(), v.address())
+
+	/** takes the next value the function pushed onto the stack itself */
+	fun setPushed(i: Int) = set(i, LuaType.NONE, 0L, 0L)
+
+	companion object
+	{
+		// sizeof(LuaCoyoteResult), LUACOYOTE_TYPED_MAXARGS/MAXRESULTS
+		private const val SLOT_SIZE = 24L
+		const val MAX_SLOTS = 8
+	}
+}